@@ -0,0 +1,246 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "mbo_event.h"
+#include "mbp_writer.h"
+#include "order_book.h"
+#include "output_buffer.h"
+
+// Derived top-of-book analytics (--analytics): mid, microprice, depth
+// imbalance over the top N levels, and the cumulative traded volume and
+// VWAP of the 'T' rows. They are kept up to date as each book changes,
+// from what the update reports (BookUpdate), instead of being recomputed
+// from a snapshot or re-derived from mbp.csv afterwards.
+
+// One row of the analytics stream, and the record of its binary form.
+// Prices are in --price-scale units, like the snapshots'.
+struct AnalyticsRecord {
+    int64_t ts_event;
+    uint32_t instrument_id;
+    uint32_t reserved;
+    int64_t bid_px;    // Best bid, or kUndefPrice if the side is empty
+    int64_t ask_px;    // Best ask, or kUndefPrice
+    int64_t bid_depth; // Size resting in the top N bid levels
+    int64_t ask_depth; // Size resting in the top N ask levels
+    int64_t volume;    // Traded size since the start of the feed
+    double mid;        // NaN unless both sides have a level
+    double microprice; // Mid weighted towards the thinner side; NaN as mid
+    double imbalance;  // (bid_depth - ask_depth) / (bid_depth + ask_depth); NaN if both are 0
+    double vwap;       // Volume-weighted price of all trades; NaN before the first
+};
+static_assert(sizeof(AnalyticsRecord) == 88, "AnalyticsRecord must be unpadded");
+
+inline constexpr char kAnalyticsMagic[8] = {'M', 'B', 'P', 'A', 'N', 'L', 'Y', '\0'};
+
+// The best `depth` levels of one side, best first, with their total size.
+//
+// A change at a level that is already cached only updates its size, and a
+// change behind the last cached level is ignored outright. The levels are
+// walked again only when one appears or disappears among the top `depth`,
+// which costs `depth` iterator steps, as within_top does.
+class TopLevels {
+public:
+    explicit TopLevels(int depth) : depth_(static_cast<size_t>(depth)) { levels_.reserve(depth_); }
+
+    // Applies a change of the level at `price` to `size` (0 if it was
+    // erased). `side` is the book side after the change. Returns true if
+    // the best level or the total changed.
+    template<typename Levels>
+    bool update(const Levels& side, int64_t price, int64_t size) {
+        if (levels_.size() == depth_ && side.key_comp()(levels_.back().price, price)) {
+            return false; // Behind the top `depth` levels
+        }
+        if (size > 0) {
+            for (size_t i = 0; i < levels_.size(); ++i) {
+                if (levels_[i].price == price) {
+                    if (levels_[i].size == size) {
+                        return false;
+                    }
+                    total_ += size - levels_[i].size;
+                    levels_[i].size = size;
+                    return true;
+                }
+            }
+        }
+        const int64_t best = best_price();
+        const int64_t best_size = this->best_size();
+        const int64_t total = total_;
+        rebuild(side);
+        return best != best_price() || best_size != this->best_size() || total != total_;
+    }
+
+    template<typename Levels>
+    void rebuild(const Levels& side) {
+        levels_.clear();
+        total_ = 0;
+        for (auto it = side.begin(); it != side.end() && levels_.size() < depth_; ++it) {
+            levels_.push_back({it->first, it->second.total_size});
+            total_ += it->second.total_size;
+        }
+    }
+
+    bool empty() const { return levels_.empty(); }
+    int64_t best_price() const { return levels_.empty() ? kUndefPrice : levels_.front().price; }
+    int64_t best_size() const { return levels_.empty() ? 0 : levels_.front().size; }
+    int64_t total() const { return total_; }
+
+private:
+    struct Level {
+        int64_t price;
+        int64_t size;
+    };
+
+    size_t depth_;
+    std::vector<Level> levels_;
+    int64_t total_{0};
+};
+
+// The analytics of one instrument's book. update() is called after every
+// event applied to the book, with what the book reported.
+class BookAnalytics {
+public:
+    explicit BookAnalytics(int depth) : bids_(depth), asks_(depth) {}
+
+    // Folds in `ev` and the update it made to `book`. Returns true if any
+    // analytics value changed.
+    template<typename Book>
+    bool update(const MboEvent& ev, const BookUpdate& u, const Book& book) {
+        bool changed = false;
+        if (ev.action == 'T' && ev.size > 0) {
+            // Every trade counts, 'N'-side ones included, though only
+            // those against a resting side change the book.
+            volume_ += ev.size;
+            notional_ += static_cast<double>(ev.price) * static_cast<double>(ev.size);
+            changed = true;
+        }
+        if (u.other_level) {
+            bids_.rebuild(book.bids());
+            asks_.rebuild(book.asks());
+            return true;
+        }
+        if (u.side == 'B') {
+            changed = bids_.update(book.bids(), u.price, u.level_size) || changed;
+        } else if (u.side == 'A') {
+            changed = asks_.update(book.asks(), u.price, u.level_size) || changed;
+        }
+        return changed;
+    }
+
+    void fill(AnalyticsRecord& rec, int64_t ts_event, uint32_t instrument_id) const {
+        constexpr double kNaN = std::numeric_limits<double>::quiet_NaN();
+        rec.ts_event = ts_event;
+        rec.instrument_id = instrument_id;
+        rec.reserved = 0;
+        rec.bid_px = bids_.best_price();
+        rec.ask_px = asks_.best_price();
+        rec.bid_depth = bids_.total();
+        rec.ask_depth = asks_.total();
+        rec.volume = volume_;
+        if (!bids_.empty() && !asks_.empty()) {
+            const double bid = static_cast<double>(rec.bid_px);
+            const double ask = static_cast<double>(rec.ask_px);
+            const double bid_sz = static_cast<double>(bids_.best_size());
+            const double ask_sz = static_cast<double>(asks_.best_size());
+            rec.mid = (bid + ask) / 2;
+            rec.microprice = (bid * ask_sz + ask * bid_sz) / (bid_sz + ask_sz);
+        } else {
+            rec.mid = kNaN;
+            rec.microprice = kNaN;
+        }
+        const int64_t depth = rec.bid_depth + rec.ask_depth;
+        rec.imbalance = depth > 0 ? static_cast<double>(rec.bid_depth - rec.ask_depth) / static_cast<double>(depth)
+                                  : kNaN;
+        rec.vwap = volume_ > 0 ? notional_ / static_cast<double>(volume_) : kNaN;
+    }
+
+private:
+    TopLevels bids_;
+    TopLevels asks_;
+    int64_t volume_{0};
+    double notional_{0}; // Sum of price * size; a double, as it outgrows int64 within a day
+};
+
+// Writes AnalyticsRecords into an OutputBuffer as CSV text, or as the
+// records themselves after an MbpFileHeader whose magic is
+// kAnalyticsMagic and whose depth is the imbalance depth.
+class AnalyticsWriter {
+public:
+    AnalyticsWriter(OutputBuffer& out, bool binary, int depth, int64_t price_scale)
+        : out_(out), binary_(binary), depth_(depth), price_scale_(price_scale) {}
+
+    void write_header() {
+        if (binary_) {
+            MbpFileHeader h{};
+            std::memcpy(h.magic, kAnalyticsMagic, sizeof(h.magic));
+            h.version = kMbpVersion;
+            h.depth = static_cast<uint16_t>(depth_);
+            h.header_size = sizeof(MbpFileHeader);
+            h.record_size = sizeof(AnalyticsRecord);
+            h.price_scale = price_scale_;
+            h.undef_price = kUndefPrice;
+            out_.append(reinterpret_cast<const char*>(&h), sizeof(h));
+            return;
+        }
+        out_.append(kCsvHeader, sizeof(kCsvHeader) - 1);
+    }
+
+    void write(const AnalyticsRecord& rec) {
+        if (binary_) {
+            out_.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+            return;
+        }
+        char* p = out_.reserve(kMaxCsvRow);
+        p = std::to_chars(p, p + 20, rec.ts_event).ptr;
+        *p++ = ',';
+        p = std::to_chars(p, p + 10, rec.instrument_id).ptr;
+        p = put_price(p, rec.bid_px);
+        p = put_price(p, rec.ask_px);
+        p = put_real(p, rec.mid, 2);
+        p = put_real(p, rec.microprice, 2);
+        p = put_real(p, rec.imbalance, 6);
+        *p++ = ',';
+        p = std::to_chars(p, p + 20, rec.bid_depth).ptr;
+        *p++ = ',';
+        p = std::to_chars(p, p + 20, rec.ask_depth).ptr;
+        *p++ = ',';
+        p = std::to_chars(p, p + 20, rec.volume).ptr;
+        p = put_real(p, rec.vwap, 2);
+        *p++ = '\n';
+        out_.commit(p);
+    }
+
+private:
+    static constexpr char kCsvHeader[] =
+        "ts_event,instrument_id,bid_px,ask_px,mid,microprice,imbalance,bid_depth,ask_depth,volume,vwap\n";
+
+    // A fixed-point price or derived value is at most 20 integer digits,
+    // a point and 6 decimals; the rest of the row is as in write_csv.
+    static constexpr size_t kMaxReal = 1 + 1 + 20 + 1 + 6;
+    static constexpr size_t kMaxCsvRow = 20 + 11 + 2 * 21 + 4 * kMaxReal + 3 * 21 + 1;
+
+    static char* put_price(char* p, int64_t px) {
+        *p++ = ',';
+        return px == kUndefPrice ? p : std::to_chars(p, p + 20, px).ptr;
+    }
+
+    // Fixed notation; an undefined (NaN) value is an empty field.
+    static char* put_real(char* p, double value, int decimals) {
+        *p++ = ',';
+        if (std::isnan(value)) {
+            return p;
+        }
+        return std::to_chars(p, p + kMaxReal, value, std::chars_format::fixed, decimals).ptr;
+    }
+
+    OutputBuffer& out_;
+    bool binary_;
+    int depth_;
+    int64_t price_scale_;
+};
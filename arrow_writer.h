@@ -0,0 +1,493 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "output_buffer.h"
+#include "spsc_queue.h"
+
+// Columnar output in the Arrow IPC file format (Feather v2), written by
+// hand so the build needs no Arrow library. Rows are transposed into the
+// column buffers of a record batch as they arrive; full batches are
+// encoded and written on a background thread. The file can be memory-
+// mapped by pyarrow, polars or DuckDB, which read only the columns asked
+// for.
+//
+// Format reference: https://arrow.apache.org/docs/format/Columnar.html.
+// Only what MBP output needs is supported: non-nested fixed-width
+// columns, one-character strings, no compression and no dictionaries.
+
+namespace detail {
+// Minimal FlatBuffers builder, enough for Arrow's IPC metadata. Like the
+// reference builder it writes back to front, so each object is complete
+// before the ones that point at it and every offset points forward.
+// Objects are referred to by their distance from the end of the buffer.
+class FlatBuilder {
+public:
+    using Ref = uint32_t;
+
+    Ref size() const { return static_cast<Ref>(buf_.size() - head_); }
+
+    template<typename T>
+    void push(T value) {
+        align(sizeof(T), sizeof(T));
+        prepend(&value, sizeof(T));
+    }
+
+    Ref string(std::string_view s) {
+        align(s.size() + 1, 4);
+        const char nul = '\0';
+        prepend(&nul, 1);
+        prepend(s.data(), s.size());
+        push(static_cast<uint32_t>(s.size()));
+        return size();
+    }
+
+    // A vector of tables, strings or other vectors.
+    Ref ref_vector(const std::vector<Ref>& refs) {
+        for (size_t i = refs.size(); i-- > 0;) {
+            push_ref(refs[i]);
+        }
+        push(static_cast<uint32_t>(refs.size()));
+        return size();
+    }
+
+    // A vector of structs, stored inline.
+    template<typename T>
+    Ref struct_vector(const std::vector<T>& items) {
+        align(items.size() * sizeof(T), std::max<size_t>(alignof(T), 4));
+        prepend(items.data(), items.size() * sizeof(T));
+        push(static_cast<uint32_t>(items.size()));
+        return size();
+    }
+
+    // Tables are built one at a time: start_table(), then the fields in
+    // any order, then end_table(). Anything the table refers to must be
+    // built before start_table().
+    void start_table() {
+        fields_.clear();
+        table_start_ = size();
+    }
+
+    template<typename T>
+    void add(uint16_t slot, T value) {
+        push(value);
+        fields_.push_back({slot, size()});
+    }
+
+    void add_ref(uint16_t slot, Ref ref) {
+        push_ref(ref);
+        fields_.push_back({slot, size()});
+    }
+
+    Ref end_table() {
+        push<int32_t>(0); // Offset to the vtable, patched below
+        const Ref table = size();
+        uint16_t slots = 0;
+        for (const Field& f : fields_) {
+            slots = std::max<uint16_t>(slots, f.slot + 1);
+        }
+        // The vtable: its own size, the table's size, then the position
+        // of each field in the table, 0 for absent ones.
+        std::vector<uint16_t> vtable(2 + slots, 0);
+        vtable[0] = static_cast<uint16_t>(vtable.size() * sizeof(uint16_t));
+        vtable[1] = static_cast<uint16_t>(table - table_start_);
+        for (const Field& f : fields_) {
+            vtable[2 + f.slot] = static_cast<uint16_t>(table - f.at);
+        }
+        prepend(vtable.data(), vtable.size() * sizeof(uint16_t));
+        const int32_t to_vtable = static_cast<int32_t>(size() - table);
+        std::memcpy(buf_.data() + buf_.size() - table, &to_vtable, sizeof(to_vtable));
+        return table;
+    }
+
+    // Completes the buffer with `root` as its root table. The result, a
+    // multiple of 8 bytes, stays valid until the builder is next used.
+    std::string_view finish(Ref root) {
+        align(sizeof(uint32_t), max_align_);
+        push_ref(root);
+        return std::string_view(reinterpret_cast<const char*>(buf_.data() + head_), size());
+    }
+
+    void clear() {
+        head_ = buf_.size();
+        max_align_ = 8;
+    }
+
+private:
+    struct Field {
+        uint16_t slot;
+        Ref at;
+    };
+
+    // Pads so that `n` bytes prepended next end up aligned to `alignment`.
+    void align(size_t n, size_t alignment) {
+        max_align_ = std::max(max_align_, alignment);
+        static constexpr char kZeros[16] = {};
+        prepend(kZeros, (alignment - (size() + n) % alignment) % alignment);
+    }
+
+    void push_ref(Ref ref) {
+        align(sizeof(uint32_t), sizeof(uint32_t));
+        push(static_cast<uint32_t>(size() + sizeof(uint32_t) - ref));
+    }
+
+    void prepend(const void* data, size_t n) {
+        if (head_ < n) {
+            // Grow at the front, keeping the contents at the end.
+            const size_t used = size();
+            std::vector<uint8_t> bigger(std::max(buf_.size() * 2, used + n + 256));
+            std::memcpy(bigger.data() + bigger.size() - used, buf_.data() + head_, used);
+            head_ = bigger.size() - used;
+            buf_.swap(bigger);
+        }
+        head_ -= n;
+        std::memcpy(buf_.data() + head_, data, n);
+    }
+
+    std::vector<uint8_t> buf_;
+    size_t head_{0};
+    size_t max_align_{8};
+    std::vector<Field> fields_;
+    Ref table_start_{0};
+};
+} // namespace detail
+
+// Value types of Arrow columns. kChar is a string of exactly one
+// character (utf8), such as a side code, and cannot be null.
+enum class ArrowType : uint8_t { kUInt8, kInt32, kUInt32, kInt64, kTimestampNs, kChar };
+
+constexpr size_t arrow_width(ArrowType type) {
+    switch (type) {
+        case ArrowType::kUInt8:
+        case ArrowType::kChar:
+            return 1;
+        case ArrowType::kInt32:
+        case ArrowType::kUInt32:
+            return 4;
+        default:
+            return 8;
+    }
+}
+
+struct ArrowField {
+    std::string name;
+    ArrowType type;
+    bool nullable;
+};
+
+// The column buffers of one record batch, filled a row at a time: set or
+// null every column of the row, then ArrowFileWriter::commit_row().
+class ArrowBatch {
+public:
+    static constexpr size_t kRows = 1 << 14;
+
+    explicit ArrowBatch(const std::vector<ArrowField>& fields) : columns_(fields.size()) {
+        for (size_t c = 0; c < fields.size(); ++c) {
+            columns_[c].values.reset(new uint8_t[kRows * arrow_width(fields[c].type)]);
+            columns_[c].validity.reset(new uint8_t[kRows / 8]);
+        }
+        clear();
+    }
+
+    template<typename T>
+    void set(size_t column, T value) {
+        reinterpret_cast<T*>(columns_[column].values.get())[rows_] = value;
+    }
+
+    template<typename T>
+    void set_null(size_t column) {
+        Column& col = columns_[column];
+        reinterpret_cast<T*>(col.values.get())[rows_] = 0;
+        col.validity[rows_ >> 3] &= static_cast<uint8_t>(~(1u << (rows_ & 7)));
+        ++col.nulls;
+    }
+
+    size_t rows() const { return rows_; }
+
+private:
+    friend class ArrowFileWriter;
+
+    struct Column {
+        std::unique_ptr<uint8_t[]> values;
+        std::unique_ptr<uint8_t[]> validity; // Bit per row, LSB first; 1 = valid
+        int64_t nulls{0};
+    };
+
+    void clear() {
+        for (Column& col : columns_) {
+            std::memset(col.validity.get(), 0xFF, kRows / 8);
+            col.nulls = 0;
+        }
+        rows_ = 0;
+    }
+
+    std::vector<Column> columns_;
+    size_t rows_{0};
+};
+
+// Writes an Arrow IPC file of `fields` into an OutputBuffer, which the
+// writer's thread uses exclusively until finish(). `metadata` becomes the
+// schema's key/value metadata.
+class ArrowFileWriter {
+public:
+    using Metadata = std::vector<std::pair<std::string, std::string>>;
+
+    ArrowFileWriter(OutputBuffer& out, std::vector<ArrowField> fields, Metadata metadata)
+        : out_(out), fields_(std::move(fields)), metadata_(std::move(metadata)), full_(kBatches), free_(kBatches) {
+        for (size_t i = 0; i < kBatches; ++i) {
+            storage_.push_back(std::make_unique<ArrowBatch>(fields_));
+        }
+        current_ = storage_[0].get();
+        for (size_t i = 1; i < kBatches; ++i) {
+            free_.push(storage_[i].get());
+        }
+        thread_ = std::thread([this] { write_file(); });
+    }
+
+    ArrowFileWriter(const ArrowFileWriter&) = delete;
+    ArrowFileWriter& operator=(const ArrowFileWriter&) = delete;
+
+    ~ArrowFileWriter() { finish(); }
+
+    // The batch the next row goes into.
+    ArrowBatch& batch() { return *current_; }
+
+    void commit_row() {
+        if (++current_->rows_ == ArrowBatch::kRows) {
+            full_.push(current_);
+            free_.pop(current_);
+        }
+    }
+
+    // Writes the last batch and the footer and stops the thread. Closing
+    // the OutputBuffer is left to its owner.
+    void finish() {
+        if (!thread_.joinable()) {
+            return;
+        }
+        if (current_->rows_ > 0) {
+            full_.push(current_);
+        }
+        full_.close();
+        thread_.join();
+    }
+
+private:
+    // Batches circulating between the row producer and the thread: one
+    // being filled, one being written and one queued between them.
+    static constexpr size_t kBatches = 3;
+
+    // Alignment of every buffer in a batch body, as Arrow recommends for
+    // SIMD access to a mapped file.
+    static constexpr size_t kBufferAlignment = 64;
+
+    enum MessageHeader : uint8_t { kSchema = 1, kRecordBatch = 3 };
+    static constexpr int16_t kMetadataV5 = 4;
+
+    // Schema.fbs `Buffer` and Message.fbs `FieldNode`.
+    struct BufferSpec {
+        int64_t offset;
+        int64_t length;
+    };
+    struct FieldNode {
+        int64_t length;
+        int64_t null_count;
+    };
+    // File.fbs `Block`: where a record batch message sits in the file.
+    struct Block {
+        int64_t offset;
+        int32_t metadata_length;
+        int32_t pad;
+        int64_t body_length;
+    };
+
+    void write_file() {
+        static constexpr char kMagic[8] = {'A', 'R', 'R', 'O', 'W', '1', '\0', '\0'};
+        put(kMagic, sizeof(kMagic));
+
+        fb_.clear();
+        const detail::FlatBuilder::Ref schema = build_schema();
+        write_message(kSchema, schema, 0);
+
+        ArrowBatch* batch;
+        while (full_.pop(batch)) {
+            write_batch(*batch);
+            batch->clear();
+            free_.push(batch);
+        }
+
+        static constexpr uint32_t kEndOfStream[2] = {0xFFFFFFFF, 0};
+        put(kEndOfStream, sizeof(kEndOfStream));
+
+        fb_.clear();
+        const detail::FlatBuilder::Ref footer_schema = build_schema();
+        const detail::FlatBuilder::Ref dictionaries = fb_.struct_vector(std::vector<Block>{});
+        const detail::FlatBuilder::Ref batches = fb_.struct_vector(blocks_);
+        fb_.start_table();
+        fb_.add(0, kMetadataV5);
+        fb_.add_ref(1, footer_schema);
+        fb_.add_ref(2, dictionaries);
+        fb_.add_ref(3, batches);
+        const std::string_view footer = fb_.finish(fb_.end_table());
+        put(footer.data(), footer.size());
+        const int32_t footer_size = static_cast<int32_t>(footer.size());
+        put(&footer_size, sizeof(footer_size));
+        put(kMagic, 6);
+    }
+
+    detail::FlatBuilder::Ref build_schema() {
+        using Ref = detail::FlatBuilder::Ref;
+        std::vector<Ref> fields;
+        for (const ArrowField& field : fields_) {
+            const Ref name = fb_.string(field.name);
+            const Ref children = fb_.ref_vector({});
+            uint8_t type_id;
+            Ref type;
+            if (field.type == ArrowType::kTimestampNs) {
+                const Ref timezone = fb_.string("UTC");
+                fb_.start_table();
+                fb_.add<int16_t>(0, 3); // NANOSECOND
+                fb_.add_ref(1, timezone);
+                type = fb_.end_table();
+                type_id = 10; // Timestamp
+            } else if (field.type == ArrowType::kChar) {
+                fb_.start_table();
+                type = fb_.end_table();
+                type_id = 5; // Utf8
+            } else {
+                fb_.start_table();
+                fb_.add<int32_t>(0, static_cast<int32_t>(arrow_width(field.type) * 8));
+                fb_.add<uint8_t>(1, field.type == ArrowType::kInt32 || field.type == ArrowType::kInt64);
+                type = fb_.end_table();
+                type_id = 2; // Int
+            }
+            fb_.start_table();
+            fb_.add_ref(0, name);
+            fb_.add<uint8_t>(1, field.nullable);
+            fb_.add<uint8_t>(2, type_id);
+            fb_.add_ref(3, type);
+            fb_.add_ref(5, children);
+            fields.push_back(fb_.end_table());
+        }
+        std::vector<Ref> metadata;
+        for (const auto& [key, value] : metadata_) {
+            const Ref k = fb_.string(key);
+            const Ref v = fb_.string(value);
+            fb_.start_table();
+            fb_.add_ref(0, k);
+            fb_.add_ref(1, v);
+            metadata.push_back(fb_.end_table());
+        }
+        const Ref field_vector = fb_.ref_vector(fields);
+        const Ref metadata_vector = fb_.ref_vector(metadata);
+        fb_.start_table();
+        fb_.add<int16_t>(0, 0); // Little-endian
+        fb_.add_ref(1, field_vector);
+        fb_.add_ref(2, metadata_vector);
+        return fb_.end_table();
+    }
+
+    // Writes an encapsulated message: continuation marker, metadata
+    // length, the Message flatbuffer, then (by the caller) the body.
+    // Returns the size of everything before the body.
+    int32_t write_message(MessageHeader kind, detail::FlatBuilder::Ref header, int64_t body_length) {
+        fb_.start_table();
+        fb_.add(0, kMetadataV5);
+        fb_.add<uint8_t>(1, kind);
+        fb_.add_ref(2, header);
+        fb_.add(3, body_length);
+        const std::string_view message = fb_.finish(fb_.end_table());
+        const int32_t prefix[2] = {-1, static_cast<int32_t>(message.size())};
+        put(prefix, sizeof(prefix));
+        put(message.data(), message.size());
+        return static_cast<int32_t>(sizeof(prefix) + message.size());
+    }
+
+    void write_batch(const ArrowBatch& batch) {
+        const size_t rows = batch.rows_;
+        std::vector<FieldNode> nodes;
+        std::vector<BufferSpec> buffers;
+        int64_t body = 0;
+        auto add_buffer = [&](size_t length) {
+            buffers.push_back({body, static_cast<int64_t>(length)});
+            body += static_cast<int64_t>(padded(length));
+        };
+        for (size_t c = 0; c < fields_.size(); ++c) {
+            const ArrowBatch::Column& col = batch.columns_[c];
+            nodes.push_back({static_cast<int64_t>(rows), col.nulls});
+            add_buffer(col.nulls > 0 ? (rows + 7) / 8 : 0);
+            if (fields_[c].type == ArrowType::kChar) {
+                add_buffer((rows + 1) * sizeof(int32_t));
+            }
+            add_buffer(rows * arrow_width(fields_[c].type));
+        }
+
+        fb_.clear();
+        const detail::FlatBuilder::Ref node_vector = fb_.struct_vector(nodes);
+        const detail::FlatBuilder::Ref buffer_vector = fb_.struct_vector(buffers);
+        fb_.start_table();
+        fb_.add(0, static_cast<int64_t>(rows));
+        fb_.add_ref(1, node_vector);
+        fb_.add_ref(2, buffer_vector);
+        const detail::FlatBuilder::Ref record_batch = fb_.end_table();
+        const int64_t offset = offset_;
+        const int32_t metadata_length = write_message(kRecordBatch, record_batch, body);
+        blocks_.push_back({offset, metadata_length, 0, body});
+
+        size_t b = 0;
+        auto put_buffer = [&](const void* data) {
+            const BufferSpec& spec = buffers[b++];
+            put(data, static_cast<size_t>(spec.length));
+            put_padding(static_cast<size_t>(spec.length));
+        };
+        for (size_t c = 0; c < fields_.size(); ++c) {
+            const ArrowBatch::Column& col = batch.columns_[c];
+            put_buffer(col.validity.get());
+            if (fields_[c].type == ArrowType::kChar) {
+                offsets_.resize(rows + 1);
+                for (size_t i = 0; i <= rows; ++i) {
+                    offsets_[i] = static_cast<int32_t>(i);
+                }
+                put_buffer(offsets_.data());
+            }
+            put_buffer(col.values.get());
+        }
+    }
+
+    static size_t padded(size_t n) { return (n + kBufferAlignment - 1) / kBufferAlignment * kBufferAlignment; }
+
+    void put(const void* data, size_t n) {
+        out_.append(static_cast<const char*>(data), n);
+        offset_ += static_cast<int64_t>(n);
+    }
+
+    void put_padding(size_t n) {
+        static constexpr char kZeros[kBufferAlignment] = {};
+        put(kZeros, padded(n) - n);
+    }
+
+    OutputBuffer& out_;
+    const std::vector<ArrowField> fields_;
+    const Metadata metadata_;
+    std::vector<std::unique_ptr<ArrowBatch>> storage_;
+    SpscQueue<ArrowBatch*> full_;
+    SpscQueue<ArrowBatch*> free_;
+    ArrowBatch* current_{nullptr};
+
+    // Used by the thread only.
+    detail::FlatBuilder fb_;
+    std::vector<Block> blocks_;
+    std::vector<int32_t> offsets_;
+    int64_t offset_{0};
+
+    std::thread thread_; // Last: starts once everything above exists
+};
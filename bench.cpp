@@ -0,0 +1,1194 @@
+// Micro-benchmarks for the hot paths of reconstruction.cpp.
+// Build and run with `make bench`; `make test` and `make perf-check` run
+// the correctness and throughput regression checks instead.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <getopt.h>
+
+#include "book_arena.h"
+#include "csv_parser.h"
+#include "l3_book.h"
+#include "mbp_writer.h"
+#include "order_index.h"
+#include "reconstructor.h"
+#include "synthetic_feed.h"
+
+namespace {
+
+// Keeps the optimizer from discarding a benchmarked result.
+template<typename T>
+void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Books as reconstruction's --book map and --book flat build them.
+using HeapBook = OrderBook<MapBids, MapAsks, std::unordered_map<uint64_t, OrderInfo>>;
+using FlatBook = OrderBook<FlatBids, FlatAsks, OrderIndex>;
+
+// Runs `fn` (which performs `ops` operations) several times and returns the
+// best observed cost per operation in nanoseconds.
+template<typename Fn>
+double ns_per_op(size_t ops, Fn&& fn, int reps = 5) {
+    double best = 1e300;
+    for (int r = 0; r < reps; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto stop = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+        best = std::min(best, ns / static_cast<double>(ops));
+    }
+    return best;
+}
+
+void report(const char* name, double ns) {
+    std::printf("  %-44s %8.2f ns/op\n", name, ns);
+}
+
+// Legacy price path: double via from_chars, then scale and truncate.
+int64_t legacy_price(std::string_view field) {
+    double price_double = parse_field<double>(field);
+    return static_cast<int64_t>(price_double * 10000.0);
+}
+
+void bench_price_parse() {
+    std::printf("price parsing (scale 10000)\n");
+
+    // Databento-style prices: 9 fractional digits, mostly on a cent grid.
+    constexpr size_t kCount = 1 << 20;
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int64_t> cents(1, 500000);
+    std::uniform_int_distribution<int> sub_cent(0, 99);
+    std::string text;
+    std::vector<std::pair<size_t, size_t>> spans;
+    spans.reserve(kCount);
+    char buf[32];
+    for (size_t i = 0; i < kCount; ++i) {
+        int64_t c = cents(rng);
+        int extra = i % 8 == 0 ? sub_cent(rng) : 0;
+        int len = std::snprintf(buf, sizeof(buf), "%lld.%02lld%02d00000",
+                                static_cast<long long>(c / 100),
+                                static_cast<long long>(c % 100), extra);
+        spans.emplace_back(text.size(), static_cast<size_t>(len));
+        text.append(buf, static_cast<size_t>(len));
+    }
+    std::vector<std::string_view> fields;
+    fields.reserve(kCount);
+    for (auto [off, len] : spans) {
+        fields.emplace_back(text.data() + off, len);
+    }
+
+    PriceScale scale = PriceScale::from_factor(10000);
+    double legacy_ns = ns_per_op(kCount, [&] {
+        int64_t sum = 0;
+        for (std::string_view f : fields) {
+            sum += legacy_price(f);
+        }
+        do_not_optimize(sum);
+    });
+    double fixed_ns = ns_per_op(kCount, [&] {
+        int64_t sum = 0;
+        for (std::string_view f : fields) {
+            sum += parse_price(f, scale);
+        }
+        do_not_optimize(sum);
+    });
+
+    size_t mismatches = 0;
+    for (std::string_view f : fields) {
+        mismatches += legacy_price(f) != parse_price(f, scale);
+    }
+
+    report("from_chars<double> * 10000 (legacy)", legacy_ns);
+    report("parse_price fixed-point", fixed_ns);
+    std::printf("  legacy truncation errors: %zu of %zu prices\n\n", mismatches, kCount);
+}
+
+// Order-id traffic: adds insert an id, cancels look it up and erase it.
+struct OrderOp {
+    uint64_t order_id;
+    bool is_add;
+};
+
+// Extracts the add/cancel order-id sequence from an MBO CSV file.
+std::vector<OrderOp> load_order_trace(const char* path) {
+    std::ifstream in(path, std::ios::binary);
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::vector<OrderOp> ops;
+    CsvScanner scanner;
+    scanner.for_each_row(text, [&](const CsvRow& row) {
+        char action = row.field_char(kAction);
+        if (action == 'A' || action == 'C') {
+            ops.push_back({parse_field<uint64_t>(row.field(kOrderId)), action == 'A'});
+        }
+    });
+    return ops;
+}
+
+// Synthetic steady-state book: ~`live` resting orders with sequential ids,
+// cancels picking a random resting order, and 10% cancels of unknown ids.
+std::vector<OrderOp> synthetic_order_trace(size_t count, size_t live) {
+    std::mt19937_64 rng(7);
+    std::vector<uint64_t> resting;
+    std::vector<OrderOp> ops;
+    ops.reserve(count);
+    uint64_t next_id = 1000000;
+    while (ops.size() < count) {
+        if (resting.size() < live || rng() % 2 == 0) {
+            resting.push_back(next_id);
+            ops.push_back({next_id++, true});
+        } else if (rng() % 10 == 0) {
+            ops.push_back({next_id + 1000000000ULL + rng() % 1000, false});
+        } else {
+            size_t i = rng() % resting.size();
+            ops.push_back({resting[i], false});
+            resting[i] = resting.back();
+            resting.pop_back();
+        }
+    }
+    return ops;
+}
+
+template<typename Index>
+void bench_index(const char* name, const std::vector<OrderOp>& ops) {
+    std::vector<uint64_t> adds;
+    std::vector<uint64_t> misses;
+    for (const OrderOp& op : ops) {
+        if (op.is_add) {
+            adds.push_back(op.order_id);
+        }
+    }
+    for (size_t i = 0; i < adds.size(); ++i) {
+        misses.push_back(adds[i] ^ 0x8000000000000000ULL);
+    }
+
+    double insert_ns = ns_per_op(adds.size(), [&] {
+        Index index;
+        for (uint64_t id : adds) {
+            index[id] = OrderInfo{static_cast<int64_t>(id), 'B'};
+        }
+        do_not_optimize(index.size());
+    });
+
+    Index full;
+    for (uint64_t id : adds) {
+        full[id] = OrderInfo{static_cast<int64_t>(id), 'B'};
+    }
+    double miss_ns = ns_per_op(misses.size(), [&] {
+        size_t found = 0;
+        for (uint64_t id : misses) {
+            found += full.find(id) != full.end();
+        }
+        do_not_optimize(found);
+    });
+
+    // Erase is timed on a fresh copy of the full table each repetition;
+    // the copy itself is outside the timed region.
+    double erase_ns = 1e300;
+    for (int r = 0; r < 5; ++r) {
+        Index index = full;
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t id : adds) {
+            auto it = index.find(id);
+            if (it != index.end()) {
+                index.erase(it);
+            }
+        }
+        auto stop = std::chrono::steady_clock::now();
+        do_not_optimize(index.size());
+        double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+        erase_ns = std::min(erase_ns, ns / static_cast<double>(adds.size()));
+    }
+
+    double replay_ns = ns_per_op(ops.size(), [&] {
+        Index index;
+        size_t unknown = 0;
+        for (const OrderOp& op : ops) {
+            if (op.is_add) {
+                index[op.order_id] = OrderInfo{static_cast<int64_t>(op.order_id), 'B'};
+            } else {
+                auto it = index.find(op.order_id);
+                if (it != index.end()) {
+                    index.erase(it);
+                } else {
+                    ++unknown;
+                }
+            }
+        }
+        do_not_optimize(unknown);
+    });
+
+    std::printf("  %s\n", name);
+    report("insert (growing from empty)", insert_ns);
+    report("find (miss)", miss_ns);
+    report("find + erase", erase_ns);
+    report("add/cancel replay", replay_ns);
+}
+
+void bench_order_index(const char* mbo_path) {
+    std::vector<OrderOp> ops = mbo_path ? load_order_trace(mbo_path)
+                                        : synthetic_order_trace(4000000, 200000);
+    size_t cancels = 0;
+    size_t unknown = 0;
+    {
+        std::unordered_map<uint64_t, bool> live;
+        for (const OrderOp& op : ops) {
+            if (op.is_add) {
+                live[op.order_id] = true;
+            } else {
+                ++cancels;
+                unknown += live.erase(op.order_id) == 0;
+            }
+        }
+    }
+    std::printf("order index (%s: %zu ops, %.1f%% of cancels miss)\n",
+                mbo_path ? mbo_path : "synthetic", ops.size(),
+                cancels ? 100.0 * static_cast<double>(unknown) / static_cast<double>(cancels) : 0.0);
+    bench_index<std::unordered_map<uint64_t, OrderInfo>>("std::unordered_map", ops);
+    bench_index<OrderIndex>("OrderIndex", ops);
+    std::printf("\n");
+}
+
+// Level and order node churn through OrderBook: every add inserts an
+// order node and possibly a level node, every cancel erases the order and,
+// when its level empties, the level. Prices random-walk so levels come
+// and go.
+template<typename Book, typename MakeBook>
+double book_churn_ns(const std::vector<OrderOp>& ops, MakeBook make_book) {
+    std::mt19937_64 rng(5);
+    std::vector<int64_t> prices(ops.size());
+    int64_t mid = 550000;
+    for (int64_t& px : prices) {
+        mid += static_cast<int64_t>(rng() % 3) - 1;
+        px = mid + static_cast<int64_t>(rng() % 64) - 32;
+    }
+    return ns_per_op(ops.size(), [&] {
+        Book book = make_book();
+        for (size_t i = 0; i < ops.size(); ++i) {
+            const OrderOp& op = ops[i];
+            if (op.is_add) {
+                book.add(op.order_id, 'B', prices[i], 1);
+            } else {
+                book.cancel(op.order_id, 1);
+            }
+        }
+        do_not_optimize(book.order_count());
+    });
+}
+
+void bench_book_churn() {
+    std::vector<OrderOp> ops = synthetic_order_trace(4000000, 200000);
+    std::printf("map book node churn (%zu synthetic add/cancel ops)\n", ops.size());
+    report("std::map + std::unordered_map (global heap)",
+           book_churn_ns<HeapBook>(ops, [] { return HeapBook{}; }));
+    report("std::pmr containers on a BookArena",
+           book_churn_ns<ArenaBook>(ops, &ArenaBook::make));
+    std::printf("\n");
+}
+
+// Legacy CSV encoder: the per-field std::ofstream formatting that
+// write_mbp_output used before MbpWriter.
+void legacy_write_csv(std::ostream& out, const MbpRecord& rec) {
+    out << rec.ts_event;
+    for (const BidAskPair& lvl : rec.levels) {
+        if (lvl.ask_px != kUndefPrice) {
+            out << ',' << lvl.ask_px << ',' << lvl.ask_sz << ',' << lvl.ask_ct;
+        } else {
+            out << ",,,";
+        }
+        if (lvl.bid_px != kUndefPrice) {
+            out << ',' << lvl.bid_px << ',' << lvl.bid_sz << ',' << lvl.bid_ct;
+        } else {
+            out << ",,,";
+        }
+    }
+    out << '\n';
+}
+
+void bench_csv_output() {
+    // Snapshots with a random number of populated levels per side, so the
+    // empty-level fast path is exercised as it is on thin books.
+    constexpr size_t kCount = 200000;
+    std::mt19937_64 rng(11);
+    std::vector<MbpRecord> records(kCount);
+    int64_t ts = 1752739503360677248LL;
+    for (MbpRecord& rec : records) {
+        rec.ts_event = ts += static_cast<int64_t>(rng() % 50000);
+        int bid_depth = static_cast<int>(rng() % (kMbpDepth + 1));
+        int ask_depth = static_cast<int>(rng() % (kMbpDepth + 1));
+        for (int i = 0; i < kMbpDepth; ++i) {
+            BidAskPair& lvl = rec.levels[i];
+            lvl.bid_px = i < bid_depth ? 55000 - 100 * i : kUndefPrice;
+            lvl.ask_px = i < ask_depth ? 55100 + 100 * i : kUndefPrice;
+            lvl.bid_sz = i < bid_depth ? static_cast<int64_t>(rng() % 5000) : 0;
+            lvl.ask_sz = i < ask_depth ? static_cast<int64_t>(rng() % 5000) : 0;
+            lvl.bid_ct = i < bid_depth ? static_cast<int32_t>(rng() % 30) : 0;
+            lvl.ask_ct = i < ask_depth ? static_cast<int32_t>(rng() % 30) : 0;
+        }
+    }
+
+    std::printf("CSV snapshot output (%zu snapshots to /dev/null)\n", kCount);
+    double legacy_ns = ns_per_op(kCount, [&] {
+        std::ofstream out("/dev/null");
+        for (const MbpRecord& rec : records) {
+            legacy_write_csv(out, rec);
+        }
+    });
+    double buffered_ns = ns_per_op(kCount, [&] {
+        OutputBuffer out;
+        out.open("/dev/null");
+        MbpWriter writer(out, OutputFormat::kCsv, EmitMode::kAll, 10000);
+        for (const MbpRecord& rec : records) {
+            writer.write(rec);
+        }
+        out.close();
+    });
+    report("std::ofstream operator<< (legacy)", legacy_ns);
+    report("MbpWriter to_chars + buffered write()", buffered_ns);
+    std::printf("  speedup: %.1fx\n\n", legacy_ns / buffered_ns);
+}
+
+// Per-message cost of one stage, sampled over batches of kStageBatch
+// messages: timing each message alone would mostly measure the clock.
+class StageStats {
+public:
+    static constexpr size_t kStageBatch = 1024;
+
+    void add(size_t messages, std::chrono::steady_clock::duration elapsed) {
+        double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+        batch_ns_.push_back(ns / static_cast<double>(messages));
+        messages_ += messages;
+        total_ns_ += ns;
+    }
+
+    void report(const char* stage) {
+        if (batch_ns_.empty()) {
+            return;
+        }
+        std::sort(batch_ns_.begin(), batch_ns_.end());
+        auto pct = [&](double p) {
+            return batch_ns_[static_cast<size_t>(p * static_cast<double>(batch_ns_.size() - 1))];
+        };
+        std::printf("  %-18s %8.2f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n", stage,
+                    static_cast<double>(messages_) / total_ns_ * 1e3, total_ns_ / static_cast<double>(messages_),
+                    pct(0.5), pct(0.9), pct(0.99), pct(0.999), batch_ns_.back());
+    }
+
+private:
+    std::vector<double> batch_ns_; // ns/message of each batch
+    size_t messages_{0};
+    double total_ns_{0};
+};
+
+// Calls `fn(begin, end)` over [0, count) in StageStats batches, timing each.
+template<typename Fn>
+void timed_batches(size_t count, StageStats& stats, Fn&& fn) {
+    for (size_t b = 0; b < count; b += StageStats::kStageBatch) {
+        const size_t e = std::min(count, b + StageStats::kStageBatch);
+        auto start = std::chrono::steady_clock::now();
+        fn(b, e);
+        stats.add(e - b, std::chrono::steady_clock::now() - start);
+    }
+}
+
+bool same_event(const MboEvent& a, const MboEvent& b) {
+    return a.ts_event == b.ts_event && a.price == b.price && a.size == b.size &&
+           a.order_id == b.order_id && a.instrument_id == b.instrument_id &&
+           a.action == b.action && a.side == b.side;
+}
+
+// Parse stage: CSV text to MboEvents, as reconstruction's mapped path
+// does it. Returns the events parsed.
+std::vector<MboEvent> parse_stage(const std::string& csv, size_t expected) {
+    std::string_view body = csv;
+    for (int k = 0; k < 2; ++k) { // Header and initial clear row
+        body.remove_prefix(body.find('\n') + 1);
+    }
+    StageStats stats;
+    std::vector<MboEvent> parsed;
+    parsed.reserve(expected);
+    PriceScale scale;
+    CsvScanner scanner;
+    auto start = std::chrono::steady_clock::now();
+    scanner.for_each_row(body, [&](const CsvRow& row) {
+        parsed.push_back(parse_event(row, scale));
+        if (parsed.size() % StageStats::kStageBatch == 0) {
+            auto now = std::chrono::steady_clock::now();
+            stats.add(StageStats::kStageBatch, now - start);
+            start = now;
+        }
+    });
+    if (size_t rest = parsed.size() % StageStats::kStageBatch) {
+        stats.add(rest, std::chrono::steady_clock::now() - start);
+    }
+    stats.report("parse");
+    return parsed;
+}
+
+// Apply and emit stages over one book type. Apply is what
+// Reconstructor::apply does per row: the book update and, unless the row
+// is an F, a snapshot of the top levels. Emit formats those snapshots as
+// CSV; it does not depend on the book, so callers ask for it once.
+// Events go through in windows, each applied in full before its
+// snapshots are emitted, so the two stages are timed separately.
+template<typename Book, typename MakeBook>
+void apply_emit_stages(const char* name, const std::vector<MboEvent>& events, size_t live_orders,
+                       MakeBook make_book, bool emit) {
+    constexpr size_t kWindow = 1 << 16;
+    Book book = make_book();
+    book.reserve_orders(live_orders * 2);
+    std::vector<MbpRecord> records(kWindow);
+    OutputBuffer out;
+    out.open("/dev/null");
+    MbpWriter writer(out, OutputFormat::kCsv, EmitMode::kAll, 10000);
+    writer.write_header();
+
+    StageStats apply;
+    StageStats format;
+    for (size_t w = 0; w < events.size(); w += kWindow) {
+        const MboEvent* window = events.data() + w;
+        size_t snapshots = 0;
+        timed_batches(std::min(kWindow, events.size() - w), apply, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) {
+                const MboEvent& ev = window[i];
+                switch (ev.action) {
+                    case 'A':
+                        book.add(ev.order_id, ev.side, ev.price, ev.size);
+                        break;
+                    case 'C':
+                        if (book.cancel(ev.order_id, ev.size).completes_fill) {
+                            continue;
+                        }
+                        break;
+                    case 'T':
+                        book.trade(ev.side, ev.price, ev.size);
+                        break;
+                    case 'F':
+                        book.fill(ev.order_id);
+                        continue;
+                    default:
+                        break;
+                }
+                build_snapshot(records[snapshots++], ev.ts_event, book.bids(), book.asks());
+            }
+        });
+        if (emit) {
+            timed_batches(snapshots, format, [&](size_t b, size_t e) {
+                for (size_t i = b; i < e; ++i) {
+                    writer.write(records[i]);
+                }
+            });
+        }
+    }
+    out.close();
+    apply.report(name);
+    if (emit) {
+        format.report("emit (csv)");
+    }
+}
+
+// End-to-end stages over a synthetic feed, one apply run per book type,
+// so the book implementations are compared on the same traffic.
+void bench_synthetic_stages(const FeedConfig& cfg) {
+    std::vector<MboEvent> events = SyntheticFeed(cfg).generate();
+    const std::string csv = render_mbo_csv(events);
+    const double weights = cfg.add_weight + cfg.cancel_weight + cfg.trade_weight;
+    std::printf("synthetic feed stages (%zu rows, %.0f/%.0f/%.0f%% add/cancel/trade, depth %d, "
+                "%zu live orders, volatility %.2f)\n",
+                events.size(), 100 * cfg.add_weight / weights, 100 * cfg.cancel_weight / weights,
+                100 * cfg.trade_weight / weights, cfg.depth, cfg.live_orders, cfg.volatility);
+    std::printf("  %-18s %8s %8s %8s %8s %8s %8s %8s\n", "stage", "M msg/s", "ns/msg", "p50", "p90",
+                "p99", "p99.9", "max");
+
+    std::vector<MboEvent> parsed = parse_stage(csv, events.size());
+    if (parsed.size() != events.size() ||
+        !std::equal(parsed.begin(), parsed.end(), events.begin(), same_event)) {
+        std::printf("  parsed events differ from the generated feed\n");
+    }
+
+    const int64_t tick = cfg.tick;
+    apply_emit_stages<FlatBook>("apply (flat)", events, cfg.live_orders, [tick] {
+        return FlatBook(FlatBids(tick), FlatAsks(tick), OrderIndex());
+    }, true);
+    apply_emit_stages<HeapBook>("apply (map)", events, cfg.live_orders, [] { return HeapBook{}; }, false);
+    apply_emit_stages<ArenaBook>("apply (map-arena)", events, cfg.live_orders, &ArenaBook::make, false);
+    apply_emit_stages<L3Book<>>("apply (l3)", events, cfg.live_orders, [tick] {
+        return L3Book<>(L3Bids(tick), L3Asks(tick));
+    }, false);
+    std::printf("  (percentiles are over %zu-message batches)\n\n", StageStats::kStageBatch);
+}
+
+// Collects an OutputBuffer's bytes in memory, so that outputs can be
+// compared without temporary files.
+class StringSink : public ByteSink {
+public:
+    explicit StringSink(std::string& text) : text_(text) {}
+    bool write(const char* data, size_t n) override {
+        text_.append(data, n);
+        return true;
+    }
+    bool finish() override { return true; }
+
+private:
+    std::string& text_;
+};
+
+// What reconstruction is asked to write, as far as the replay below goes.
+struct ReplayMode {
+    const char* name;
+    EmitMode emit;
+    OutputFormat format;
+    int64_t conflate_ns;
+    bool tagged;
+};
+
+// Replays `events` through a Reconstructor over `Book`, at `Depth`, and
+// returns the output reconstruction would write in `mode`: one emitter
+// per instrument on a shared writer, as in serial mode. `batched` takes
+// the prefetching path of the replay; otherwise events go in one by one.
+template<int Depth = kMbpDepth, typename Book>
+std::string replay(const std::vector<MboEvent>& events, std::function<Book()> make_book, const ReplayMode& mode,
+                   bool batched) {
+    std::string text;
+    OutputBuffer out;
+    out.attach(std::make_unique<StringSink>(text));
+    BasicMbpWriter<Depth> writer(out, mode.format, mode.emit, 10000, mode.tagged);
+    writer.write_header();
+    ReconstructorOptions opts;
+    opts.emit = mode.emit;
+    opts.conflate_ns = mode.conflate_ns;
+    Reconstructor<Book, Depth> recon(opts, std::move(make_book), 1024);
+    std::unordered_map<uint32_t, BasicSnapshotEmitter<Depth>> emitters;
+    Snapshot<Depth> snap;
+    auto emit = [&](const Snapshot<Depth>& s) {
+        auto it = emitters.try_emplace(s.instrument_id, writer, mode.emit, s.instrument_id).first;
+        it->second.emit(s.rec);
+    };
+    if (batched) {
+        recon.process(events.data(), events.size(), snap, emit);
+    } else {
+        for (const MboEvent& ev : events) {
+            recon.process(ev, snap, emit);
+        }
+    }
+    recon.flush(snap, emit);
+    writer.finish();
+    out.close();
+    return text;
+}
+
+// Calls fn(name, make_book) for each book that is checked against the
+// std::map reference: the map book itself on the batched path, and the
+// faster ones, the flat ladder also with a window narrow enough that
+// prices keep falling outside it.
+template<typename Fn>
+void for_each_level_book(int64_t tick, Fn&& fn) {
+    fn("map", std::function<HeapBook()>([] { return HeapBook{}; }));
+    fn("map-arena", std::function<ArenaBook()>(&ArenaBook::make));
+    fn("flat", std::function<FlatBook()>([] { return FlatBook(); }));
+    fn("flat (narrow ladder)", std::function<FlatBook()>([tick] {
+        return FlatBook(FlatBids(tick, 16), FlatAsks(tick, 16), OrderIndex());
+    }));
+}
+
+// The same for the L3 book, whose reference keeps its levels in std::map.
+using MapL3Book = L3Book<std::map<int64_t, L3Level, std::greater<int64_t>>, std::map<int64_t, L3Level>>;
+
+template<typename Fn>
+void for_each_l3_book(int64_t tick, Fn&& fn) {
+    fn("l3", std::function<L3Book<>()>([] { return L3Book<>(); }));
+    fn("l3 (narrow ladder)", std::function<L3Book<>()>([tick] {
+        return L3Book<>(L3Bids(tick, 16), L3Asks(tick, 16));
+    }));
+}
+
+// Prints where `got` first differs from `expected` and, for text, the
+// line of each.
+void report_mismatch(const char* what, const std::string& expected, const std::string& got, bool text) {
+    size_t line = 1;
+    size_t start = 0;
+    const size_t n = std::min(expected.size(), got.size());
+    size_t i = 0;
+    for (; i < n && expected[i] == got[i]; ++i) {
+        if (expected[i] == '\n') {
+            ++line;
+            start = i + 1;
+        }
+    }
+    auto line_at = [start](const std::string& output) {
+        const size_t end = output.find('\n', start);
+        return output.substr(start, std::min<size_t>(end, start + 120) - start);
+    };
+    if (!text) {
+        std::printf("  FAIL %s: differs at byte %zu of %zu\n", what, i, expected.size());
+        return;
+    }
+    std::printf("  FAIL %s: differs at line %zu (byte %zu)\n    expected: %s\n    got:      %s\n", what, line, i,
+                line_at(expected).c_str(), line_at(got).c_str());
+}
+
+bool check_same(const std::string& what, const std::string& expected, const std::string& got, bool text = true) {
+    if (expected == got) {
+        return true;
+    }
+    report_mismatch(what.c_str(), expected, got, text);
+    return false;
+}
+
+// A hand-written MBO sample and the MBP CSV that reconstruction must
+// write for it at `depth` (1 or 10) with `emit`. Rows are given as
+// "ts,action,side,price,size,order_id"; expected rows stop at the last
+// non-empty field, the empty levels after it are implied. `l3` is the L3
+// book's output where it differs.
+struct GoldenCase {
+    const char* name;
+    int depth;
+    EmitMode emit;
+    const char* mbo;
+    const char* mbp;
+    const char* l3;
+};
+
+const GoldenCase kGoldenCases[] = {
+    {"levels: best first, ask before bid in each pair", kMbpDepth, EmitMode::kAll,
+     "1,A,B,100.25,10,1\n"
+     "2,A,B,100.00,4,2\n"
+     "3,A,A,100.75,3,3\n"
+     "4,A,A,100.50,6,4\n"
+     "5,A,A,100.50,2,5\n"
+     "6,C,B,100.25,10,1\n"
+     "7,C,A,100.50,6,4\n",
+     "1,,,,1002500,10,1\n"
+     "2,,,,1002500,10,1,,,,1000000,4,1\n"
+     "3,1007500,3,1,1002500,10,1,,,,1000000,4,1\n"
+     "4,1005000,6,1,1002500,10,1,1007500,3,1,1000000,4,1\n"
+     "5,1005000,8,2,1002500,10,1,1007500,3,1,1000000,4,1\n"
+     "6,1005000,8,2,1000000,4,1,1007500,3,1\n"
+     "7,1005000,2,1,1000000,4,1,1007500,3,1\n",
+     nullptr},
+    // The T takes the filled size off the bids; the F and the C of the
+    // filled order only complete it, so the three make one snapshot.
+    {"T-F-C: one snapshot, the trade's", kMbpDepth, EmitMode::kAll,
+     "1,A,B,100.25,10,1\n"
+     "2,A,B,100.25,5,2\n"
+     "3,A,A,100.50,7,3\n"
+     "4,T,A,100.25,10,0\n"
+     "5,F,B,100.25,10,1\n"
+     "6,C,B,100.25,10,1\n"
+     "7,C,B,100.25,5,2\n",
+     "1,,,,1002500,10,1\n"
+     "2,,,,1002500,15,2\n"
+     "3,1005000,7,1,1002500,15,2\n"
+     "4,1005000,7,1,1002500,5,1\n"
+     "7,1005000,7,1\n",
+     nullptr},
+    {"partial fill, its order cancelled after an add", 1, EmitMode::kAll,
+     "1,A,B,100.00,10,1\n"
+     "2,T,A,100.00,4,0\n"
+     "3,F,B,100.00,4,1\n"
+     "4,A,B,100.00,5,2\n"
+     "5,C,B,100.00,6,1\n",
+     "1,,,,1000000,10,1\n"
+     "2,,,,1000000,6,0\n"
+     "4,,,,1000000,11,1\n"
+     "5,,,,1000000,5,0\n",
+     "1,,,,1000000,10,1\n"
+     "2,,,,1000000,6,1\n"
+     "4,,,,1000000,11,2\n"
+     "5,,,,1000000,5,1\n"},
+    {"'N'-side trades leave the book alone", kMbpDepth, EmitMode::kAll,
+     "1,A,B,100.25,10,1\n"
+     "2,A,A,100.50,7,2\n"
+     "3,T,N,100.25,10,0\n"
+     "4,T,N,100.50,7,0\n",
+     "1,,,,1002500,10,1\n"
+     "2,1005000,7,1,1002500,10,1\n"
+     "3,1005000,7,1,1002500,10,1\n"
+     "4,1005000,7,1,1002500,10,1\n",
+     nullptr},
+    {"cancels of unknown orders are no-ops", kMbpDepth, EmitMode::kAll,
+     "1,A,B,100.25,10,1\n"
+     "2,C,B,100.25,10,42\n"
+     "3,C,B,100.25,10,1\n"
+     "4,C,B,100.25,10,1\n"
+     "5,T,A,100.25,5,0\n",
+     "1,,,,1002500,10,1\n"
+     "2,,,,1002500,10,1\n"
+     "3\n"
+     "4\n"
+     "5\n",
+     nullptr},
+    // Re-adding a live id moves the order in the L3 book, which changes
+    // the top level although the new price is behind it. The level book
+    // keeps the old order's size where it was.
+    {"reused order id, --emit changed at depth 1", 1, EmitMode::kChanged,
+     "1,A,B,100.00,10,1\n"
+     "2,A,B,99.90,5,2\n"
+     "3,A,B,99.80,7,1\n",
+     "1,,,,1000000,10,1\n",
+     "1,,,,1000000,10,1\n"
+     "3,,,,999000,5,1\n"},
+};
+
+// Expands the short rows of a GoldenCase into an MBO CSV file, header
+// and initial 'R' row included.
+std::string golden_mbo_csv(const char* rows) {
+    std::string csv = "ts_recv,ts_event,rtype,publisher_id,instrument_id,action,side,price,size,channel_id,"
+                      "order_id,flags,ts_in_delta,sequence,symbol\n"
+                      "0,0,160,2,1108,R,N,,0,0,0,8,0,0,SYN\n";
+    for (std::string_view rest = rows; !rest.empty();) {
+        const std::string_view row = rest.substr(0, rest.find('\n'));
+        rest.remove_prefix(row.size() + 1);
+        std::string_view f[6];
+        std::string_view fields = row;
+        for (std::string_view& field : f) {
+            field = fields.substr(0, fields.find(','));
+            fields.remove_prefix(std::min(field.size() + 1, fields.size()));
+        }
+        csv.append(f[0]).append(",").append(f[0]).append(",160,2,1108,");
+        csv.append(f[1]).append(",").append(f[2]).append(",").append(f[3]).append("0000000,");
+        csv.append(f[4]).append(",0,").append(f[5]).append(",130,165200,851012,SYN\n");
+    }
+    return csv;
+}
+
+// The expected MBP CSV of a GoldenCase: the header, then each row
+// padded with the empty fields of the levels it leaves out.
+template<int Depth>
+std::string golden_mbp_csv(const char* rows) {
+    std::string csv(kCsvHeader<Depth>.data, kCsvHeader<Depth>.size());
+    constexpr size_t kFields = 1 + Depth * 6;
+    for (std::string_view rest = rows; !rest.empty();) {
+        const std::string_view row = rest.substr(0, rest.find('\n'));
+        rest.remove_prefix(row.size() + 1);
+        csv.append(row);
+        csv.append(kFields - 1 - static_cast<size_t>(std::count(row.begin(), row.end(), ',')), ',');
+        csv += '\n';
+    }
+    return csv;
+}
+
+// Parses MBO CSV text as reconstruction's mapped path does.
+std::vector<MboEvent> parse_mbo_csv(const std::string& csv) {
+    std::string_view body = csv;
+    for (int k = 0; k < 2; ++k) { // Header and initial clear row
+        body.remove_prefix(body.find('\n') + 1);
+    }
+    std::vector<MboEvent> events;
+    PriceScale scale;
+    CsvScanner scanner;
+    scanner.for_each_row(body, [&](const CsvRow& row) { events.push_back(parse_event(row, scale)); });
+    return events;
+}
+
+// One golden case through every book, per row and batched. Returns the
+// number of failures.
+template<int Depth>
+int check_golden_case(const GoldenCase& g) {
+    const ReplayMode mode{"csv", g.emit, OutputFormat::kCsv, 0, false};
+    const std::vector<MboEvent> events = parse_mbo_csv(golden_mbo_csv(g.mbo));
+    const std::string mbp = golden_mbp_csv<Depth>(g.mbp);
+    const std::string l3 = g.l3 ? golden_mbp_csv<Depth>(g.l3) : mbp;
+    int failed = 0;
+    auto run = [&](const std::string& expected, const char* book, auto make_book) {
+        const std::string what = std::string(g.name) + " [" + book + "]";
+        failed += !check_same(what, expected, replay<Depth>(events, make_book, mode, false));
+        failed += !check_same(what + " batched", expected, replay<Depth>(events, make_book, mode, true));
+    };
+    for_each_level_book(100, [&](const char* book, auto make_book) { run(mbp, book, make_book); });
+    run(l3, "l3 (std::map)", std::function<MapL3Book()>([] { return MapL3Book(); }));
+    for_each_l3_book(100, [&](const char* book, auto make_book) { run(l3, book, make_book); });
+    return failed;
+}
+
+// Every golden case. Returns the number of failures.
+int check_golden() {
+    int failures = 0;
+    for (const GoldenCase& g : kGoldenCases) {
+        const int failed = g.depth == 1 ? check_golden_case<1>(g) : check_golden_case<kMbpDepth>(g);
+        std::printf("  %-52s %s\n", g.name, failed ? "FAIL" : "ok");
+        failures += failed;
+    }
+    return failures;
+}
+
+// Two synthetic instruments interleaved row by row, plus the rows the
+// generator never makes: 'N'-side trades at the last price and cancels
+// of order ids that were never added. Round-tripped through the CSV
+// parser, as reconstruction would read them.
+std::vector<MboEvent> differential_feed(const FeedConfig& cfg) {
+    FeedConfig other = cfg;
+    other.seed = cfg.seed + 1;
+    other.instrument_id = cfg.instrument_id + 1;
+    other.start_mid = cfg.start_mid * 2;
+    const std::vector<MboEvent> a = SyntheticFeed(cfg).generate();
+    const std::vector<MboEvent> b = SyntheticFeed(other).generate();
+    std::vector<MboEvent> events;
+    events.reserve(a.size() + b.size() + (a.size() + b.size()) / 16);
+    for (size_t i = 0; i < std::max(a.size(), b.size()); ++i) {
+        for (const std::vector<MboEvent>* feed : {&a, &b}) {
+            if (i >= feed->size()) {
+                continue;
+            }
+            const MboEvent& ev = (*feed)[i];
+            events.push_back(ev);
+            if (i % 50 == 49 && ev.action != 'T') {
+                events.push_back(MboEvent{ev.ts_event, ev.price, 5, 0, ev.instrument_id, 'T', 'N'});
+            }
+            if (i % 70 == 69 && ev.action != 'T') {
+                events.push_back(MboEvent{ev.ts_event, ev.price, ev.size, (uint64_t{1} << 60) + i,
+                                          ev.instrument_id, 'C', ev.side});
+            }
+        }
+    }
+    return parse_mbo_csv(render_mbo_csv(events));
+}
+
+// Differential check of every book against its std::map reference, over
+// synthetic feeds of several shapes, in each output mode. Returns the
+// number of failures.
+int check_differential(const FeedConfig& base) {
+    static const ReplayMode kModes[] = {
+        {"all csv", EmitMode::kAll, OutputFormat::kCsv, 0, true},
+        {"changed csv", EmitMode::kChanged, OutputFormat::kCsv, 0, true},
+        {"delta csv", EmitMode::kDelta, OutputFormat::kCsv, 0, true},
+        {"all bin", EmitMode::kAll, OutputFormat::kBinary, 0, true},
+        {"changed csv, conflated", EmitMode::kChanged, OutputFormat::kCsv, 1000, true},
+    };
+    struct Shape {
+        const char* name;
+        double add, cancel, trade, volatility;
+        int depth;
+        size_t orders;
+    };
+    static const Shape kShapes[] = {
+        {"default", 0.5, 0.4, 0.1, 0.2, 20, 10000},
+        {"trade-heavy, volatile", 0.4, 0.3, 0.3, 0.9, 5, 2000},
+        {"deep, quiet", 0.5, 0.45, 0.05, 0.01, 200, 50000},
+    };
+    int failures = 0;
+    for (const Shape& shape : kShapes) {
+        FeedConfig cfg = base;
+        cfg.add_weight = shape.add;
+        cfg.cancel_weight = shape.cancel;
+        cfg.trade_weight = shape.trade;
+        cfg.volatility = shape.volatility;
+        cfg.depth = shape.depth;
+        cfg.live_orders = shape.orders;
+        const std::vector<MboEvent> events = differential_feed(cfg);
+        int failed = 0;
+        for (const ReplayMode& mode : kModes) {
+            const std::string expected =
+                replay(events, std::function<HeapBook()>([] { return HeapBook{}; }), mode, false);
+            const std::string expected_l3 =
+                replay(events, std::function<MapL3Book()>([] { return MapL3Book(); }), mode, false);
+            auto run = [&](const std::string& reference, const char* book, auto make_book) {
+                const std::string what = std::string(shape.name) + ", " + mode.name + " [" + book + "]";
+                failed += !check_same(what, reference, replay(events, make_book, mode, true),
+                                      mode.format == OutputFormat::kCsv);
+            };
+            for_each_level_book(cfg.tick, [&](const char* book, auto make_book) { run(expected, book, make_book); });
+            for_each_l3_book(cfg.tick, [&](const char* book, auto make_book) { run(expected_l3, book, make_book); });
+        }
+        std::printf("  %-52s %s\n", (std::string(shape.name) + " (" + std::to_string(events.size()) + " rows)").c_str(),
+                    failed ? "FAIL" : "ok");
+        failures += failed;
+    }
+    return failures;
+}
+
+// --check: the golden samples, then the differential check. Returns the
+// exit status.
+int run_check(const FeedConfig& cfg) {
+    std::printf("golden MBP-10 samples (every book, per row and batched)\n");
+    int failures = check_golden();
+    std::printf("differential against the std::map books (map-arena, flat, l3; all/changed/delta/bin/conflated)\n");
+    failures += check_differential(cfg);
+    std::printf(failures ? "%d check(s) failed\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}
+
+// Messages per second of the serial replay over `Book`: every event
+// applied, with a snapshot after each, as --emit all makes them. The
+// output format is left out, as it costs the same for every book. Best
+// of `reps` runs.
+template<typename Book>
+double replay_rate(const std::vector<MboEvent>& events, std::function<Book()> make_book, size_t live_orders,
+                   int reps = 5) {
+    ReconstructorOptions opts;
+    const double ns = ns_per_op(events.size(), [&] {
+        Reconstructor<Book, kMbpDepth> recon(opts, make_book, live_orders * 2);
+        Snapshot<kMbpDepth> snap;
+        int64_t sum = 0;
+        recon.process(events.data(), events.size(), snap,
+                      [&sum](const Snapshot<kMbpDepth>& s) { sum += s.rec.levels[0].bid_sz; });
+        do_not_optimize(sum);
+    }, reps);
+    return 1e9 / ns;
+}
+
+// The feed a baseline was measured on, so that it is not compared
+// against a run on another.
+std::string describe_feed(const FeedConfig& cfg) {
+    char text[160];
+    std::snprintf(text, sizeof(text), "events=%zu mix=%g,%g,%g volatility=%g depth=%d orders=%zu seed=%llu",
+                  cfg.events, cfg.add_weight, cfg.cancel_weight, cfg.trade_weight, cfg.volatility, cfg.depth,
+                  cfg.live_orders, static_cast<unsigned long long>(cfg.seed));
+    return text;
+}
+
+// --perf-check / --perf-record: messages/sec of each book on the
+// synthetic feed. Recorded into `baseline_path` if `record` is set or the
+// file does not exist yet; otherwise compared with it, failing if a book
+// is more than `tolerance` percent slower. Returns the exit status.
+int run_perf_check(const FeedConfig& cfg, const char* baseline_path, bool record, double tolerance) {
+    const std::vector<MboEvent> events = SyntheticFeed(cfg).generate();
+    const int64_t tick = cfg.tick;
+    std::vector<std::pair<std::string, double>> rates;
+    rates.emplace_back("map", replay_rate(events, std::function<HeapBook()>([] { return HeapBook{}; }),
+                                          cfg.live_orders));
+    rates.emplace_back("map-arena", replay_rate(events, std::function<ArenaBook()>(&ArenaBook::make),
+                                                cfg.live_orders));
+    rates.emplace_back("flat", replay_rate(events, std::function<FlatBook()>([tick] {
+        return FlatBook(FlatBids(tick), FlatAsks(tick), OrderIndex());
+    }), cfg.live_orders));
+    rates.emplace_back("l3", replay_rate(events, std::function<L3Book<>()>([tick] {
+        return L3Book<>(L3Bids(tick), L3Asks(tick));
+    }), cfg.live_orders));
+
+    const std::string feed = describe_feed(cfg);
+    std::ifstream in;
+    if (!record) {
+        in.open(baseline_path);
+    }
+    if (!in.is_open()) {
+        std::printf("replay throughput (%s)\n", feed.c_str());
+        std::ofstream out(baseline_path);
+        out << "# mbp_bench throughput baseline: messages/sec of the serial replay, best of 5\n";
+        out << "feed " << feed << "\n";
+        for (const auto& [book, rate] : rates) {
+            std::printf("  %-12s %10.2f M msg/s\n", book.c_str(), rate / 1e6);
+            out << book << ' ' << static_cast<uint64_t>(rate) << "\n";
+        }
+        if (!out) {
+            std::fprintf(stderr, "Cannot write %s\n", baseline_path);
+            return 1;
+        }
+        std::printf("recorded as the baseline in %s\n", baseline_path);
+        return 0;
+    }
+
+    // "feed <description>", then "<book> <messages/sec>" lines.
+    std::unordered_map<std::string, double> baseline;
+    bool same_feed = false;
+    for (std::string line; std::getline(in, line);) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        const size_t space = std::min(line.find(' '), line.size());
+        const std::string key = line.substr(0, space);
+        const std::string value = line.substr(std::min(space + 1, line.size()));
+        if (key == "feed") {
+            same_feed = value == feed;
+        } else {
+            baseline[key] = std::strtod(value.c_str(), nullptr);
+        }
+    }
+    if (!same_feed) {
+        std::fprintf(stderr, "%s was measured on another feed; record it again with --perf-record\n",
+                     baseline_path);
+        return 1;
+    }
+
+    std::printf("replay throughput against %s (%s, tolerance %.0f%%)\n", baseline_path, feed.c_str(), tolerance);
+    std::printf("  %-12s %10s %10s %8s\n", "book", "M msg/s", "baseline", "change");
+    int regressions = 0;
+    for (const auto& [book, rate] : rates) {
+        auto it = baseline.find(book);
+        if (it == baseline.end() || it->second <= 0) {
+            std::printf("  %-12s %10.2f %10s\n", book.c_str(), rate / 1e6, "-");
+            continue;
+        }
+        const double change = 100 * (rate / it->second - 1);
+        const bool regressed = change < -tolerance;
+        regressions += regressed;
+        std::printf("  %-12s %10.2f %10.2f %+7.1f%%%s\n", book.c_str(), rate / 1e6, it->second / 1e6, change,
+                    regressed ? "  REGRESSION" : "");
+    }
+    std::printf(regressions ? "%d book(s) regressed\n" : "no regressions\n", regressions);
+    return regressions ? 1 : 0;
+}
+
+void print_usage() {
+    std::fprintf(stderr,
+                 "Usage: mbp_bench [options] [mbo.csv]\n"
+                 "  With a file, the order-index benchmark replays its add/cancel traffic.\n"
+                 "  Synthetic feed for the stage benchmark:\n"
+                 "  --events N        rows to generate (default 500000)\n"
+                 "  --mix A,C,T       relative add/cancel/trade frequency (default 50,40,10)\n"
+                 "  --volatility P    chance per row that the mid moves a tick (default 0.2)\n"
+                 "  --depth N         levels per side that adds spread over (default 20)\n"
+                 "  --orders N        resting orders the book hovers at (default 10000)\n"
+                 "  --seed N          random seed (default 1)\n"
+                 "  --write-feed PATH write the synthetic feed as MBO CSV and exit\n"
+                 "  Checks, run instead of the benchmarks:\n"
+                 "  --check           replay golden MBO samples and synthetic feeds through every\n"
+                 "                    book and compare the MBP-10 output (--events defaults to\n"
+                 "                    100000 per instrument); exit 1 on any difference\n"
+                 "  --perf-check FILE measure messages/sec of each book and compare with the\n"
+                 "                    baseline in FILE, recording it if FILE does not exist;\n"
+                 "                    exit 1 if a book is slower by more than the tolerance\n"
+                 "  --perf-record FILE  measure and record the baseline, replacing FILE\n"
+                 "  --tolerance PCT   allowed slowdown for --perf-check (default 10)\n");
+}
+
+bool parse_count(const char* text, size_t& out) {
+    const char* end = text + std::strlen(text);
+    auto [ptr, ec] = std::from_chars(text, end, out);
+    return ec == std::errc() && ptr == end && out > 0;
+}
+
+bool parse_mix(const char* text, FeedConfig& cfg) {
+    double w[3];
+    std::string_view rest = text;
+    for (int k = 0; k < 3; ++k) {
+        size_t comma = k < 2 ? rest.find(',') : rest.size();
+        if (comma == std::string_view::npos) {
+            return false;
+        }
+        auto [ptr, ec] = std::from_chars(rest.data(), rest.data() + comma, w[k]);
+        if (ec != std::errc() || ptr != rest.data() + comma || w[k] < 0) {
+            return false;
+        }
+        rest.remove_prefix(std::min(comma + 1, rest.size()));
+    }
+    cfg.add_weight = w[0];
+    cfg.cancel_weight = w[1];
+    cfg.trade_weight = w[2];
+    return w[0] > 0;
+}
+
+} // namespace
+
+// Usage: mbp_bench [options] [mbo.csv]. With a file, the order-index
+// benchmark replays its add/cancel traffic; otherwise a synthetic trace is
+// used. The options shape the synthetic feed of the stage benchmark.
+int main(int argc, char* argv[]) {
+    enum { kEvents = 256, kMix, kVolatility, kDepth, kOrders, kSeed, kWriteFeed, kCheck, kPerfCheck, kPerfRecord,
+           kTolerance };
+    static const option long_options[] = {
+        {"events", required_argument, nullptr, kEvents},
+        {"mix", required_argument, nullptr, kMix},
+        {"volatility", required_argument, nullptr, kVolatility},
+        {"depth", required_argument, nullptr, kDepth},
+        {"orders", required_argument, nullptr, kOrders},
+        {"seed", required_argument, nullptr, kSeed},
+        {"write-feed", required_argument, nullptr, kWriteFeed},
+        {"check", no_argument, nullptr, kCheck},
+        {"perf-check", required_argument, nullptr, kPerfCheck},
+        {"perf-record", required_argument, nullptr, kPerfRecord},
+        {"tolerance", required_argument, nullptr, kTolerance},
+        {nullptr, 0, nullptr, 0},
+    };
+    FeedConfig cfg;
+    const char* feed_path = nullptr;
+    bool check = false;
+    bool events_given = false;
+    const char* baseline_path = nullptr;
+    bool record = false;
+    double tolerance = 10;
+    size_t n = 0;
+    int c;
+    while ((c = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+        bool ok = true;
+        switch (c) {
+            case kEvents:
+                ok = parse_count(optarg, cfg.events);
+                events_given = true;
+                break;
+            case kMix:
+                ok = parse_mix(optarg, cfg);
+                break;
+            case kVolatility: {
+                auto [ptr, ec] = std::from_chars(optarg, optarg + std::strlen(optarg), cfg.volatility);
+                ok = ec == std::errc() && *ptr == '\0' && cfg.volatility >= 0 && cfg.volatility <= 1;
+                break;
+            }
+            case kDepth:
+                ok = parse_count(optarg, n) && n <= 10000;
+                cfg.depth = static_cast<int>(n);
+                break;
+            case kOrders:
+                ok = parse_count(optarg, cfg.live_orders);
+                break;
+            case kSeed:
+                ok = parse_count(optarg, n);
+                cfg.seed = n;
+                break;
+            case kWriteFeed:
+                feed_path = optarg;
+                break;
+            case kCheck:
+                check = true;
+                break;
+            case kPerfCheck:
+            case kPerfRecord:
+                baseline_path = optarg;
+                record = c == kPerfRecord;
+                break;
+            case kTolerance: {
+                auto [ptr, ec] = std::from_chars(optarg, optarg + std::strlen(optarg), tolerance);
+                ok = ec == std::errc() && *ptr == '\0' && tolerance >= 0;
+                break;
+            }
+            default:
+                ok = false;
+                break;
+        }
+        if (!ok) {
+            print_usage();
+            return 1;
+        }
+    }
+    if (argc - optind > 1) {
+        print_usage();
+        return 1;
+    }
+    if (feed_path) {
+        std::ofstream out(feed_path, std::ios::binary);
+        out << render_mbo_csv(SyntheticFeed(cfg).generate());
+        return out ? 0 : 1;
+    }
+    if (check) {
+        if (!events_given) {
+            cfg.events = 100000;
+        }
+        return run_check(cfg);
+    }
+    if (baseline_path) {
+        return run_perf_check(cfg, baseline_path, record, tolerance);
+    }
+
+    const char* mbo_path = optind < argc ? argv[optind] : nullptr;
+    bench_price_parse();
+    bench_order_index(mbo_path);
+    bench_book_churn();
+    bench_csv_output();
+    bench_synthetic_stages(cfg);
+    return 0;
+}
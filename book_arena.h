@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include "order_book.h"
+
+// Node memory for one instrument's map-based book.
+//
+// Small blocks (tree and hash nodes) are carved out of large contiguous
+// slabs and recycled through one intrusive free list per 16-byte size
+// class, so the erase/insert churn of a trading day reuses the same slab
+// memory instead of fragmenting the global heap, and allocating a node is
+// a pointer pop. Large blocks (hash bucket arrays) go to the upstream
+// resource. Nothing is returned to the system until the arena is
+// destroyed. Not thread-safe, which matches a book's single owner.
+//
+// std::pmr::unsynchronized_pool_resource does the same job, but its
+// per-call chunk search costs more than the global allocator it replaces.
+class BookArena : public std::pmr::memory_resource {
+public:
+    static constexpr size_t kSlabBytes = 1 << 20;
+
+    explicit BookArena(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+        : upstream_(upstream) {}
+
+    BookArena(const BookArena&) = delete;
+    BookArena& operator=(const BookArena&) = delete;
+
+    ~BookArena() override {
+        for (void* slab : slabs_) {
+            upstream_->deallocate(slab, kSlabBytes, kAlign);
+        }
+    }
+
+private:
+    static constexpr size_t kAlign = 16;
+    static constexpr size_t kMaxPooled = 256;
+    static constexpr size_t kClasses = kMaxPooled / kAlign;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static size_t size_class(size_t bytes) { return (bytes + kAlign - 1) / kAlign - 1; }
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        if (bytes > kMaxPooled || alignment > kAlign) {
+            return upstream_->allocate(bytes, alignment);
+        }
+        const size_t c = size_class(bytes);
+        if (FreeBlock* block = free_[c]) {
+            free_[c] = block->next;
+            return block;
+        }
+        const size_t rounded = (c + 1) * kAlign;
+        if (static_cast<size_t>(slab_end_ - cursor_) < rounded) {
+            cursor_ = static_cast<char*>(upstream_->allocate(kSlabBytes, kAlign));
+            slab_end_ = cursor_ + kSlabBytes;
+            slabs_.push_back(cursor_);
+        }
+        void* p = cursor_;
+        cursor_ += rounded;
+        return p;
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        if (bytes > kMaxPooled || alignment > kAlign) {
+            upstream_->deallocate(p, bytes, alignment);
+            return;
+        }
+        const size_t c = size_class(bytes);
+        free_[c] = ::new (p) FreeBlock{free_[c]};
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    std::pmr::memory_resource* upstream_;
+    FreeBlock* free_[kClasses] = {};
+    char* cursor_{nullptr};
+    char* slab_end_{nullptr};
+    std::vector<void*> slabs_;
+};
+
+// The reference std::map / std::unordered_map book, allocating from a BookArena.
+using ArenaBids = std::pmr::map<int64_t, LevelInfo, std::greater<int64_t>>;
+using ArenaAsks = std::pmr::map<int64_t, LevelInfo>;
+using ArenaOrders = std::pmr::unordered_map<uint64_t, OrderInfo>;
+
+// The arena of an ArenaBook, in a base class so that it is constructed
+// before the containers using it and destroyed after them. It is held by
+// pointer so that its address survives the book being moved.
+struct ArenaHolder {
+    std::unique_ptr<BookArena> arena;
+};
+
+// An OrderBook whose containers all allocate from one BookArena.
+struct ArenaBook : ArenaHolder, OrderBook<ArenaBids, ArenaAsks, ArenaOrders> {
+    using Base = OrderBook<ArenaBids, ArenaAsks, ArenaOrders>;
+
+    explicit ArenaBook(std::unique_ptr<BookArena> a)
+        : ArenaHolder{std::move(a)},
+          Base(ArenaBids(arena.get()), ArenaAsks(arena.get()), ArenaOrders(arena.get())) {}
+
+    static ArenaBook make() { return ArenaBook(std::make_unique<BookArena>()); }
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Owns one book per instrument and maps instrument ids, which are sparse
+// 32-bit values, to dense indices in order of first appearance.
+//
+// Books are stored by value in a single vector, so the per-instrument
+// state the hot path touches first sits in one contiguous array instead of
+// behind a pointer per instrument. Feeds arrive in bursts for the same
+// instrument, so the last id looked up is cached in front of the hash map.
+//
+// References returned by operator[] are invalidated when a new instrument
+// is added; look the book up again for each event.
+template<typename Book>
+class BookManager {
+public:
+    explicit BookManager(std::function<Book()> make_book) : make_book_(std::move(make_book)) {
+        books_.reserve(kInitialInstruments);
+        ids_.reserve(kInitialInstruments);
+    }
+
+    // Dense index of `instrument_id`, creating an empty book for it the
+    // first time it is seen. New instruments get index size() - 1.
+    uint32_t index_of(uint32_t instrument_id) {
+        if (instrument_id == last_id_ && !books_.empty()) {
+            return last_index_;
+        }
+        auto [it, inserted] = index_.try_emplace(instrument_id, static_cast<uint32_t>(books_.size()));
+        if (inserted) {
+            books_.push_back(make_book_());
+            ids_.push_back(instrument_id);
+        }
+        last_id_ = instrument_id;
+        last_index_ = it->second;
+        return last_index_;
+    }
+
+    // The book of `instrument_id`, or nullptr if it has not been seen yet.
+    // Never adds one.
+    const Book* find(uint32_t instrument_id) const {
+        if (instrument_id == last_id_ && !books_.empty()) {
+            return &books_[last_index_];
+        }
+        auto it = index_.find(instrument_id);
+        return it == index_.end() ? nullptr : &books_[it->second];
+    }
+
+    Book& operator[](uint32_t index) { return books_[index]; }
+    const Book& operator[](uint32_t index) const { return books_[index]; }
+
+    // Instrument id of the book at dense index `index`.
+    uint32_t instrument_id(uint32_t index) const { return ids_[index]; }
+
+    size_t size() const { return books_.size(); }
+
+private:
+    static constexpr size_t kInitialInstruments = 64;
+
+    std::function<Book()> make_book_;
+    std::vector<Book> books_;
+    std::vector<uint32_t> ids_;
+    std::unordered_map<uint32_t, uint32_t> index_;
+    uint32_t last_id_{0};
+    uint32_t last_index_{0};
+};
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "output_buffer.h"
+
+// Binary checkpoint of a replay: every book, with the input position and
+// event time it was taken at, so a later run can resume from there
+// instead of replaying the feed from its first row. The input itself is
+// identified by its size and a hash of its first bytes, so that a
+// checkpoint is not resumed on another file at a meaningless offset.
+//
+// The file is a CheckpointHeader followed by the books in order of first
+// appearance, each as its instrument id and the book's own save() record.
+// Values are written in host byte order; a checkpoint is meant to be read
+// back on the machine, or at least the architecture, that wrote it.
+struct CheckpointHeader {
+    static constexpr char kMagic[8] = {'M', 'B', 'P', 'C', 'K', 'P', 'T', '\0'};
+    static constexpr uint32_t kVersion = 4;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t book_kind;    // Which --book wrote it; books of other kinds cannot load it
+    int64_t price_scale;   // Fixed-point factor of every price in the file
+    uint64_t input_offset; // Byte offset of the first input row not yet applied
+    int64_t ts_event;      // ts_event of the last row applied
+    uint64_t rows;         // Rows applied, header and R row excluded
+    uint64_t instruments;  // Books that follow
+    uint64_t input_size;   // Size of the input file; 0 if it was piped (see InputIdentity)
+    uint64_t input_hash;   // InputIdentity::head_hash of the input file
+};
+static_assert(sizeof(CheckpointHeader) == 72, "CheckpointHeader must have no padding");
+
+// What a checkpoint records of the file it was taken from: its size and an
+// FNV-1a hash of its first kHeadBytes, as stored (compressed or not). The
+// head holds the first rows and their timestamps, which tell one day's
+// feed from another; the size tells a file from a longer or shorter
+// version of itself. Piped input cannot be read twice, so it has no
+// identity and is not checked.
+struct InputIdentity {
+    static constexpr size_t kHeadBytes = 1 << 16;
+
+    uint64_t size{0}; // 0: not a regular file
+    uint64_t head_hash{0};
+
+    bool known() const { return size != 0; }
+    bool operator==(const InputIdentity& o) const { return size == o.size && head_hash == o.head_hash; }
+    bool operator!=(const InputIdentity& o) const { return !(*this == o); }
+};
+
+// Identifies the input at `path`; "-" and anything that is not a regular
+// file get the unknown identity. Returns false if the file cannot be read.
+inline bool input_identity(const char* path, InputIdentity& id) {
+    id = InputIdentity{};
+    if (std::strcmp(path, "-") == 0) {
+        return true;
+    }
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return true;
+    }
+    std::vector<char> head(std::min<uint64_t>(InputIdentity::kHeadBytes, static_cast<uint64_t>(st.st_size)));
+    size_t got = 0;
+    while (got < head.size()) {
+        const ssize_t n = ::pread(fd, head.data() + got, head.size() - got, static_cast<off_t>(got));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ::close(fd);
+            return false;
+        }
+        got += static_cast<size_t>(n);
+    }
+    ::close(fd);
+    uint64_t hash = 14695981039346656037ull; // FNV-1a offset basis
+    for (char c : head) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    id.size = static_cast<uint64_t>(st.st_size);
+    id.head_hash = hash;
+    return true;
+}
+
+// Serialises plain values into an OutputBuffer.
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(OutputBuffer& out) : out_(out) {}
+
+    template<typename T>
+    void put(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>, "checkpoint values are copied byte for byte");
+        out_.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+private:
+    OutputBuffer& out_;
+};
+
+// Reads back what a CheckpointWriter wrote. Reading past the end yields
+// zeros and marks the reader failed, so a loader can check ok() once per
+// record instead of after every value.
+class CheckpointReader {
+public:
+    // Reads the whole of `path`. Returns false if it cannot be read.
+    bool open(const char* path) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        char block[1 << 16];
+        ssize_t n;
+        while ((n = ::read(fd, block, sizeof(block))) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ::close(fd);
+                return false;
+            }
+            data_.insert(data_.end(), block, block + n);
+        }
+        ::close(fd);
+        return true;
+    }
+
+    template<typename T>
+    T get() {
+        static_assert(std::is_trivially_copyable_v<T>, "checkpoint values are copied byte for byte");
+        T value{};
+        if (data_.size() - pos_ < sizeof(T)) {
+            failed_ = true;
+            pos_ = data_.size();
+            return value;
+        }
+        std::memcpy(&value, data_.data() + pos_, sizeof(T));
+        pos_ += sizeof(T);
+        return value;
+    }
+
+    bool ok() const { return !failed_; }
+    bool at_end() const { return pos_ == data_.size(); }
+
+private:
+    std::vector<char> data_;
+    size_t pos_{0};
+    bool failed_{false};
+};
+
+// Writes a checkpoint to `path` through a temporary file that is renamed
+// into place, so a crash mid-write never leaves a truncated checkpoint.
+// `body` writes everything after the header. Returns false on any error.
+template<typename BodyFn>
+bool write_checkpoint(const std::string& path, const CheckpointHeader& header, BodyFn&& body) {
+    const std::string tmp = path + ".tmp";
+    OutputBuffer buffer;
+    if (!buffer.open(tmp.c_str())) {
+        return false;
+    }
+    CheckpointWriter out(buffer);
+    out.put(header);
+    body(out);
+    if (!buffer.close()) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+// Reads and validates the header of a checkpoint. Returns false, with a
+// reason in `error`, if the file is not one this build can resume from.
+inline bool read_checkpoint_header(CheckpointReader& in, CheckpointHeader& header, std::string& error) {
+    header = in.get<CheckpointHeader>();
+    if (!in.ok() || std::memcmp(header.magic, CheckpointHeader::kMagic, sizeof(header.magic)) != 0) {
+        error = "not a checkpoint file";
+        return false;
+    }
+    if (header.version != CheckpointHeader::kVersion) {
+        error = "unsupported checkpoint version " + std::to_string(header.version);
+        return false;
+    }
+    return true;
+}
+
+// Checks that a checkpoint read by read_checkpoint_header() was taken
+// from `input`. Returns false, with a reason in `error`, if it was taken
+// from another file, or from a file while `input` is piped. A checkpoint
+// taken from piped input cannot be checked and is accepted.
+inline bool check_checkpoint_input(const CheckpointHeader& header, const InputIdentity& input, std::string& error) {
+    const InputIdentity taken{header.input_size, header.input_hash};
+    if (!taken.known()) {
+        return true;
+    }
+    if (!input.known()) {
+        error = "it was taken from a file, which must be passed by name so it can be checked";
+        return false;
+    }
+    if (taken != input) {
+        error = taken.size != input.size ? "it was taken from another input, of " + std::to_string(taken.size) +
+                                               " bytes (this one has " + std::to_string(input.size) + ")"
+                                         : "it was taken from another input, of the same size but other content";
+        return false;
+    }
+    return true;
+}
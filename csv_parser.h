@@ -0,0 +1,332 @@
+#pragma once
+
+#include <string_view>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "mbo_event.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Column positions in a Databento MBO CSV row.
+enum MboColumn : uint32_t {
+    kTsRecv = 0,
+    kTsEvent,
+    kRtype,
+    kPublisherId,
+    kInstrumentId,
+    kAction,
+    kSide,
+    kPrice,
+    kSize,
+    kChannelId,
+    kOrderId,
+};
+
+// Writes the offset of every ',' and '\n' in [data, data + len) to `out`
+// and returns how many were found. `out` must have room for `len` entries.
+// The vector kernel is picked at compile time; the Makefile builds with
+// -march=native, so this is the widest ISA the build machine supports.
+inline size_t find_delimiters(const char* data, size_t len, uint32_t* out) {
+    size_t n = 0;
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    for (; i + 64 <= len; i += 64) {
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+        uint32_t mlo = static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(lo, comma), _mm256_cmpeq_epi8(lo, newline))));
+        uint32_t mhi = static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(hi, comma), _mm256_cmpeq_epi8(hi, newline))));
+        uint64_t mask = (static_cast<uint64_t>(mhi) << 32) | mlo;
+        while (mask != 0) {
+            out[n++] = static_cast<uint32_t>(i + __builtin_ctzll(mask));
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, comma), _mm_cmpeq_epi8(v, newline))));
+        while (mask != 0) {
+            out[n++] = static_cast<uint32_t>(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t comma = vdupq_n_u8(',');
+    const uint8x16_t newline = vdupq_n_u8('\n');
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(data + i));
+        uint8x16_t eq = vorrq_u8(vceqq_u8(v, comma), vceqq_u8(v, newline));
+        // Narrow to one nibble per byte; NEON has no movemask.
+        uint64_t mask = vget_lane_u64(
+            vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        while (mask != 0) {
+            unsigned bit = static_cast<unsigned>(__builtin_ctzll(mask));
+            out[n++] = static_cast<uint32_t>(i + (bit >> 2));
+            mask &= ~(0xFULL << (bit & ~3u));
+        }
+    }
+#endif
+    for (; i < len; ++i) {
+        if (data[i] == ',' || data[i] == '\n') {
+            out[n++] = static_cast<uint32_t>(i);
+        }
+    }
+    return n;
+}
+
+// One CSV row inside a scanned chunk. Fields are addressed by index using
+// the delimiter offsets found by find_delimiters, so nothing is rescanned.
+class CsvRow {
+public:
+    CsvRow(const char* base, uint32_t begin, const uint32_t* delims, uint32_t count)
+        : base_(base), begin_(begin), delims_(delims), count_(count) {}
+
+    // Returns field `i`, or an empty view if the row has fewer fields.
+    std::string_view field(uint32_t i) const {
+        if (i >= count_) {
+            return {};
+        }
+        uint32_t start = i == 0 ? begin_ : delims_[i - 1] + 1;
+        return {base_ + start, delims_[i] - start};
+    }
+
+    // First character of field `i`, or '\0' if it is empty or missing.
+    char field_char(uint32_t i) const {
+        std::string_view f = field(i);
+        return f.empty() ? '\0' : f[0];
+    }
+
+    uint32_t field_count() const { return count_; }
+
+    // The row's terminating '\n', or the end of the chunk for a final
+    // line without one.
+    const char* end() const { return base_ + delims_[count_ - 1]; }
+
+private:
+    const char* base_;
+    uint32_t begin_;
+    const uint32_t* delims_;
+    uint32_t count_;
+};
+
+// Splits blocks of complete CSV lines into rows. Each chunk of the block is
+// scanned for delimiters in a single vectorized pass, then rows are handed
+// to the callback one at a time. The offset buffer is reused across calls.
+class CsvScanner {
+public:
+    // Chunk size is a trade-off: large enough to amortize the per-chunk
+    // boundary search, small enough that text and offsets stay in L2.
+    static constexpr size_t kChunkBytes = 256 * 1024;
+
+    template<typename RowFn>
+    void for_each_row(std::string_view block, RowFn&& fn) {
+        const char* p = block.data();
+        const char* end = p + block.size();
+        while (p < end) {
+            size_t n = static_cast<size_t>(end - p);
+            if (n > kChunkBytes) {
+                // End the chunk on a line boundary.
+                n = chunk_end(p, n);
+            }
+            if (delims_.size() < n + 1) {
+                delims_.resize(n + 1);
+            }
+            size_t count = find_delimiters(p, n, delims_.data());
+            if (p[n - 1] != '\n') {
+                // Final line without a trailing newline.
+                delims_[count++] = static_cast<uint32_t>(n);
+            }
+
+            uint32_t row_begin = 0;
+            size_t first = 0;
+            for (size_t k = 0; k < count; ++k) {
+                uint32_t pos = delims_[k];
+                if (pos < n && p[pos] != '\n') {
+                    continue;
+                }
+                if (pos > row_begin) { // Skip empty lines.
+                    fn(CsvRow(p, row_begin, &delims_[first], static_cast<uint32_t>(k - first + 1)));
+                }
+                row_begin = pos + 1;
+                first = k + 1;
+            }
+            p += n;
+        }
+    }
+
+private:
+    static size_t chunk_end(const char* p, size_t n) {
+        size_t limit = kChunkBytes;
+        while (limit > 0 && p[limit - 1] != '\n') {
+            --limit;
+        }
+        if (limit > 0) {
+            return limit;
+        }
+        // A single line longer than a chunk: take all of it.
+        const void* nl = std::memchr(p + kChunkBytes, '\n', n - kChunkBytes);
+        return nl ? static_cast<const char*>(nl) - p + 1 : n;
+    }
+
+    std::vector<uint32_t> delims_;
+};
+
+// Custom parser for performance. Avoids std::stringstream overhead.
+// Converts a single field to the specified type.
+template<typename T>
+T parse_field(std::string_view field) {
+    T value{};
+    // Use std::from_chars for fast, locale-independent conversion.
+    std::from_chars(field.data(), field.data() + field.size(), value);
+    return value;
+}
+
+// Fixed-point price encoding: a price of 1.0 is stored as `factor` units.
+// Powers of ten are recognised up front so the common case needs no
+// multiply/divide at all when the input digits line up with the scale.
+struct PriceScale {
+    int64_t factor{10000};
+    int decimals{4}; // log10(factor), or -1 if factor is not a power of ten
+
+    static PriceScale from_factor(int64_t factor) {
+        PriceScale s;
+        s.factor = factor;
+        s.decimals = -1;
+        int64_t p = 1;
+        for (int d = 0; d <= 18; ++d, p *= 10) {
+            if (p == factor) {
+                s.decimals = d;
+                break;
+            }
+            if (p > INT64_MAX / 10) {
+                break;
+            }
+        }
+        return s;
+    }
+};
+
+namespace detail {
+inline constexpr uint64_t kPow10[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+    1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+    1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+__extension__ typedef unsigned __int128 uint128;
+
+// Divides by 10^d into `out`. Returns false, leaving `out` alone, if the
+// division is not exact.
+inline bool div_pow10_exact(uint128 value, int d, uint64_t& out) {
+    const uint128 div = kPow10[d];
+    if (value % div != 0) {
+        return false;
+    }
+    out = static_cast<uint64_t>(value / div);
+    return true;
+}
+} // namespace detail
+
+// parse_price's result for a price that the scale cannot hold exactly,
+// such as 100.00005 at the default scale or 100.10 in quarters. There is
+// one scale for the whole feed, so such a price is refused rather than
+// silently rounded to a neighbour.
+inline constexpr int64_t kOffScalePrice = INT64_MIN;
+
+// Parses a decimal price such as "5.510000000" or "-0.1235" straight into
+// scaled integer units, without going through a double. Fractional digits
+// past the scale must be zeros; otherwise the result is kOffScalePrice.
+// An empty field parses as 0.
+inline int64_t parse_price(std::string_view field, const PriceScale& scale) {
+    const char* p = field.data();
+    const char* end = p + field.size();
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    for (; p < end && static_cast<unsigned>(*p - '0') < 10; ++p) {
+        mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+    }
+
+    uint64_t units;
+    if (scale.decimals >= 0) {
+        // Power-of-ten scale: read exactly `decimals` fractional digits;
+        // any further ones must be zeros. No multiply or divide by a
+        // runtime power of ten is needed beyond padding short fractions.
+        int frac_digits = 0;
+        if (p < end && *p == '.') {
+            ++p;
+            for (; frac_digits < scale.decimals && p < end &&
+                   static_cast<unsigned>(*p - '0') < 10; ++p, ++frac_digits) {
+                mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+            }
+            while (p < end && *p == '0') {
+                ++p;
+            }
+            if (p < end && static_cast<unsigned>(*p - '1') < 9) {
+                return kOffScalePrice;
+            }
+        }
+        units = mantissa * detail::kPow10[scale.decimals - frac_digits];
+    } else {
+        // Arbitrary scale (e.g. ticks of 0.25): keep up to 18 significant
+        // digits, the rest being zeros, and do one exact 128-bit
+        // multiply/divide.
+        constexpr uint64_t kLimit = detail::kPow10[18];
+        int frac_digits = 0;
+        if (p < end && *p == '.') {
+            ++p;
+            for (; p < end && static_cast<unsigned>(*p - '0') < 10; ++p) {
+                if (mantissa >= kLimit) {
+                    if (*p != '0') {
+                        return kOffScalePrice;
+                    }
+                    continue;
+                }
+                mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+                ++frac_digits;
+            }
+        }
+        detail::uint128 product = static_cast<detail::uint128>(mantissa) *
+                                  static_cast<uint64_t>(scale.factor);
+        if (!detail::div_pow10_exact(product, frac_digits, units)) {
+            return kOffScalePrice;
+        }
+    }
+    int64_t value = static_cast<int64_t>(units);
+    return negative ? -value : value;
+}
+
+// Extracts the fields the reconstruction uses from one MBO row.
+inline MboEvent parse_event(const CsvRow& row, const PriceScale& scale) {
+    MboEvent ev;
+    ev.ts_event = parse_field<int64_t>(row.field(kTsEvent));
+    ev.instrument_id = parse_field<uint32_t>(row.field(kInstrumentId));
+    ev.action = row.field_char(kAction);
+    ev.side = row.field_char(kSide);
+    // Prices go straight from decimal text to fixed-point integers,
+    // which avoids floating point issues entirely.
+    ev.price = parse_price(row.field(kPrice), scale);
+    ev.size = parse_field<int64_t>(row.field(kSize));
+    ev.order_id = parse_field<uint64_t>(row.field(kOrderId));
+    return ev;
+}
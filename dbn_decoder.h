@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+
+#include "csv_parser.h"
+#include "mbo_event.h"
+
+// Databento Binary Encoding (DBN) input, versions 1 to 3: the native
+// form of the feed, read without any text parsing. A DBN stream is
+// "DBN", a version byte and a 32-bit metadata length, the metadata, then
+// records that each start with their own length. MBO records are decoded
+// into MboEvents; records of any other type (status, symbol mappings,
+// errors) are skipped. All fields are little-endian.
+
+// The file prefix: magic, version and metadata length.
+constexpr size_t kDbnPrefixSize = 8;
+
+// True if `data` starts like a DBN stream.
+inline bool is_dbn(const char* data, size_t n) {
+    return n >= 4 && std::memcmp(data, "DBN", 3) == 0 && data[3] >= 1 && data[3] <= 3;
+}
+
+// Offset of the first record, just past the metadata, or 0 if the first
+// `n` bytes do not reach it.
+inline size_t dbn_records_offset(const char* data, size_t n) {
+    if (n < kDbnPrefixSize) {
+        return 0;
+    }
+    uint32_t metadata_size;
+    std::memcpy(&metadata_size, data + 4, sizeof(metadata_size));
+    const size_t begin = kDbnPrefixSize + metadata_size;
+    return begin <= n ? begin : 0;
+}
+
+// Databento's MboMsg: a 16-byte record header, then the order fields.
+struct DbnMboRecord {
+    uint8_t length; // Record size in 4-byte units
+    uint8_t rtype;  // kDbnMboRtype
+    uint16_t publisher_id;
+    uint32_t instrument_id;
+    uint64_t ts_event;
+    uint64_t order_id;
+    int64_t price; // 1e-9 units, or kDbnUndefPrice
+    uint32_t size;
+    uint8_t flags;
+    uint8_t channel_id;
+    char action;
+    char side;
+    uint64_t ts_recv;
+    int32_t ts_in_delta;
+    uint32_t sequence;
+};
+static_assert(sizeof(DbnMboRecord) == 56, "DbnMboRecord must match the DBN layout");
+
+constexpr uint8_t kDbnMboRtype = 0xA0;
+constexpr size_t kDbnRecordHeaderSize = 16;
+constexpr int64_t kDbnUndefPrice = std::numeric_limits<int64_t>::max();
+
+// Decodes the records of a DBN stream into MboEvents, converting prices
+// from DBN's 1e-9 units to `scale` with integer arithmetic only. A price
+// the scale cannot hold exactly becomes kOffScalePrice, as in parse_price,
+// so a feed gives the same prices as its CSV form.
+class DbnDecoder {
+public:
+    explicit DbnDecoder(const PriceScale& scale)
+        : factor_(static_cast<uint64_t>(scale.factor)),
+          divisor_(kDbnUnits % factor_ == 0 ? kDbnUnits / factor_ : 0) {}
+
+    // Calls fn(event, end) for each MBO record among the whole records at
+    // the front of `data`, `end` pointing just past the record. Returns the
+    // bytes consumed; a partial record at the end is left for the next
+    // call, with more data. Stops, setting failed(), at a record too short
+    // to hold its own header.
+    template<typename Fn>
+    size_t decode(std::string_view data, Fn&& fn) {
+        size_t pos = 0;
+        while (pos < data.size()) {
+            const size_t length = static_cast<uint8_t>(data[pos]) * size_t{4};
+            if (length < kDbnRecordHeaderSize) {
+                failed_ = true;
+                break;
+            }
+            if (data.size() - pos < length) {
+                break;
+            }
+            if (static_cast<uint8_t>(data[pos + 1]) == kDbnMboRtype && length >= sizeof(DbnMboRecord)) {
+                DbnMboRecord rec;
+                std::memcpy(&rec, data.data() + pos, sizeof(rec));
+                MboEvent ev;
+                ev.ts_event = static_cast<int64_t>(rec.ts_event);
+                ev.instrument_id = rec.instrument_id;
+                ev.action = rec.action;
+                ev.side = rec.side;
+                ev.price = price(rec.price);
+                ev.size = rec.size;
+                ev.order_id = rec.order_id;
+                fn(ev, data.data() + pos + length);
+            }
+            pos += length;
+        }
+        return pos;
+    }
+
+    bool failed() const { return failed_; }
+
+private:
+    static constexpr uint64_t kDbnUnits = 1000000000; // Price units per 1.0
+
+    int64_t price(int64_t nanos) const {
+        if (nanos == kDbnUndefPrice) {
+            return 0; // As an empty CSV price field parses
+        }
+        const uint64_t magnitude = nanos < 0 ? 0 - static_cast<uint64_t>(nanos) : static_cast<uint64_t>(nanos);
+        // A scale that divides 1e9, such as the default 1e4, needs one
+        // 64-bit division; any other an exact 128-bit multiply/divide.
+        uint64_t units;
+        if (divisor_ > 0) {
+            if (magnitude % divisor_ != 0) {
+                return kOffScalePrice;
+            }
+            units = magnitude / divisor_;
+        } else if (!detail::div_pow10_exact(static_cast<detail::uint128>(magnitude) * factor_, 9, units)) {
+            return kOffScalePrice;
+        }
+        const int64_t value = static_cast<int64_t>(units);
+        return nanos < 0 ? -value : value;
+    }
+
+    uint64_t factor_;
+    uint64_t divisor_; // 1e9 / factor_, or 0 if it does not divide
+    bool failed_{false};
+};
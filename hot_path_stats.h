@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "order_book.h"
+
+// Opt-in hot-path instrumentation. Built with -DMBP_INSTRUMENT (`make
+// INSTRUMENT=1`), every row is timestamped with the TSC as it is parsed,
+// applied to its book and written out, and each stage's cost goes into a
+// histogram; counters record what the rows did to the books. Everything
+// is printed to stderr when the replay ends. Without the flag the probes
+// below are empty and compile away.
+#ifdef MBP_INSTRUMENT
+inline constexpr bool kInstrumented = true;
+#else
+inline constexpr bool kInstrumented = false;
+#endif
+
+// A cheap, monotonic tick count: the TSC where there is one, otherwise
+// steady_clock nanoseconds.
+inline uint64_t cycle_count() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// Log-linear histogram of tick counts, in the style of HdrHistogram:
+// values below 2 * kSubBuckets are exact, and every power of two above is
+// split into kSubBuckets linear buckets, so any recorded value is known to
+// within 1/kSubBuckets (about 3%). Recording is a bit scan and an
+// increment; 64-bit values need fewer than 2000 buckets.
+class LatencyHistogram {
+public:
+    static constexpr int kSubBits = 5;
+    static constexpr uint64_t kSubBuckets = uint64_t{1} << kSubBits;
+
+    void record(uint64_t value) {
+        ++counts_[index(value)];
+        ++total_;
+        sum_ += value;
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < kBuckets; ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t max() const { return max_; }
+    double mean() const { return total_ ? static_cast<double>(sum_) / static_cast<double>(total_) : 0.0; }
+
+    // Value at quantile `q` (0..1): the midpoint of the bucket holding it.
+    double quantile(double q) const {
+        if (total_ == 0) {
+            return 0.0;
+        }
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * static_cast<double>(total_) + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return std::min(midpoint(i), static_cast<double>(max_));
+            }
+        }
+        return static_cast<double>(max_);
+    }
+
+private:
+    // `shift` keeps the top kSubBits + 1 bits of a value, so bucket
+    // shift * kSubBuckets + (value >> shift) is one of the kSubBuckets of
+    // its power of two. The largest shift is 63 - kSubBits.
+    static constexpr size_t kBuckets = (65 - kSubBits) * kSubBuckets;
+
+    static size_t index(uint64_t value) {
+        const int msb = 63 - __builtin_clzll(value | 1);
+        const int shift = std::max(0, msb - kSubBits);
+        return static_cast<size_t>(shift) * kSubBuckets + static_cast<size_t>(value >> shift);
+    }
+
+    static double midpoint(size_t i) {
+        if (i < 2 * kSubBuckets) {
+            return static_cast<double>(i);
+        }
+        const size_t shift = i / kSubBuckets - 1;
+        const uint64_t low = (i % kSubBuckets + kSubBuckets) << shift;
+        return static_cast<double>(low) + static_cast<double>((uint64_t{1} << shift) - 1) / 2.0;
+    }
+
+    uint64_t counts_[kBuckets] = {};
+    uint64_t total_{0};
+    uint64_t sum_{0};
+    uint64_t max_{0};
+};
+
+// The timed stages of a row: CSV fields to MboEvent, the book update,
+// copying the top levels into a snapshot, and formatting it for output.
+enum class HotStage { kParse, kApply, kSnapshot, kEmit, kCount };
+
+// Histograms and counters of one thread.
+struct HotPathStats {
+    // Rows by action, in this order; anything else is counted as other.
+    static constexpr char kActions[] = {'A', 'C', 'T', 'F', 'R'};
+    static constexpr size_t kActionSlots = sizeof(kActions) + 1;
+
+    static size_t action_slot(char action) {
+        for (size_t i = 0; i < sizeof(kActions); ++i) {
+            if (kActions[i] == action) {
+                return i;
+            }
+        }
+        return sizeof(kActions);
+    }
+
+    void merge(const HotPathStats& other) {
+        for (size_t i = 0; i < static_cast<size_t>(HotStage::kCount); ++i) {
+            stages[i].merge(other.stages[i]);
+        }
+        for (size_t i = 0; i < kActionSlots; ++i) {
+            apply_by_action[i].merge(other.apply_by_action[i]);
+            rows[i] += other.rows[i];
+        }
+        unknown_cancels += other.unknown_cancels;
+        missing_trade_levels += other.missing_trade_levels;
+        levels_erased += other.levels_erased;
+    }
+
+    LatencyHistogram stages[static_cast<size_t>(HotStage::kCount)];
+    LatencyHistogram apply_by_action[kActionSlots];
+    uint64_t rows[kActionSlots] = {};
+    uint64_t unknown_cancels{0};
+    uint64_t missing_trade_levels{0};
+    uint64_t levels_erased{0};
+};
+
+namespace detail {
+// Every thread's stats, kept until exit, and the start of the TSC
+// calibration interval. Deliberately leaked, so reporting at any point of
+// shutdown is safe.
+struct HotPathRegistry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<HotPathStats>> threads;
+    uint64_t start_ticks{cycle_count()};
+    std::chrono::steady_clock::time_point start_time{std::chrono::steady_clock::now()};
+};
+
+inline HotPathRegistry& hot_path_registry() {
+    static HotPathRegistry* registry = new HotPathRegistry;
+    return *registry;
+}
+} // namespace detail
+
+// The calling thread's stats. Threads never share them, so recording
+// needs no synchronisation.
+inline HotPathStats& thread_hot_path_stats() {
+    thread_local HotPathStats* stats = [] {
+        detail::HotPathRegistry& reg = detail::hot_path_registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.threads.push_back(std::make_unique<HotPathStats>());
+        return reg.threads.back().get();
+    }();
+    return *stats;
+}
+
+// Times its scope as one row's pass through `stage`.
+class StageProbe {
+public:
+    explicit StageProbe(HotStage stage) {
+        if constexpr (kInstrumented) {
+            stage_ = stage;
+            start_ = cycle_count();
+        }
+    }
+
+    ~StageProbe() {
+        if constexpr (kInstrumented) {
+            thread_hot_path_stats().stages[static_cast<size_t>(stage_)].record(cycle_count() - start_);
+        }
+    }
+
+    StageProbe(const StageProbe&) = delete;
+    StageProbe& operator=(const StageProbe&) = delete;
+
+private:
+    HotStage stage_{};
+    uint64_t start_{0};
+};
+
+// Times its scope as the book update of one row, both overall and for the
+// row's action, and counts what the update did.
+class ApplyProbe {
+public:
+    explicit ApplyProbe(char action) {
+        if constexpr (kInstrumented) {
+            slot_ = HotPathStats::action_slot(action);
+            start_ = cycle_count();
+        }
+    }
+
+    void record(const BookUpdate& update) {
+        if constexpr (kInstrumented) {
+            HotPathStats& stats = thread_hot_path_stats();
+            stats.unknown_cancels += update.unknown_order;
+            stats.missing_trade_levels += update.missing_level;
+            stats.levels_erased += update.level_erased;
+        }
+    }
+
+    ~ApplyProbe() {
+        if constexpr (kInstrumented) {
+            const uint64_t ticks = cycle_count() - start_;
+            HotPathStats& stats = thread_hot_path_stats();
+            stats.stages[static_cast<size_t>(HotStage::kApply)].record(ticks);
+            stats.apply_by_action[slot_].record(ticks);
+            ++stats.rows[slot_];
+        }
+    }
+
+    ApplyProbe(const ApplyProbe&) = delete;
+    ApplyProbe& operator=(const ApplyProbe&) = delete;
+
+private:
+    size_t slot_{0};
+    uint64_t start_{0};
+};
+
+// Merges every thread's stats and prints them, with ticks converted to
+// nanoseconds at the rate the TSC ran since the first probe.
+inline void report_hot_path_stats(std::ostream& out) {
+    detail::HotPathRegistry& reg = detail::hot_path_registry();
+    HotPathStats all;
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (const auto& stats : reg.threads) {
+            all.merge(*stats);
+        }
+    }
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - reg.start_time).count();
+    const double ticks = static_cast<double>(cycle_count() - reg.start_ticks);
+    const double ticks_per_ns = ns > 0 && ticks > 0 ? ticks / ns : 1.0;
+
+    char line[200];
+    std::snprintf(line, sizeof(line), "hot path latency, ns per row (%.3f ticks/ns; includes ~25 ticks of probe cost)\n",
+                  ticks_per_ns);
+    out << line;
+    std::snprintf(line, sizeof(line), "  %-10s %12s %9s %9s %9s %9s %9s %10s %10s\n", "stage", "rows",
+                  "mean", "p50", "p90", "p99", "p99.9", "p99.99", "max");
+    out << line;
+    auto row = [&](const char* name, const LatencyHistogram& h) {
+        if (h.count() == 0) {
+            return;
+        }
+        auto at = [&](double q) { return h.quantile(q) / ticks_per_ns; };
+        std::snprintf(line, sizeof(line), "  %-10s %12llu %9.1f %9.1f %9.1f %9.1f %9.1f %10.1f %10.1f\n", name,
+                      static_cast<unsigned long long>(h.count()), h.mean() / ticks_per_ns, at(0.5), at(0.9),
+                      at(0.99), at(0.999), at(0.9999), static_cast<double>(h.max()) / ticks_per_ns);
+        out << line;
+    };
+    row("parse", all.stages[static_cast<size_t>(HotStage::kParse)]);
+    row("apply", all.stages[static_cast<size_t>(HotStage::kApply)]);
+    row("snapshot", all.stages[static_cast<size_t>(HotStage::kSnapshot)]);
+    row("emit", all.stages[static_cast<size_t>(HotStage::kEmit)]);
+    for (size_t i = 0; i < HotPathStats::kActionSlots; ++i) {
+        char name[16];
+        if (i < sizeof(HotPathStats::kActions)) {
+            std::snprintf(name, sizeof(name), "apply %c", HotPathStats::kActions[i]);
+        } else {
+            std::snprintf(name, sizeof(name), "apply ?");
+        }
+        row(name, all.apply_by_action[i]);
+    }
+
+    out << "hot path counters\n  rows:";
+    for (size_t i = 0; i < HotPathStats::kActionSlots; ++i) {
+        std::snprintf(line, sizeof(line), " %c %llu", i < sizeof(HotPathStats::kActions) ? HotPathStats::kActions[i] : '?',
+                      static_cast<unsigned long long>(all.rows[i]));
+        out << line;
+    }
+    std::snprintf(line, sizeof(line),
+                  "\n  cancels of unknown orders %llu\n  trades at missing levels %llu\n  levels erased %llu\n",
+                  static_cast<unsigned long long>(all.unknown_cancels),
+                  static_cast<unsigned long long>(all.missing_trade_levels),
+                  static_cast<unsigned long long>(all.levels_erased));
+    out << line;
+}
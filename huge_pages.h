@@ -0,0 +1,231 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <linux/mempolicy.h>
+#include <linux/mman.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Placement of the replay's large arrays: the order index's slots, the
+// price ladders, L3 order nodes and the I/O buffers. With huge pages on,
+// each takes a few TLB entries instead of hundreds, which is most of the
+// cost of a random probe into a multi-megabyte table. The NUMA helpers
+// below keep a worker and the books it owns on one node.
+
+// Page size for large arrays (--huge-pages); process-wide, and set once
+// before the first book or buffer is created.
+enum class HugePages {
+    kOff,         // The global heap
+    kTransparent, // 2 MB aligned mappings marked MADV_HUGEPAGE
+    k2M,          // hugetlbfs 2 MB pages, falling back to kTransparent
+    k1G,          // hugetlbfs 1 GB pages for arrays of 512 MB and up, else as k2M
+};
+
+namespace detail {
+
+inline std::atomic<HugePages>& huge_pages_mode() {
+    static std::atomic<HugePages> mode{HugePages::kOff};
+    return mode;
+}
+
+constexpr size_t kHugePage2M = size_t{2} << 20;
+constexpr size_t kHugePage1G = size_t{1} << 30;
+
+// Bytes mapped for a large allocation of `bytes`: whole pages of the size
+// it is given. allocate_large and deallocate_large must agree on it.
+inline size_t large_mapping_page(size_t bytes, HugePages mode) {
+    return mode == HugePages::k1G && bytes >= kHugePage1G / 2 ? kHugePage1G : kHugePage2M;
+}
+
+// An anonymous mapping of `length` bytes aligned to `align`, which the
+// kernel does not promise for a plain mmap: over-map and trim the ends.
+inline void* map_aligned(size_t length, size_t align) {
+    void* p = mmap(nullptr, length + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(p);
+    const uintptr_t aligned = (begin + align - 1) & ~(uintptr_t{align} - 1);
+    if (aligned > begin) {
+        munmap(p, aligned - begin);
+    }
+    munmap(reinterpret_cast<void*>(aligned + length), begin + align - aligned);
+    return reinterpret_cast<void*>(aligned);
+}
+
+} // namespace detail
+
+// Allocations below this size go to the global heap whatever the mode:
+// a huge page would be mostly empty.
+constexpr size_t kLargeAllocationBytes = size_t{1} << 20;
+
+inline void set_huge_pages(HugePages mode) { detail::huge_pages_mode().store(mode, std::memory_order_relaxed); }
+inline HugePages huge_pages() { return detail::huge_pages_mode().load(std::memory_order_relaxed); }
+
+// Storage for `bytes`, on huge pages if the mode and size call for them.
+// A hugetlbfs request the system has no pages for (vm.nr_hugepages, or
+// /sys/kernel/mm/hugepages for 1 GB) falls back to transparent huge
+// pages, with one note on stderr. The storage is aligned to `align`, at
+// most 2 MB; huge pages are aligned to that already. Throws
+// std::bad_alloc.
+inline void* allocate_large(size_t bytes, size_t align = __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    const HugePages mode = huge_pages();
+    if (mode == HugePages::kOff || bytes < kLargeAllocationBytes) {
+        return ::operator new(bytes, std::align_val_t{align});
+    }
+    const size_t page = detail::large_mapping_page(bytes, mode);
+    const size_t length = (bytes + page - 1) & ~(page - 1);
+    if (mode != HugePages::kTransparent) {
+        const int size_flag = page == detail::kHugePage1G ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+        void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | size_flag,
+                       -1, 0);
+        if (p != MAP_FAILED) {
+            return p;
+        }
+        static std::atomic<bool> noted{false};
+        if (!noted.exchange(true)) {
+            std::fprintf(stderr, "No %s huge pages available; using transparent huge pages\n",
+                         page == detail::kHugePage1G ? "1 GB" : "2 MB");
+        }
+    }
+    void* p = detail::map_aligned(length, detail::kHugePage2M);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    madvise(p, length, MADV_HUGEPAGE);
+    return p;
+}
+
+// Releases allocate_large(bytes, align) storage. The mode must not have
+// changed in between.
+inline void deallocate_large(void* p, size_t bytes, size_t align = __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    const HugePages mode = huge_pages();
+    if (mode == HugePages::kOff || bytes < kLargeAllocationBytes) {
+        ::operator delete(p, std::align_val_t{align});
+        return;
+    }
+    const size_t page = detail::large_mapping_page(bytes, mode);
+    munmap(p, (bytes + page - 1) & ~(page - 1));
+}
+
+// std::allocator over allocate_large, for the vectors behind the books.
+template<typename T>
+struct HugePageAllocator {
+    using value_type = T;
+
+    HugePageAllocator() = default;
+    template<typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(allocate_large(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) { deallocate_large(p, n * sizeof(T)); }
+
+    template<typename U>
+    bool operator==(const HugePageAllocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const HugePageAllocator<U>&) const { return false; }
+};
+
+template<typename T>
+using LargeVector = std::vector<T, HugePageAllocator<T>>;
+
+// An uninitialised byte buffer from allocate_large, so that its pages are
+// first touched, and placed, by the thread that fills it.
+class PageBuffer {
+public:
+    explicit PageBuffer(size_t size, size_t align = __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        : data_(static_cast<char*>(allocate_large(size, align))), size_(size), align_(align) {}
+
+    PageBuffer(const PageBuffer&) = delete;
+    PageBuffer& operator=(const PageBuffer&) = delete;
+
+    ~PageBuffer() { deallocate_large(data_, size_, align_); }
+
+    char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    char* data_;
+    size_t size_;
+    size_t align_;
+};
+
+// Parses a sysfs list such as "0-3,8,10-11".
+inline std::vector<int> parse_id_list(const std::string& text) {
+    std::vector<int> ids;
+    const char* p = text.c_str();
+    while (*p >= '0' && *p <= '9') {
+        char* end;
+        const long first = std::strtol(p, &end, 10);
+        long last = first;
+        if (*end == '-') {
+            last = std::strtol(end + 1, &end, 10);
+        }
+        for (long id = first; id <= last; ++id) {
+            ids.push_back(static_cast<int>(id));
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return ids;
+}
+
+inline std::string read_sysfs_line(const std::string& path) {
+    std::string line;
+    if (std::FILE* f = std::fopen(path.c_str(), "r")) {
+        char buf[4096];
+        if (std::fgets(buf, sizeof(buf), f) != nullptr) {
+            line = buf;
+        }
+        std::fclose(f);
+    }
+    return line;
+}
+
+// The NUMA nodes with CPUs, in order; {0} on a machine without NUMA
+// information.
+inline std::vector<int> numa_cpu_nodes() {
+    std::vector<int> nodes = parse_id_list(read_sysfs_line("/sys/devices/system/node/has_cpu"));
+    if (nodes.empty()) {
+        nodes.push_back(0);
+    }
+    return nodes;
+}
+
+// Runs the calling thread on the CPUs of NUMA node `node` only, and has
+// the memory it first touches come from that node while it has free
+// pages (MPOL_PREFERRED). Threads it starts afterwards inherit both.
+// Returns false, changing nothing, if the node has no CPUs.
+inline bool bind_to_numa_node(int node) {
+    const std::vector<int> cpus =
+        parse_id_list(read_sysfs_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (CPU_COUNT(&set) == 0 || sched_setaffinity(0, sizeof(set), &set) != 0) {
+        return false;
+    }
+    // No libnuma: set_mempolicy(2) directly. The policy is a preference,
+    // so a full node spills to the others rather than failing.
+    constexpr size_t kMaskWords = 16;
+    unsigned long mask[kMaskWords] = {};
+    const size_t bits = sizeof(mask[0]) * 8;
+    if (static_cast<size_t>(node) < kMaskWords * bits) {
+        mask[node / bits] = 1UL << (node % bits);
+        syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, kMaskWords * bits + 1);
+    }
+    return true;
+}
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "order_book.h"
+#include "order_index.h"
+
+// Price level of an L3 book: the aggregate LevelInfo, which snapshots
+// read, plus the ends of the level's FIFO order queue (slab indices).
+struct L3Level : LevelInfo {
+    static constexpr uint32_t kNil = ~0U;
+    uint32_t head{kNil}; // Oldest order: first to fill
+    uint32_t tail{kNil}; // Newest order
+};
+
+using L3Bids = PriceLadder<BookSide::kBid, L3Level>;
+using L3Asks = PriceLadder<BookSide::kAsk, L3Level>;
+
+// Where a resting order stands in its level's queue.
+struct QueuePosition {
+    bool found{false};
+    char side{0};
+    int64_t price{0};
+    int64_t size{0};         // Remaining size of the order itself
+    int64_t orders_ahead{0}; // Orders that fill before it
+    int64_t size_ahead{0};   // Their combined remaining size
+};
+
+// Order-level (L3) book: every resting order is kept with its remaining
+// size, in arrival order within its price level.
+//
+// Orders live in a slab (a vector with a free list) and are linked into
+// an intrusive doubly-linked FIFO per level, so adding at the tail and
+// unlinking from anywhere are O(1) and never touch the allocator once the
+// slab has grown. The order index maps order ids to slab slots.
+//
+// Unlike OrderBook, which assumes every cancel removes the whole order and
+// every trade fills exactly one, sizes and counts here are exact:
+//   - a cancel removes `size` from its order, and the order only leaves
+//     the book (and the level's count) once nothing is left;
+//   - a trade fills resting orders at its price from the front of the
+//     queue (price-time priority), partially filling the last one.
+// The C that closes a T-F-C, right after its F, is a no-op, since its
+// trade already filled the order, as is any later cancel of an order that
+// is gone.
+//
+// Same interface as OrderBook, so the Reconstructor can drive either.
+template<typename Bids = L3Bids, typename Asks = L3Asks>
+class L3Book {
+public:
+    explicit L3Book(Bids bids = Bids(), Asks asks = Asks())
+        : bids_(std::move(bids)), asks_(std::move(asks)) {}
+
+    void watch_top(int depth) { watch_depth_ = depth; }
+
+    void reserve_orders(size_t n) {
+        index_.reserve(n);
+        nodes_.reserve(n);
+    }
+
+    const Bids& bids() const { return bids_; }
+    const Asks& asks() const { return asks_; }
+    size_t order_count() const { return index_.size(); }
+
+    // Prefetch addresses, as for OrderBook. The order's node is only known
+    // once its index slot has been read, so that is what is returned.
+    const void* order_address(uint64_t order_id) const { return entry_address(index_, order_id); }
+    const void* level_address(char side, int64_t price) const {
+        if (side == 'B') {
+            return entry_address(bids_, price);
+        }
+        return side == 'A' ? entry_address(asks_, price) : nullptr;
+    }
+
+    BookUpdate add(uint64_t order_id, char side, int64_t price, int64_t size) {
+        BookUpdate u;
+        fill_pending_ = false;
+        if (side != 'B' && side != 'A') {
+            return u;
+        }
+        auto existing = index_.find(order_id);
+        if (existing != index_.end()) {
+            // A reused id replaces the old order.
+            remove_order(existing->second, u);
+            index_.erase(existing);
+            u.other_level = true;
+        }
+        if (side == 'B') {
+            enqueue(bids_, order_id, side, price, size, u);
+        } else {
+            enqueue(asks_, order_id, side, price, size, u);
+        }
+        return u;
+    }
+
+    // Removes `size` from the order; it leaves the book once fully
+    // cancelled. The C that closes a T-F-C changes nothing: the trade
+    // filled exactly what it took.
+    BookUpdate cancel(uint64_t order_id, int64_t size) {
+        BookUpdate u;
+        const bool closes_fill = fill_pending_ && order_id == filled_order_;
+        fill_pending_ = false; // Only the C right after its F closes it
+        if (closes_fill) {
+            u.completes_fill = true;
+            return u;
+        }
+        auto it = index_.find(order_id);
+        if (it == index_.end()) {
+            u.unknown_order = true;
+            return u;
+        }
+        const uint32_t n = it->second;
+        u.side = nodes_[n].side;
+        u.price = nodes_[n].price;
+        if (nodes_[n].side == 'B') {
+            u.touched = watched(bids_, nodes_[n].price);
+            reduce(bids_, n, size, u);
+        } else {
+            u.touched = watched(asks_, nodes_[n].price);
+            reduce(asks_, n, size, u);
+        }
+        return u;
+    }
+
+    // `side` is the aggressor's side. A trade fills orders resting on the
+    // OPPOSITE side, front of the queue first; side 'N' is ignored.
+    BookUpdate trade(char side, int64_t price, int64_t size) {
+        BookUpdate u;
+        fill_pending_ = false;
+        if (side == 'A') {
+            fill_queue(bids_, 'B', price, size, u);
+        } else if (side == 'B') {
+            fill_queue(asks_, 'A', price, size, u);
+        }
+        return u;
+    }
+
+    // The F of a T-F-C, as for OrderBook.
+    BookUpdate fill(uint64_t order_id) {
+        filled_order_ = order_id;
+        fill_pending_ = true;
+        return BookUpdate{};
+    }
+
+    // Locating the order is O(1), but counting what is ahead of it walks
+    // the queue in front of it: the query is O(orders ahead), not O(1).
+    // Cancels take orders out of the middle of a queue. A rank kept per
+    // order would then need updating for every order behind the
+    // cancelled one. A per-level order-statistics tree would cost
+    // O(log n) on every cancel. Either way the cost lands on the hot
+    // path that every replay takes, to speed up a query only queue models
+    // make. Use is_first_in_queue() where the front is all that matters.
+    QueuePosition queue_position(uint64_t order_id) {
+        QueuePosition q;
+        auto it = index_.find(order_id);
+        if (it == index_.end()) {
+            return q;
+        }
+        const Node& node = nodes_[it->second];
+        q.found = true;
+        q.side = node.side;
+        q.price = node.price;
+        q.size = node.size;
+        for (uint32_t p = node.prev; p != L3Level::kNil; p = nodes_[p].prev) {
+            ++q.orders_ahead;
+            q.size_ahead += nodes_[p].size;
+        }
+        return q;
+    }
+
+    // True if the order is at the front of its level's queue. O(1).
+    bool is_first_in_queue(uint64_t order_id) {
+        auto it = index_.find(order_id);
+        return it != index_.end() && nodes_[it->second].prev == L3Level::kNil;
+    }
+
+    // Writes both sides, best level first, each level as its queue of
+    // orders front to back, then the fill awaiting its C, with `out.put`
+    // (see checkpoint.h).
+    template<typename Out>
+    void save(Out& out) const {
+        save_levels(out, bids_);
+        save_levels(out, asks_);
+        out.put(static_cast<uint8_t>(fill_pending_));
+        out.put(filled_order_);
+    }
+
+    // Restores what save() wrote into this (empty) book, queue order
+    // included. Returns false if the record is truncated.
+    template<typename In>
+    bool load(In& in) {
+        if (!load_levels(in, bids_, 'B') || !load_levels(in, asks_, 'A')) {
+            return false;
+        }
+        fill_pending_ = in.template get<uint8_t>() != 0;
+        filled_order_ = in.template get<uint64_t>();
+        return in.ok();
+    }
+
+private:
+    struct Node {
+        uint64_t order_id;
+        int64_t price;
+        int64_t size;
+        uint32_t prev;
+        uint32_t next; // Also links the slab's free list
+        char side;
+    };
+
+    template<typename Out, typename Levels>
+    void save_levels(Out& out, const Levels& levels) const {
+        out.put(static_cast<uint64_t>(levels.size()));
+        for (auto it = levels.begin(); it != levels.end(); ++it) {
+            out.put(it->first);
+            out.put(static_cast<uint64_t>(it->second.order_count));
+            for (uint32_t n = it->second.head; n != L3Level::kNil; n = nodes_[n].next) {
+                out.put(nodes_[n].order_id);
+                out.put(nodes_[n].size);
+            }
+        }
+    }
+
+    template<typename In, typename Levels>
+    bool load_levels(In& in, Levels& levels, char side) {
+        BookUpdate ignored;
+        const uint64_t count = in.template get<uint64_t>();
+        for (uint64_t i = 0; i < count && in.ok(); ++i) {
+            const int64_t price = in.template get<int64_t>();
+            const uint64_t orders = in.template get<uint64_t>();
+            for (uint64_t k = 0; k < orders && in.ok(); ++k) {
+                const uint64_t order_id = in.template get<uint64_t>();
+                enqueue(levels, order_id, side, price, in.template get<int64_t>(), ignored);
+            }
+        }
+        return in.ok();
+    }
+
+    template<typename Levels>
+    bool watched(const Levels& levels, int64_t price) const {
+        return watch_depth_ > 0 && within_top(levels, price, watch_depth_);
+    }
+
+    uint32_t allocate_node() {
+        if (free_ != L3Level::kNil) {
+            uint32_t n = free_;
+            free_ = nodes_[n].next;
+            return n;
+        }
+        nodes_.emplace_back();
+        return static_cast<uint32_t>(nodes_.size() - 1);
+    }
+
+    void free_node(uint32_t n) {
+        nodes_[n].next = free_;
+        free_ = n;
+    }
+
+    template<typename Levels>
+    void enqueue(Levels& levels, uint64_t order_id, char side, int64_t price, int64_t size,
+                 BookUpdate& u) {
+        // Or'ed in: a reused id has already flagged the level it left.
+        u.touched = watched(levels, price) || u.touched;
+        const uint32_t n = allocate_node();
+        L3Level& level = levels[price];
+        nodes_[n] = Node{order_id, price, size, level.tail, L3Level::kNil, side};
+        if (level.tail != L3Level::kNil) {
+            nodes_[level.tail].next = n;
+        } else {
+            level.head = n;
+        }
+        level.tail = n;
+        level.total_size += size;
+        level.order_count++;
+        index_[order_id] = n;
+        u.side = side;
+        u.price = price;
+        u.level_size = level.total_size;
+    }
+
+    // Takes node `n` out of `level`'s queue and frees it. Does not touch
+    // the order index.
+    void unlink(L3Level& level, uint32_t n) {
+        Node& node = nodes_[n];
+        if (node.prev != L3Level::kNil) {
+            nodes_[node.prev].next = node.next;
+        } else {
+            level.head = node.next;
+        }
+        if (node.next != L3Level::kNil) {
+            nodes_[node.next].prev = node.prev;
+        } else {
+            level.tail = node.prev;
+        }
+        level.total_size -= node.size;
+        level.order_count--;
+        free_node(n);
+    }
+
+    // Removes `size` from order `n`, dropping the order (and its level,
+    // if it was the last one) when nothing remains.
+    template<typename Levels>
+    void reduce(Levels& levels, uint32_t n, int64_t size, BookUpdate& u) {
+        auto lvl = levels.find(nodes_[n].price);
+        L3Level& level = lvl->second;
+        Node& node = nodes_[n];
+        const int64_t removed = std::min(size, node.size);
+        if (removed < node.size) {
+            node.size -= removed;
+            level.total_size -= removed;
+            u.level_size = level.total_size;
+            return;
+        }
+        index_.erase(node.order_id);
+        unlink(level, n);
+        if (level.order_count == 0) {
+            levels.erase(lvl);
+            u.level_erased = true;
+        } else {
+            u.level_size = level.total_size;
+        }
+    }
+
+    // Fully removes order `n` wherever it rests.
+    void remove_order(uint32_t n, BookUpdate& u) {
+        if (nodes_[n].side == 'B') {
+            u.touched = watched(bids_, nodes_[n].price) || u.touched;
+            drop(bids_, n, u);
+        } else {
+            u.touched = watched(asks_, nodes_[n].price) || u.touched;
+            drop(asks_, n, u);
+        }
+    }
+
+    template<typename Levels>
+    void drop(Levels& levels, uint32_t n, BookUpdate& u) {
+        auto lvl = levels.find(nodes_[n].price);
+        unlink(lvl->second, n);
+        if (lvl->second.order_count == 0) {
+            levels.erase(lvl);
+            u.level_erased = true;
+        }
+    }
+
+    // Fills up to `size` from the front of the queue at `price`, removing
+    // every order it fills completely.
+    template<typename Levels>
+    void fill_queue(Levels& levels, char side, int64_t price, int64_t size, BookUpdate& u) {
+        auto lvl = levels.find(price);
+        if (lvl == levels.end()) {
+            u.missing_level = true;
+            return;
+        }
+        u.touched = watched(levels, price);
+        u.side = side;
+        u.price = price;
+        L3Level& level = lvl->second;
+        int64_t remaining = size;
+        uint32_t n = level.head;
+        while (remaining > 0 && n != L3Level::kNil) {
+            Node& node = nodes_[n];
+            const uint32_t next = node.next;
+            if (node.size <= remaining) {
+                remaining -= node.size;
+                index_.erase(node.order_id);
+                unlink(level, n);
+            } else {
+                node.size -= remaining;
+                level.total_size -= remaining;
+                remaining = 0;
+            }
+            n = next;
+        }
+        if (level.order_count == 0) {
+            levels.erase(lvl);
+            u.level_erased = true;
+        } else {
+            u.level_size = level.total_size;
+        }
+    }
+
+    Bids bids_;
+    Asks asks_;
+    BasicOrderIndex<uint32_t> index_;
+    LargeVector<Node> nodes_;
+    uint32_t free_{L3Level::kNil};
+    int watch_depth_{0};
+    uint64_t filled_order_{0}; // Order of the last F, if fill_pending_
+    bool fill_pending_{false};
+};
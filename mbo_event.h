@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+// One parsed MBO row: the unit handed from the parser to the books, and
+// between threads in the parallel modes. Prices are fixed-point.
+struct MboEvent {
+    int64_t ts_event;
+    int64_t price;
+    int64_t size;
+    uint64_t order_id;
+    uint32_t instrument_id;
+    char action;
+    char side;
+};
+static_assert(sizeof(MboEvent) == 40, "MboEvent should stay at 40 bytes");
@@ -0,0 +1,207 @@
+#include "mbp.h"
+
+#include <cstring>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "book_arena.h"
+#include "l3_book.h"
+#include "order_book.h"
+#include "order_index.h"
+
+// The state behind an MbpFeed that does not depend on the book type: the
+// subscribers, and the parsers of raw input.
+class MbpFeedImpl {
+public:
+    explicit MbpFeedImpl(const MbpFeedOptions& opts) : opts_(opts), dbn_(opts.price_scale) {}
+    virtual ~MbpFeedImpl() = default;
+
+    virtual void apply(const MboEvent* events, size_t n) = 0;
+    virtual bool snapshot(uint32_t instrument_id, MbpRecord& out) const = 0;
+    virtual size_t instrument_count() const = 0;
+
+    size_t on_csv(std::string_view data) {
+        const size_t used = data.rfind('\n') + 1; // 0 without a newline
+        batch_.clear();
+        scanner_.for_each_row(data.substr(0, used), [&](const CsvRow& row) {
+            const char first = row.field_char(kTsRecv);
+            if (first < '0' || first > '9') {
+                return; // The header line
+            }
+            push_row(parse_event(row, opts_.price_scale));
+        });
+        apply(batch_.data(), batch_.size());
+        return used;
+    }
+
+    size_t on_dbn(std::string_view data) {
+        batch_.clear();
+        const size_t used = dbn_.decode(data, [&](const MboEvent& ev, const char*) { push_row(ev); });
+        apply(batch_.data(), batch_.size());
+        return used;
+    }
+
+    bool failed() const { return dbn_.failed() || off_scale_; }
+
+    // The emitters' writer: hands records on to the subscribers.
+    struct Subscribers {
+        void write(const MbpRecord& rec, uint32_t instrument_id) { snapshot(instrument_id, rec); }
+        void write_delta(const MbpDelta& delta, uint32_t instrument_id) { this->delta(instrument_id, delta); }
+
+        MbpFeed::SnapshotFn snapshot;
+        MbpFeed::DeltaFn delta;
+        MbpFeed::TopFn top;
+    };
+
+    Subscribers subscribers;
+
+protected:
+    const MbpFeedOptions opts_;
+
+private:
+    // Rule 1, as in the replay: a feed that opens with an R row opens
+    // with a clear of books that are already empty, and it is skipped.
+    // From a price that price_scale cannot hold on, nothing is applied.
+    void push_row(const MboEvent& ev) {
+        off_scale_ = off_scale_ || ev.price == kOffScalePrice;
+        if (off_scale_) {
+            return;
+        }
+        if (first_row_) {
+            first_row_ = false;
+            if (ev.action == 'R') {
+                return;
+            }
+        }
+        batch_.push_back(ev);
+    }
+
+    CsvScanner scanner_;
+    DbnDecoder dbn_;
+    std::vector<MboEvent> batch_; // Events of the last on_csv() or on_dbn()
+    bool first_row_{true};        // No CSV or DBN row seen yet
+    bool off_scale_{false};       // A row's price did not fit price_scale
+};
+
+namespace {
+
+// An MbpFeed over books of type `Book`. Snapshots go to a per-instrument
+// emitter, for the --emit policy, and are compared at level 0 for the
+// top-of-book subscriber.
+template<typename Book>
+class BasicMbpFeedImpl final : public MbpFeedImpl {
+public:
+    BasicMbpFeedImpl(const MbpFeedOptions& opts, std::function<Book()> make_book)
+        : MbpFeedImpl(opts), recon_(reconstructor_options(opts), std::move(make_book), 0) {}
+
+    void apply(const MboEvent* events, size_t n) override {
+        if (n == 0) {
+            return;
+        }
+        auto write = [this](const Snapshot<kMbpDepth>& snap) { deliver(snap); };
+        if (n == 1) {
+            recon_.process(events[0], scratch_, write);
+        } else {
+            recon_.process(events, n, scratch_, write);
+        }
+        last_ts_ = events[n - 1].ts_event;
+    }
+
+    bool snapshot(uint32_t instrument_id, MbpRecord& out) const override {
+        return recon_.snapshot_of(instrument_id, last_ts_, out);
+    }
+
+    size_t instrument_count() const override { return recon_.instrument_count(); }
+
+private:
+    static ReconstructorOptions reconstructor_options(const MbpFeedOptions& opts) {
+        ReconstructorOptions r;
+        r.emit = opts.emit;
+        r.orders_hint = opts.orders_hint;
+        return r;
+    }
+
+    void deliver(const Snapshot<kMbpDepth>& snap) {
+        if (subscribers.top) {
+            if (snap.index >= tops_.size()) {
+                tops_.resize(snap.index + 1, BidAskPair{kUndefPrice, kUndefPrice, 0, 0, 0, 0});
+            }
+            BidAskPair& last = tops_[snap.index];
+            if (std::memcmp(&last, &snap.rec.levels[0], sizeof(last)) != 0) {
+                last = snap.rec.levels[0];
+                subscribers.top(TopOfBook{snap.rec.ts_event, snap.instrument_id, last});
+            }
+        }
+        if (opts_.emit == EmitMode::kDelta ? !subscribers.delta : !subscribers.snapshot) {
+            return;
+        }
+        if (snap.index >= emitters_.size()) {
+            emitters_.resize(snap.index + 1);
+        }
+        if (!emitters_[snap.index]) {
+            emitters_[snap.index].emplace(subscribers, opts_.emit, snap.instrument_id);
+        }
+        emitters_[snap.index]->emit(snap.rec);
+    }
+
+    Reconstructor<Book, kMbpDepth> recon_;
+    Snapshot<kMbpDepth> scratch_;
+    std::vector<std::optional<BasicSnapshotEmitter<kMbpDepth, Subscribers>>> emitters_; // By instrument index
+    std::vector<BidAskPair> tops_; // By instrument index: level 0 last passed to subscribers.top
+    int64_t last_ts_{0};
+};
+
+// The books of --book, as in the replay's run_book().
+std::unique_ptr<MbpFeedImpl> make_impl(const MbpFeedOptions& opts) {
+    if (opts.book == BookKind::kMap) {
+        using Book = OrderBook<MapBids, MapAsks, std::unordered_map<uint64_t, OrderInfo>>;
+        return std::make_unique<BasicMbpFeedImpl<Book>>(opts, [] { return Book{}; });
+    }
+    if (opts.book == BookKind::kMapArena) {
+        return std::make_unique<BasicMbpFeedImpl<ArenaBook>>(opts, &ArenaBook::make);
+    }
+    const int64_t tick = opts.tick;
+    const size_t span = static_cast<size_t>(opts.ladder_span);
+    if (opts.book == BookKind::kL3) {
+        using Book = L3Book<L3Bids, L3Asks>;
+        return std::make_unique<BasicMbpFeedImpl<Book>>(
+            opts, [tick, span] { return Book(L3Bids(tick, span), L3Asks(tick, span)); });
+    }
+    using Book = OrderBook<FlatBids, FlatAsks, OrderIndex>;
+    return std::make_unique<BasicMbpFeedImpl<Book>>(
+        opts, [tick, span] { return Book(FlatBids(tick, span), FlatAsks(tick, span), OrderIndex()); });
+}
+
+} // namespace
+
+MbpFeed::MbpFeed(const MbpFeedOptions& opts) : impl_(make_impl(opts)) {}
+MbpFeed::~MbpFeed() = default;
+MbpFeed::MbpFeed(MbpFeed&&) noexcept = default;
+MbpFeed& MbpFeed::operator=(MbpFeed&&) noexcept = default;
+
+void MbpFeed::subscribe_snapshots(SnapshotFn fn) { impl_->subscribers.snapshot = std::move(fn); }
+void MbpFeed::subscribe_deltas(DeltaFn fn) { impl_->subscribers.delta = std::move(fn); }
+void MbpFeed::subscribe_top(TopFn fn) { impl_->subscribers.top = std::move(fn); }
+
+void MbpFeed::on_event(const MboEvent& ev) { impl_->apply(&ev, 1); }
+void MbpFeed::on_events(const MboEvent* events, size_t n) { impl_->apply(events, n); }
+size_t MbpFeed::on_csv(std::string_view data) { return impl_->on_csv(data); }
+size_t MbpFeed::on_dbn(std::string_view data) { return impl_->on_dbn(data); }
+bool MbpFeed::failed() const { return impl_->failed(); }
+
+bool MbpFeed::snapshot(uint32_t instrument_id, MbpRecord& out) const {
+    return impl_->snapshot(instrument_id, out);
+}
+
+bool MbpFeed::top(uint32_t instrument_id, TopOfBook& out) const {
+    MbpRecord rec;
+    if (!impl_->snapshot(instrument_id, rec)) {
+        return false;
+    }
+    out = TopOfBook{rec.ts_event, instrument_id, rec.levels[0]};
+    return true;
+}
+
+size_t MbpFeed::instrument_count() const { return impl_->instrument_count(); }
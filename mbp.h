@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+
+#include "csv_parser.h"
+#include "dbn_decoder.h"
+#include "mbo_event.h"
+#include "mbp_writer.h"
+#include "reconstructor.h"
+
+// libmbp: the order book reconstruction as a library, for a process that
+// receives the MBO feed itself, such as a live strategy. Events are pushed
+// in with on_event() or as raw CSV or DBN bytes, and the resulting MBP-10
+// snapshots, level deltas and top-of-book changes are passed to
+// subscriber callbacks before the call returns. There is no file I/O and
+// no thread of its own.
+//
+//     MbpFeed feed;
+//     feed.subscribe_top([&](const TopOfBook& top) { strategy.on_quote(top); });
+//     for (;;) {
+//         feed.on_event(next_event_from_the_wire());
+//     }
+//
+// Link with libmbp.a or libmbp.so (`make lib`). An MbpFeed is not thread
+// safe: call it from one thread at a time, which is also the thread the
+// callbacks run on.
+
+// Configuration of an MbpFeed; the fields match the command-line options
+// of the same names.
+struct MbpFeedOptions {
+    PriceScale price_scale; // Fixed-point units per 1.0 of price in events and raw input, for every instrument
+    BookKind book{BookKind::kFlat};
+    int64_t tick{1};              // PriceLadder slot width, in price units
+    int64_t ladder_span{1 << 16}; // PriceLadder window size, in ticks
+    int64_t orders_hint{0};      // Live orders to reserve per book; 0 = grow on demand
+    // Which snapshots reach subscribe_snapshots() (kAll, kChanged) or
+    // subscribe_deltas() (kDelta). Top-of-book subscribers are called on
+    // every change of the best levels whatever the mode.
+    EmitMode emit{EmitMode::kChanged};
+};
+
+// Best bid and ask of one instrument after the event at `ts_event`. An
+// empty side has price kUndefPrice and size and count 0.
+struct TopOfBook {
+    int64_t ts_event;
+    uint32_t instrument_id;
+    BidAskPair best; // Level 0 of the MBP snapshot
+};
+
+class MbpFeedImpl;
+
+// One book per instrument, fed event by event.
+class MbpFeed {
+public:
+    using SnapshotFn = std::function<void(uint32_t instrument_id, const MbpRecord& rec)>;
+    using DeltaFn = std::function<void(uint32_t instrument_id, const MbpDelta& delta)>;
+    using TopFn = std::function<void(const TopOfBook& top)>;
+
+    explicit MbpFeed(const MbpFeedOptions& opts = MbpFeedOptions());
+    ~MbpFeed();
+    MbpFeed(MbpFeed&&) noexcept;
+    MbpFeed& operator=(MbpFeed&&) noexcept;
+
+    // Subscribers, one of each kind; a later call replaces the earlier
+    // one. Set them before the first event, or the changes before it are
+    // not seen.
+    void subscribe_snapshots(SnapshotFn fn);
+    void subscribe_deltas(DeltaFn fn);
+    void subscribe_top(TopFn fn);
+
+    // Applies one event, or `n` in order, calling the subscribers for
+    // the snapshots they produce. Batches are prefetched ahead, as in the
+    // replay.
+    void on_event(const MboEvent& ev);
+    void on_events(const MboEvent* events, size_t n);
+
+    // Parses and applies the complete rows of MBO CSV text in `data`,
+    // skipping a header line and, as the replay does, an R row that is
+    // the first row of the feed. Returns the bytes consumed: everything
+    // up to the last newline, so a partial row can be passed again with
+    // more.
+    size_t on_csv(std::string_view data);
+
+    // Decodes and applies the whole DBN records in `data`, which starts at
+    // a record (past the metadata; see dbn_records_offset), skipping a
+    // leading R record as on_csv() does. Returns the bytes consumed, as
+    // on_csv(). Stops at a malformed record and sets failed(), which
+    // stays set.
+    //
+    // A CSV or DBN price that price_scale cannot hold exactly, such as
+    // 100.00005 at the default scale, is refused rather than rounded:
+    // it sets failed(), and neither its row nor any later one is applied.
+    size_t on_dbn(std::string_view data);
+    bool failed() const;
+
+    // The current snapshot of `instrument_id`, stamped with the last
+    // event's time. Returns false if the instrument has not been seen.
+    bool snapshot(uint32_t instrument_id, MbpRecord& out) const;
+    bool top(uint32_t instrument_id, TopOfBook& out) const;
+
+    size_t instrument_count() const;
+
+private:
+    std::unique_ptr<MbpFeedImpl> impl_;
+};
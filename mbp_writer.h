@@ -0,0 +1,554 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "arrow_writer.h"
+#include "output_buffer.h"
+
+// Number of price levels per side in an MBP snapshot, unless built for
+// another depth (--depth): the MBP-10 layout of the sample output.
+constexpr int kMbpDepth = 10;
+
+// Largest depth a snapshot can have: level numbers are two digits in CSV
+// column names and one byte in MbpDelta.
+constexpr int kMaxMbpDepth = 100;
+
+// Calls `fn(std::integral_constant<int, I>{})` for I = 0 .. Depth - 1,
+// fully unrolled, and stops after the first call that returns false.
+template<typename Fn, int... I>
+void for_each_level_impl(Fn& fn, std::integer_sequence<int, I...>) {
+    (fn(std::integral_constant<int, I>{}) && ...);
+}
+
+template<int Depth, typename Fn>
+void for_each_level(Fn&& fn) {
+    for_each_level_impl(fn, std::make_integer_sequence<int, Depth>{});
+}
+
+// Price stored for an empty level in binary snapshots (Databento's
+// UNDEF_PRICE), so consumers can tell "no level" from a zero price.
+constexpr int64_t kUndefPrice = std::numeric_limits<int64_t>::max();
+
+// One level of both sides, laid out like Databento's BidAskPair. All
+// fields are naturally aligned, so the struct has no padding.
+struct BidAskPair {
+    int64_t bid_px;
+    int64_t ask_px;
+    int64_t bid_sz;
+    int64_t ask_sz;
+    int32_t bid_ct;
+    int32_t ask_ct;
+};
+
+// A top-of-book snapshot of `Depth` levels per side: the unit of output.
+// The binary format is a sequence of these, byte for byte.
+template<int Depth>
+struct BasicMbpRecord {
+    static_assert(Depth >= 1 && Depth <= kMaxMbpDepth, "unsupported MBP depth");
+    static constexpr int kDepth = Depth;
+
+    int64_t ts_event;
+    BidAskPair levels[Depth];
+};
+
+using MbpRecord = BasicMbpRecord<kMbpDepth>;
+static_assert(sizeof(BidAskPair) == 40, "BidAskPair must be unpadded");
+static_assert(sizeof(MbpRecord) == 8 + 40 * kMbpDepth, "MbpRecord must be unpadded");
+
+// Header at the start of a binary snapshot file. Records follow it
+// immediately, each `record_size` bytes, so a consumer can mmap the file
+// and index records as an array starting at offset `header_size`.
+struct MbpFileHeader {
+    char magic[8];        // "MBPSNAP\0"
+    uint16_t version;     // Format version, currently 1
+    uint16_t depth;       // Levels per side in each record
+    uint32_t header_size; // Bytes before the first record
+    uint32_t record_size; // Bytes per record
+    uint32_t flags;       // kMbpFlag* bits
+    int64_t price_scale;  // Fixed-point units per 1.0 of price
+    int64_t undef_price;  // Price stored for empty levels
+    uint8_t reserved[24];
+};
+static_assert(sizeof(MbpFileHeader) == 64, "MbpFileHeader must be 64 bytes");
+
+inline constexpr char kMbpMagic[8] = {'M', 'B', 'P', 'S', 'N', 'A', 'P', '\0'};
+inline constexpr char kDeltaMagic[8] = {'M', 'B', 'P', 'D', 'E', 'L', 'T', '\0'};
+constexpr uint16_t kMbpVersion = 1;
+
+// Header flag: every record is prefixed with an InstrumentTag.
+constexpr uint32_t kMbpFlagTagged = 1;
+
+// Prefix of each record in tagged output, naming the instrument whose
+// book it describes. Keeps the record that follows 8-byte aligned.
+struct InstrumentTag {
+    uint32_t instrument_id;
+    uint32_t reserved;
+};
+static_assert(sizeof(InstrumentTag) == 8, "InstrumentTag must be unpadded");
+
+// Incremental update: the new contents of one level on one side. A
+// removed level (the side now has fewer levels) has price kUndefPrice.
+struct MbpDelta {
+    int64_t ts_event;
+    int64_t px;
+    int64_t sz;
+    int32_t ct;
+    char side;     // 'A' or 'B'
+    uint8_t level; // 0 = top of book
+    uint8_t reserved[2];
+};
+static_assert(sizeof(MbpDelta) == 32, "MbpDelta must be unpadded");
+
+// Copies the top Depth levels of each side into `rec`. Works with any
+// book side that iterates best-first over (price, level) pairs.
+//
+// Unlike the writer's loops, this one is not force-unrolled: that inlines
+// the book iterators Depth times over, and the code growth cost about a
+// quarter of the MBP-10 throughput.
+template<int Depth, typename Bids, typename Asks>
+void build_snapshot(BasicMbpRecord<Depth>& rec, int64_t ts_event, const Bids& bids, const Asks& asks) {
+    rec.ts_event = ts_event;
+
+    auto bid_it = bids.begin();
+    auto ask_it = asks.begin();
+
+    for (int i = 0; i < Depth; ++i) {
+        BidAskPair& lvl = rec.levels[i];
+        if (ask_it != asks.end()) {
+            lvl.ask_px = ask_it->first;
+            lvl.ask_sz = ask_it->second.total_size;
+            lvl.ask_ct = ask_it->second.order_count;
+            ++ask_it;
+        } else {
+            lvl.ask_px = kUndefPrice;
+            lvl.ask_sz = 0;
+            lvl.ask_ct = 0;
+        }
+        if (bid_it != bids.end()) {
+            lvl.bid_px = bid_it->first;
+            lvl.bid_sz = bid_it->second.total_size;
+            lvl.bid_ct = bid_it->second.order_count;
+            ++bid_it;
+        } else {
+            lvl.bid_px = kUndefPrice;
+            lvl.bid_sz = 0;
+            lvl.bid_ct = 0;
+        }
+    }
+}
+
+// Snapshot output encodings: CSV text, the fixed-width records above, or
+// an Arrow IPC file with one column per CSV column.
+enum class OutputFormat { kCsv, kBinary, kArrow };
+
+// Which snapshots are written:
+//   kAll     - one full snapshot per book event (the MBP-10 sample layout)
+//   kChanged - a full snapshot only when the visible levels changed
+//   kDelta   - one MbpDelta per level that changed, instead of snapshots
+enum class EmitMode { kAll, kChanged, kDelta };
+
+inline constexpr char kCsvDeltaHeader[] = "ts_event,side,level,price,size,count\n";
+
+// Column inserted after ts_event in tagged CSV output.
+inline constexpr char kCsvTagColumn[] = "instrument_id,";
+
+// A string built at compile time.
+template<size_t N>
+struct FixedString {
+    char data[N + 1]{};
+    static constexpr size_t size() { return N; }
+};
+
+// "ts_event", then ",ask_px_NN" and the like (10 characters) for three
+// fields of two sides per level, then a newline.
+constexpr size_t csv_header_length(int depth) {
+    return 8 + static_cast<size_t>(depth) * 2 * 3 * 10 + 1;
+}
+
+template<int Depth>
+constexpr FixedString<csv_header_length(Depth)> make_csv_header() {
+    FixedString<csv_header_length(Depth)> s{};
+    size_t n = 0;
+    for (const char* t = "ts_event"; *t; ++t) {
+        s.data[n++] = *t;
+    }
+    const char* sides[2] = {"ask", "bid"};
+    const char* fields[3] = {"px", "sz", "ct"};
+    for (int i = 0; i < Depth; ++i) {
+        for (const char* side : sides) {
+            for (const char* field : fields) {
+                s.data[n++] = ',';
+                s.data[n++] = side[0];
+                s.data[n++] = side[1];
+                s.data[n++] = side[2];
+                s.data[n++] = '_';
+                s.data[n++] = field[0];
+                s.data[n++] = field[1];
+                s.data[n++] = '_';
+                s.data[n++] = static_cast<char>('0' + i / 10);
+                s.data[n++] = static_cast<char>('0' + i % 10);
+            }
+        }
+    }
+    s.data[n++] = '\n';
+    return s;
+}
+
+// CSV header for Depth levels; at depth 10, exactly as specified in the
+// sample output.
+template<int Depth>
+inline constexpr auto kCsvHeader = make_csv_header<Depth>();
+
+// The sample output's header, to check the generated one against.
+inline constexpr char kSampleCsvHeader[] = "ts_event,ask_px_00,ask_sz_00,ask_ct_00,bid_px_00,bid_sz_00,bid_ct_00,ask_px_01,ask_sz_01,ask_ct_01,bid_px_01,bid_sz_01,bid_ct_01,ask_px_02,ask_sz_02,ask_ct_02,bid_px_02,bid_sz_02,bid_ct_02,ask_px_03,ask_sz_03,ask_ct_03,bid_px_03,bid_sz_03,bid_ct_03,ask_px_04,ask_sz_04,ask_ct_04,bid_px_04,bid_sz_04,bid_ct_04,ask_px_05,ask_sz_05,ask_ct_05,bid_px_05,bid_sz_05,bid_ct_05,ask_px_06,ask_sz_06,ask_ct_06,bid_px_06,bid_sz_06,bid_ct_06,ask_px_07,ask_sz_07,ask_ct_07,bid_px_07,bid_sz_07,bid_ct_07,ask_px_08,ask_sz_08,ask_ct_08,bid_px_08,bid_sz_08,bid_ct_08,ask_px_09,ask_sz_09,ask_ct_09,bid_px_09,bid_sz_09,bid_ct_09\n";
+
+constexpr bool same_text(const char* a, const char* b) {
+    for (; *a && *a == *b; ++a, ++b) {
+    }
+    return *a == *b;
+}
+static_assert(same_text(kCsvHeader<kMbpDepth>.data, kSampleCsvHeader),
+              "generated MBP-10 header must match the sample output");
+
+// Writes snapshots of Depth levels into an OutputBuffer as CSV text (at
+// depth 10, the MBP-10 column layout of the sample output), as the
+// fixed-width binary format above or as Arrow record batches. A tagged writer also records which
+// instrument each row belongs to, so several books can share one output
+// stream.
+//
+// Everything that depends on the depth, from the header text to the level
+// loop, is fixed at compile time, so a top-of-book (depth 1) writer only
+// pays for the columns it writes.
+template<int Depth>
+class BasicMbpWriter {
+public:
+    using Record = BasicMbpRecord<Depth>;
+
+    BasicMbpWriter(OutputBuffer& out, OutputFormat format, EmitMode mode, int64_t price_scale,
+                   bool tagged = false)
+        : out_(out), format_(format), mode_(mode), price_scale_(price_scale), tagged_(tagged) {}
+
+    void write_header() {
+        const bool delta = mode_ == EmitMode::kDelta;
+        if (format_ == OutputFormat::kArrow) {
+            arrow_ = std::make_unique<ArrowFileWriter>(out_, delta ? arrow_delta_fields() : arrow_fields(),
+                                                       ArrowFileWriter::Metadata{
+                                                           {"price_scale", std::to_string(price_scale_)},
+                                                           {"depth", std::to_string(Depth)}});
+            return;
+        }
+        if (format_ == OutputFormat::kBinary) {
+            MbpFileHeader h{};
+            std::memcpy(h.magic, delta ? kDeltaMagic : kMbpMagic, sizeof(h.magic));
+            h.version = kMbpVersion;
+            h.depth = Depth;
+            h.header_size = sizeof(MbpFileHeader);
+            h.record_size = delta ? sizeof(MbpDelta) : sizeof(Record);
+            if (tagged_) {
+                h.record_size += sizeof(InstrumentTag);
+                h.flags = kMbpFlagTagged;
+            }
+            h.price_scale = price_scale_;
+            h.undef_price = kUndefPrice;
+            out_.append(reinterpret_cast<const char*>(&h), sizeof(h));
+            return;
+        }
+        const char* header = delta ? kCsvDeltaHeader : kCsvHeader<Depth>.data;
+        size_t len = delta ? sizeof(kCsvDeltaHeader) - 1 : kCsvHeader<Depth>.size();
+        if (tagged_) {
+            // "ts_event," then the tag column, then the rest.
+            constexpr size_t kTsColumn = 9;
+            out_.append(header, kTsColumn);
+            out_.append(kCsvTagColumn, sizeof(kCsvTagColumn) - 1);
+            header += kTsColumn;
+            len -= kTsColumn;
+        }
+        out_.append(header, len);
+    }
+
+    void write_delta(const MbpDelta& d, uint32_t instrument_id = 0) {
+        if (format_ == OutputFormat::kBinary) {
+            put_tag(instrument_id);
+            out_.append(reinterpret_cast<const char*>(&d), sizeof(d));
+            return;
+        }
+        if (format_ == OutputFormat::kArrow) {
+            put_arrow_delta(d, instrument_id);
+            return;
+        }
+        char* p = out_.reserve(kMaxCsvDeltaRow);
+        p = std::to_chars(p, p + 20, d.ts_event).ptr;
+        p = put_csv_tag(p, instrument_id);
+        *p++ = ',';
+        *p++ = d.side;
+        *p++ = ',';
+        p = std::to_chars(p, p + 3, d.level).ptr;
+        if (d.px != kUndefPrice) {
+            p = put_level(p, d.px, d.sz, d.ct);
+        } else {
+            std::memcpy(p, ",,,", 3);
+            p += 3;
+        }
+        *p++ = '\n';
+        out_.commit(p);
+    }
+
+    void write(const Record& rec, uint32_t instrument_id = 0) {
+        if (format_ == OutputFormat::kBinary) {
+            put_tag(instrument_id);
+            out_.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+            return;
+        }
+        if (format_ == OutputFormat::kArrow) {
+            put_arrow(rec, instrument_id);
+            return;
+        }
+        write_csv(rec, instrument_id);
+    }
+
+    // Completes the output after the last record: an Arrow file still
+    // needs its last batch and its footer. The buffer is the caller's to
+    // close afterwards.
+    void finish() {
+        if (arrow_) {
+            arrow_->finish();
+        }
+    }
+
+private:
+    // Upper bound on one CSV row: a 20-digit timestamp, then per level and
+    // side three commas, two 20-digit int64s and an 11-digit int32.
+    // Tagged rows add a comma and a 10-digit uint32.
+    static constexpr size_t kMaxCsvTag = 1 + 10;
+    static constexpr size_t kMaxCsvRow = 20 + kMaxCsvTag + Depth * 2 * (3 + 20 + 20 + 11) + 1;
+    static constexpr size_t kMaxCsvDeltaRow = 20 + kMaxCsvTag + 4 + 4 + (3 + 20 + 20 + 11) + 1;
+
+    // ",,," for every remaining (ask, bid) pair once both sides run out.
+    static constexpr size_t kEmptyPairLen = 6;
+    static constexpr FixedString<Depth * kEmptyPairLen> make_empty_tail() {
+        FixedString<Depth * kEmptyPairLen> s{};
+        for (size_t i = 0; i < s.size(); ++i) {
+            s.data[i] = ',';
+        }
+        return s;
+    }
+    inline static constexpr FixedString<Depth * kEmptyPairLen> kEmptyTail = make_empty_tail();
+
+    static char* put_level(char* p, int64_t px, int64_t sz, int32_t ct) {
+        *p++ = ',';
+        p = std::to_chars(p, p + 20, px).ptr;
+        *p++ = ',';
+        p = std::to_chars(p, p + 20, sz).ptr;
+        *p++ = ',';
+        return std::to_chars(p, p + 11, ct).ptr;
+    }
+
+    void put_tag(uint32_t instrument_id) {
+        if (tagged_) {
+            InstrumentTag tag{instrument_id, 0};
+            out_.append(reinterpret_cast<const char*>(&tag), sizeof(tag));
+        }
+    }
+
+    char* put_csv_tag(char* p, uint32_t instrument_id) const {
+        if (!tagged_) {
+            return p;
+        }
+        *p++ = ',';
+        return std::to_chars(p, p + 10, instrument_id).ptr;
+    }
+
+    // Arrow columns: ts_event, the tag, then the CSV level columns, whose
+    // empty fields are nulls.
+    std::vector<ArrowField> arrow_fields() const {
+        std::vector<ArrowField> fields{{"ts_event", ArrowType::kTimestampNs, false}};
+        if (tagged_) {
+            fields.push_back({"instrument_id", ArrowType::kUInt32, false});
+        }
+        const std::string_view header(kCsvHeader<Depth>.data, kCsvHeader<Depth>.size() - 1);
+        for (size_t pos = header.find(',') + 1, i = 0; pos != 0; pos = header.find(',', pos) + 1, ++i) {
+            const std::string_view name = header.substr(pos, header.find(',', pos) - pos);
+            fields.push_back({std::string(name), i % 3 == 2 ? ArrowType::kInt32 : ArrowType::kInt64, true});
+        }
+        return fields;
+    }
+
+    std::vector<ArrowField> arrow_delta_fields() const {
+        std::vector<ArrowField> fields{{"ts_event", ArrowType::kTimestampNs, false}};
+        if (tagged_) {
+            fields.push_back({"instrument_id", ArrowType::kUInt32, false});
+        }
+        fields.push_back({"side", ArrowType::kChar, false});
+        fields.push_back({"level", ArrowType::kUInt8, false});
+        fields.push_back({"price", ArrowType::kInt64, true});
+        fields.push_back({"size", ArrowType::kInt64, true});
+        fields.push_back({"count", ArrowType::kInt32, true});
+        return fields;
+    }
+
+    static void put_arrow_level(ArrowBatch& batch, size_t column, int64_t px, int64_t sz, int32_t ct) {
+        if (px == kUndefPrice) {
+            batch.set_null<int64_t>(column);
+            batch.set_null<int64_t>(column + 1);
+            batch.set_null<int32_t>(column + 2);
+            return;
+        }
+        batch.set(column, px);
+        batch.set(column + 1, sz);
+        batch.set(column + 2, ct);
+    }
+
+    void put_arrow(const Record& rec, uint32_t instrument_id) {
+        ArrowBatch& batch = arrow_->batch();
+        batch.set(0, rec.ts_event);
+        const size_t first = tagged_ ? 2 : 1;
+        if (tagged_) {
+            batch.set(1, instrument_id);
+        }
+        for_each_level<Depth>([&](int i) {
+            const BidAskPair& lvl = rec.levels[i];
+            const size_t column = first + static_cast<size_t>(i) * 6;
+            put_arrow_level(batch, column, lvl.ask_px, lvl.ask_sz, lvl.ask_ct);
+            put_arrow_level(batch, column + 3, lvl.bid_px, lvl.bid_sz, lvl.bid_ct);
+            return true;
+        });
+        arrow_->commit_row();
+    }
+
+    void put_arrow_delta(const MbpDelta& d, uint32_t instrument_id) {
+        ArrowBatch& batch = arrow_->batch();
+        batch.set(0, d.ts_event);
+        const size_t first = tagged_ ? 2 : 1;
+        if (tagged_) {
+            batch.set(1, instrument_id);
+        }
+        batch.set(first, d.side);
+        batch.set(first + 1, d.level);
+        put_arrow_level(batch, first + 2, d.px, d.sz, d.ct);
+        arrow_->commit_row();
+    }
+
+    void write_csv(const Record& rec, uint32_t instrument_id) {
+        char* p = out_.reserve(kMaxCsvRow);
+        p = std::to_chars(p, p + 20, rec.ts_event).ptr;
+        p = put_csv_tag(p, instrument_id);
+        for_each_level<Depth>([&](int i) {
+            const BidAskPair& lvl = rec.levels[i];
+            bool has_ask = lvl.ask_px != kUndefPrice;
+            bool has_bid = lvl.bid_px != kUndefPrice;
+            if (!has_ask && !has_bid) {
+                // Both sides are exhausted, so every deeper level is too.
+                size_t n = static_cast<size_t>(Depth - i) * kEmptyPairLen;
+                std::memcpy(p, kEmptyTail.data, n);
+                p += n;
+                return false;
+            }
+            // Ask Price, Size, Count
+            if (has_ask) {
+                p = put_level(p, lvl.ask_px, lvl.ask_sz, lvl.ask_ct);
+            } else {
+                std::memcpy(p, ",,,", 3);
+                p += 3;
+            }
+            // Bid Price, Size, Count
+            if (has_bid) {
+                p = put_level(p, lvl.bid_px, lvl.bid_sz, lvl.bid_ct);
+            } else {
+                std::memcpy(p, ",,,", 3);
+                p += 3;
+            }
+            return true;
+        });
+        *p++ = '\n';
+        out_.commit(p);
+    }
+
+    OutputBuffer& out_;
+    OutputFormat format_;
+    EmitMode mode_;
+    int64_t price_scale_;
+    bool tagged_;
+    std::unique_ptr<ArrowFileWriter> arrow_; // With OutputFormat::kArrow, from write_header()
+};
+
+using MbpWriter = BasicMbpWriter<kMbpDepth>;
+
+// Applies the EmitMode policy: remembers the last snapshot written and
+// passes on either every snapshot, only those whose levels changed, or
+// just the per-level differences. There is one emitter per book; records
+// are tagged with `instrument_id` when the writer is shared. `Writer` is
+// anything with BasicMbpWriter's write(rec, id) and write_delta(delta, id),
+// such as the callbacks of an MbpFeed (mbp.h).
+template<int Depth, typename Writer = BasicMbpWriter<Depth>>
+class BasicSnapshotEmitter {
+public:
+    using Record = BasicMbpRecord<Depth>;
+
+    BasicSnapshotEmitter(Writer& writer, EmitMode mode, uint32_t instrument_id = 0)
+        : writer_(&writer), mode_(mode), instrument_id_(instrument_id) {
+        for (BidAskPair& lvl : last_.levels) {
+            lvl = BidAskPair{kUndefPrice, kUndefPrice, 0, 0, 0, 0};
+        }
+    }
+
+    // In kAll mode every event is written, even if the book did not move.
+    // Otherwise callers may skip events that provably left the top
+    // Depth levels alone (see within_top) without building a snapshot.
+    bool emits_every_event() const { return mode_ == EmitMode::kAll; }
+
+    // Sets the last snapshot written without writing `rec`.
+    void prime(const Record& rec) { last_ = rec; }
+
+    void emit(const Record& rec) {
+        switch (mode_) {
+            case EmitMode::kAll:
+                writer_->write(rec, instrument_id_);
+                return;
+            case EmitMode::kChanged:
+                if (std::memcmp(rec.levels, last_.levels, sizeof(rec.levels)) != 0) {
+                    writer_->write(rec, instrument_id_);
+                    last_ = rec;
+                }
+                return;
+            case EmitMode::kDelta:
+                emit_deltas(rec);
+                return;
+        }
+    }
+
+private:
+    void emit_deltas(const Record& rec) {
+        for_each_level<Depth>([&](int i) {
+            const BidAskPair& now = rec.levels[i];
+            BidAskPair& was = last_.levels[i];
+            if (now.ask_px != was.ask_px || now.ask_sz != was.ask_sz || now.ask_ct != was.ask_ct) {
+                writer_->write_delta(MbpDelta{rec.ts_event, now.ask_px, now.ask_sz, now.ask_ct,
+                                              'A', static_cast<uint8_t>(i), {}},
+                                     instrument_id_);
+            }
+            if (now.bid_px != was.bid_px || now.bid_sz != was.bid_sz || now.bid_ct != was.bid_ct) {
+                writer_->write_delta(MbpDelta{rec.ts_event, now.bid_px, now.bid_sz, now.bid_ct,
+                                              'B', static_cast<uint8_t>(i), {}},
+                                     instrument_id_);
+            }
+            was = now;
+            return true;
+        });
+    }
+
+    Writer* writer_;
+    EmitMode mode_;
+    uint32_t instrument_id_;
+    Record last_{};
+};
+
+using SnapshotEmitter = BasicSnapshotEmitter<kMbpDepth>;
@@ -0,0 +1,584 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "huge_pages.h"
+
+// Represents a single price level in the order book.
+// Tracks total volume and number of orders.
+struct LevelInfo {
+    int64_t total_size{0};
+    int32_t order_count{0};
+};
+
+// Stores essential info about an order for O(1) lookup.
+struct OrderInfo {
+    int64_t price;
+    char side;
+};
+
+// Red-black tree book sides: the reference implementation.
+using MapBids = std::map<int64_t, LevelInfo, std::greater<int64_t>>;
+using MapAsks = std::map<int64_t, LevelInfo>;
+
+enum class BookSide { kBid, kAsk };
+
+// One side of the book stored as a flat, tick-indexed array of levels.
+//
+// A window of `span` consecutive ticks is kept in a vector, with a bitmap
+// of occupied slots and a cursor on the best (highest bid / lowest ask)
+// occupied slot. Lookups, inserts and erases inside the window are O(1),
+// and walking the top levels is a bitmap scan over contiguous memory.
+//
+// Prices outside the window, or off the tick grid, live in a small
+// overflow std::map, and iteration merges the two in price order, so the
+// ladder behaves exactly like the std::map it replaces. The window is
+// re-centred on the next price seen whenever it becomes empty.
+//
+// `Level` is the per-level payload: LevelInfo, or a type extending it.
+//
+// The interface mirrors the subset of std::map that the book uses. As
+// with std::map, the non-const find() and end() return a mutable
+// `iterator`; here it is only a handle for updating or erasing the level
+// found, and traversal goes through the const iterators.
+template<BookSide Side, typename Level = LevelInfo>
+class PriceLadder {
+    using Compare = std::conditional_t<Side == BookSide::kBid,
+                                       std::greater<int64_t>, std::less<int64_t>>;
+    using Overflow = std::map<int64_t, Level, Compare>;
+    static constexpr int64_t kNone = -1;
+
+public:
+    // `tick` is the price increment between adjacent slots, in fixed-point
+    // units. `span` is the window size in ticks (rounded up to 64).
+    explicit PriceLadder(int64_t tick = 1, size_t span = 1 << 16)
+        : tick_(tick > 0 ? tick : 1),
+          span_((span + 63) / 64 * 64),
+          levels_(span_),
+          bits_(span_ / 64) {}
+
+    // Returns the level at `price`, creating an empty one if needed.
+    Level& operator[](int64_t price) {
+        int64_t slot = slot_of(price);
+        if (slot == kNone && window_count_ == 0) {
+            recenter(price);
+            slot = slot_of(price);
+        }
+        if (slot == kNone) {
+            return overflow_[price];
+        }
+        if (!test(slot)) {
+            set(slot);
+            levels_[slot] = Level{};
+        }
+        return levels_[slot];
+    }
+
+    size_t count(int64_t price) const {
+        int64_t slot = slot_of(price);
+        return slot == kNone ? overflow_.count(price) : test(slot);
+    }
+
+    size_t erase(int64_t price) {
+        int64_t slot = slot_of(price);
+        if (slot == kNone) {
+            return overflow_.erase(price);
+        }
+        if (!test(slot)) {
+            return 0;
+        }
+        clear(slot);
+        return 1;
+    }
+
+    // Where the level at `price` lives if it is in the window, or nullptr:
+    // what to prefetch ahead of an update there.
+    const void* slot_address(int64_t price) const {
+        int64_t slot = slot_of(price);
+        return slot == kNone ? nullptr : &levels_[slot];
+    }
+
+    // Handle on one existing level, as returned by find(). Dereferences to
+    // a (price, level) pair whose level is mutable.
+    class iterator {
+    public:
+        using value_type = std::pair<int64_t, Level&>;
+
+        struct arrow_proxy {
+            value_type value;
+            const value_type* operator->() const { return &value; }
+        };
+
+        value_type operator*() const {
+            return slot_ == kNone ? value_type{ovf_->first, ovf_->second}
+                                  : value_type{price_, *level_};
+        }
+        arrow_proxy operator->() const { return {**this}; }
+
+        bool operator==(const iterator& o) const { return slot_ == o.slot_ && ovf_ == o.ovf_; }
+        bool operator!=(const iterator& o) const { return !(*this == o); }
+
+    private:
+        friend class PriceLadder;
+
+        iterator(int64_t slot, int64_t price, Level* level, typename Overflow::iterator ovf)
+            : slot_(slot), price_(price), level_(level), ovf_(ovf) {}
+
+        int64_t slot_;
+        int64_t price_;
+        Level* level_;
+        typename Overflow::iterator ovf_;
+    };
+
+    iterator find(int64_t price) {
+        int64_t slot = slot_of(price);
+        if (slot == kNone) {
+            return {kNone, price, nullptr, overflow_.find(price)};
+        }
+        if (!test(slot)) {
+            return end();
+        }
+        return {slot, price, &levels_[slot], overflow_.end()};
+    }
+
+    iterator end() { return {kNone, 0, nullptr, overflow_.end()}; }
+
+    void erase(iterator it) {
+        if (it.slot_ == kNone) {
+            overflow_.erase(it.ovf_);
+        } else {
+            clear(it.slot_);
+        }
+    }
+
+    size_t size() const { return window_count_ + overflow_.size(); }
+    bool empty() const { return size() == 0; }
+
+    // Orders prices best-first, like std::map::key_comp.
+    Compare key_comp() const { return Compare{}; }
+
+    // Forward iteration from the best price outward, over both the window
+    // and the overflow map. Dereferences to a (price, level) pair.
+    class const_iterator {
+    public:
+        using value_type = std::pair<int64_t, const Level&>;
+
+        struct arrow_proxy {
+            value_type value;
+            const value_type* operator->() const { return &value; }
+        };
+
+        value_type operator*() const {
+            if (in_window_) {
+                return {ladder_->price_of(slot_), ladder_->levels_[slot_]};
+            }
+            return {ovf_->first, ovf_->second};
+        }
+        arrow_proxy operator->() const { return {**this}; }
+
+        const_iterator& operator++() {
+            if (in_window_) {
+                slot_ = ladder_->next_worse(slot_);
+            } else {
+                ++ovf_;
+            }
+            settle();
+            return *this;
+        }
+
+        bool operator==(const const_iterator& o) const {
+            return slot_ == o.slot_ && ovf_ == o.ovf_;
+        }
+        bool operator!=(const const_iterator& o) const { return !(*this == o); }
+
+    private:
+        friend class PriceLadder;
+
+        const_iterator(const PriceLadder* ladder, int64_t slot,
+                       typename Overflow::const_iterator ovf)
+            : ladder_(ladder), slot_(slot), ovf_(ovf) {
+            settle();
+        }
+
+        // Picks whichever source holds the better remaining price.
+        void settle() {
+            if (slot_ == kNone) {
+                in_window_ = false;
+            } else if (ovf_ == ladder_->overflow_.end()) {
+                in_window_ = true;
+            } else {
+                in_window_ = Compare{}(ladder_->price_of(slot_), ovf_->first);
+            }
+        }
+
+        const PriceLadder* ladder_;
+        int64_t slot_;
+        typename Overflow::const_iterator ovf_;
+        bool in_window_{false};
+    };
+
+    const_iterator begin() const { return {this, best_, overflow_.begin()}; }
+    const_iterator end() const { return {this, kNone, overflow_.end()}; }
+
+private:
+    int64_t price_of(int64_t slot) const { return base_ + slot * tick_; }
+
+    // Window slot for `price`, or kNone if it is outside or off-grid.
+    int64_t slot_of(int64_t price) const {
+        int64_t offset = price - base_;
+        if (offset < 0) {
+            return kNone;
+        }
+        int64_t slot = offset;
+        if (tick_ != 1) {
+            if (offset % tick_ != 0) {
+                return kNone;
+            }
+            slot = offset / tick_;
+        }
+        return slot < static_cast<int64_t>(span_) ? slot : kNone;
+    }
+
+    bool test(int64_t slot) const {
+        return (bits_[slot >> 6] >> (slot & 63)) & 1;
+    }
+
+    void set(int64_t slot) {
+        bits_[slot >> 6] |= 1ULL << (slot & 63);
+        ++window_count_;
+        if (best_ == kNone || better(slot, best_)) {
+            best_ = slot;
+        }
+    }
+
+    void clear(int64_t slot) {
+        bits_[slot >> 6] &= ~(1ULL << (slot & 63));
+        --window_count_;
+        if (slot == best_) {
+            best_ = window_count_ == 0 ? kNone : next_worse(slot);
+        }
+    }
+
+    static bool better(int64_t a, int64_t b) {
+        return Side == BookSide::kBid ? a > b : a < b;
+    }
+
+    // Next occupied slot after `slot` moving away from the touch
+    // (downwards for bids, upwards for asks), or kNone.
+    int64_t next_worse(int64_t slot) const {
+        if constexpr (Side == BookSide::kBid) {
+            if (slot == 0) {
+                return kNone;
+            }
+            int64_t from = slot - 1;
+            int64_t word = from >> 6;
+            uint64_t bits = bits_[word] & (~0ULL >> (63 - (from & 63)));
+            while (bits == 0) {
+                if (--word < 0) {
+                    return kNone;
+                }
+                bits = bits_[word];
+            }
+            return word * 64 + 63 - __builtin_clzll(bits);
+        } else {
+            int64_t from = slot + 1;
+            if (from >= static_cast<int64_t>(span_)) {
+                return kNone;
+            }
+            int64_t word = from >> 6;
+            const int64_t words = static_cast<int64_t>(bits_.size());
+            uint64_t bits = bits_[word] & (~0ULL << (from & 63));
+            while (bits == 0) {
+                if (++word >= words) {
+                    return kNone;
+                }
+                bits = bits_[word];
+            }
+            return word * 64 + __builtin_ctzll(bits);
+        }
+    }
+
+    // Moves the (empty) window so that `price` sits in its middle, then
+    // pulls in any overflow levels that now fall inside it.
+    void recenter(int64_t price) {
+        base_ = price - static_cast<int64_t>(span_ / 2) * tick_;
+        for (auto it = overflow_.begin(); it != overflow_.end();) {
+            int64_t slot = slot_of(it->first);
+            if (slot == kNone) {
+                ++it;
+                continue;
+            }
+            set(slot);
+            levels_[slot] = it->second;
+            it = overflow_.erase(it);
+        }
+    }
+
+    int64_t tick_;
+    size_t span_;
+    int64_t base_{0};
+    LargeVector<Level> levels_;
+    std::vector<uint64_t> bits_;
+    size_t window_count_{0};
+    int64_t best_{kNone};
+    Overflow overflow_;
+};
+
+using FlatBids = PriceLadder<BookSide::kBid>;
+using FlatAsks = PriceLadder<BookSide::kAsk>;
+
+// True if the level at `price` is, or would be, among the `depth` best
+// levels of `side`: fewer than `depth` existing levels are strictly
+// better. A mutation at any other price cannot change the visible top of
+// the book. Costs at most `depth` iterator steps.
+template<typename Levels>
+bool within_top(const Levels& side, int64_t price, int depth) {
+    auto better = side.key_comp();
+    int rank = 0;
+    for (auto it = side.begin(); it != side.end() && rank < depth; ++it, ++rank) {
+        if (!better(it->first, price)) {
+            return true;
+        }
+    }
+    return rank < depth;
+}
+
+// Calls fn(key, value) for every entry of a std::map-like container. The
+// flat OrderIndex has its own overload.
+template<typename Map, typename Fn>
+void for_each_entry(const Map& map, Fn&& fn) {
+    for (const auto& [key, value] : map) {
+        fn(key, value);
+    }
+}
+
+// Address to prefetch ahead of an update of entry `key`, or nullptr. Nodes
+// of the std containers cannot be located without the lookup itself; the
+// flat ladder and OrderIndex overload this.
+template<typename Map, typename Key>
+const void* entry_address(const Map&, Key) {
+    return nullptr;
+}
+
+template<BookSide Side, typename Level>
+const void* entry_address(const PriceLadder<Side, Level>& ladder, int64_t price) {
+    return ladder.slot_address(price);
+}
+
+// What an add, cancel or trade did to the book.
+struct BookUpdate {
+    bool touched{false};       // May have changed the watched top levels
+    bool unknown_order{false}; // Cancel of an order id that is not resting
+    bool missing_level{false}; // Cancel or trade at a price with no level
+    bool level_erased{false};  // A level emptied and was removed
+    bool other_level{false};   // Changed a second level too (L3 id reuse)
+    bool completes_fill{false}; // The C that closes a T-F-C; its trade already applied it
+    char side{0};              // Side of the level changed, or 0 if none
+    int64_t price{0};          // Its price
+    int64_t level_size{0};     // Its total size now; 0 once erased
+};
+
+// One instrument's book: both sides plus the resting orders that make
+// them up, and the add / cancel / trade rules that update them.
+//
+// Each operation looks its level up once and updates or erases it through
+// the same iterator. The containers are template parameters, so the same
+// rules drive the std::map reference book, its arena variant and the flat
+// PriceLadder / OrderIndex book.
+//
+// When `watch_top(depth)` is set, each update reports in `touched`
+// whether it could have changed the top `depth` levels of its side (see
+// within_top); otherwise `touched` is not computed.
+template<typename Bids, typename Asks, typename Orders>
+class OrderBook {
+public:
+    explicit OrderBook(Bids bids = Bids(), Asks asks = Asks(), Orders orders = Orders())
+        : bids_(std::move(bids)), asks_(std::move(asks)), orders_(std::move(orders)) {}
+
+    void watch_top(int depth) { watch_depth_ = depth; }
+    void reserve_orders(size_t n) { orders_.reserve(n); }
+
+    const Bids& bids() const { return bids_; }
+    const Asks& asks() const { return asks_; }
+    size_t order_count() const { return orders_.size(); }
+
+    // What an event on `order_id`, or at `price` on the resting `side`,
+    // reads first, for prefetching a few events ahead; nullptr if unknown.
+    const void* order_address(uint64_t order_id) const { return entry_address(orders_, order_id); }
+    const void* level_address(char side, int64_t price) const {
+        if (side == 'B') {
+            return entry_address(bids_, price);
+        }
+        return side == 'A' ? entry_address(asks_, price) : nullptr;
+    }
+
+    BookUpdate add(uint64_t order_id, char side, int64_t price, int64_t size) {
+        BookUpdate u;
+        fill_pending_ = false;
+        if (side == 'B') {
+            add_to_level(bids_, side, price, size, u);
+        } else if (side == 'A') {
+            add_to_level(asks_, side, price, size, u);
+        }
+        orders_[order_id] = {price, side};
+        return u;
+    }
+
+    // Removes `size` from the order's level and forgets the order. The C
+    // that closes a T-F-C only forgets it: the trade already took the
+    // filled size off the level.
+    BookUpdate cancel(uint64_t order_id, int64_t size) {
+        BookUpdate u;
+        const bool closes_fill = fill_pending_ && order_id == filled_order_;
+        fill_pending_ = false; // Only the C right after its F closes it
+        if (closes_fill) {
+            orders_.erase(order_id);
+            u.completes_fill = true;
+            return u;
+        }
+        auto it = orders_.find(order_id);
+        if (it == orders_.end()) {
+            u.unknown_order = true;
+            return u;
+        }
+        OrderInfo info = it->second;
+        if (info.side == 'B') {
+            reduce_level(bids_, 'B', info.price, size, u);
+        } else if (info.side == 'A') {
+            reduce_level(asks_, 'A', info.price, size, u);
+        }
+        orders_.erase(it);
+        return u;
+    }
+
+    // `side` is the aggressor's side. A trade consumes liquidity resting
+    // on the OPPOSITE side (Rule 2); side 'N' trades are ignored (Rule 3).
+    BookUpdate trade(char side, int64_t price, int64_t size) {
+        BookUpdate u;
+        fill_pending_ = false;
+        if (side == 'A') { // Aggressive Ask (sell) hits a resting Bid
+            reduce_level(bids_, 'B', price, size, u);
+        } else if (side == 'B') { // Aggressive Bid (buy) hits a resting Ask
+            reduce_level(asks_, 'A', price, size, u);
+        }
+        return u;
+    }
+
+    // The F of a T-F-C: names the resting order the trade filled, whose
+    // C closes the sequence if it comes next (see cancel()). Changes
+    // nothing visible.
+    BookUpdate fill(uint64_t order_id) {
+        filled_order_ = order_id;
+        fill_pending_ = true;
+        return BookUpdate{};
+    }
+
+    // Writes both sides, best level first, then the resting orders and
+    // the fill awaiting its C, with `out.put` (see checkpoint.h).
+    template<typename Out>
+    void save(Out& out) const {
+        save_levels(out, bids_);
+        save_levels(out, asks_);
+        out.put(static_cast<uint64_t>(orders_.size()));
+        for_each_entry(orders_, [&](uint64_t order_id, const OrderInfo& info) {
+            out.put(order_id);
+            out.put(info.price);
+            out.put(info.side);
+        });
+        out.put(static_cast<uint8_t>(fill_pending_));
+        out.put(filled_order_);
+    }
+
+    // Restores what save() wrote into this (empty) book. Returns false if
+    // the record is truncated.
+    template<typename In>
+    bool load(In& in) {
+        if (!load_levels(in, bids_) || !load_levels(in, asks_)) {
+            return false;
+        }
+        const uint64_t count = in.template get<uint64_t>();
+        for (uint64_t i = 0; i < count && in.ok(); ++i) {
+            const uint64_t order_id = in.template get<uint64_t>();
+            const int64_t price = in.template get<int64_t>();
+            orders_[order_id] = {price, in.template get<char>()};
+        }
+        fill_pending_ = in.template get<uint8_t>() != 0;
+        filled_order_ = in.template get<uint64_t>();
+        return in.ok();
+    }
+
+private:
+    template<typename Out, typename Levels>
+    static void save_levels(Out& out, const Levels& levels) {
+        out.put(static_cast<uint64_t>(levels.size()));
+        for (auto it = levels.begin(); it != levels.end(); ++it) {
+            out.put(it->first);
+            out.put(it->second.total_size);
+            out.put(it->second.order_count);
+        }
+    }
+
+    template<typename In, typename Levels>
+    static bool load_levels(In& in, Levels& levels) {
+        const uint64_t count = in.template get<uint64_t>();
+        for (uint64_t i = 0; i < count && in.ok(); ++i) {
+            const int64_t price = in.template get<int64_t>();
+            LevelInfo& level = levels[price];
+            level.total_size = in.template get<int64_t>();
+            level.order_count = in.template get<int32_t>();
+        }
+        return in.ok();
+    }
+
+    template<typename Levels>
+    bool watched(const Levels& levels, int64_t price) const {
+        return watch_depth_ > 0 && within_top(levels, price, watch_depth_);
+    }
+
+    template<typename Levels>
+    void add_to_level(Levels& levels, char side, int64_t price, int64_t size, BookUpdate& u) {
+        u.touched = watched(levels, price);
+        LevelInfo& level = levels[price];
+        level.total_size += size;
+        level.order_count++;
+        u.side = side;
+        u.price = price;
+        u.level_size = level.total_size;
+    }
+
+    // Takes one order of `size` out of the level at `price`, erasing the
+    // level once its volume is gone. A trade implies a single resting
+    // order was filled.
+    template<typename Levels>
+    void reduce_level(Levels& levels, char side, int64_t price, int64_t size, BookUpdate& u) {
+        auto it = levels.find(price);
+        if (it == levels.end()) {
+            u.missing_level = true;
+            return;
+        }
+        u.touched = watched(levels, price);
+        u.side = side;
+        u.price = price;
+        LevelInfo& level = it->second;
+        level.total_size -= size;
+        level.order_count--;
+        if (level.total_size <= 0) {
+            levels.erase(it);
+            u.level_erased = true;
+        } else {
+            u.level_size = level.total_size;
+        }
+    }
+
+    Bids bids_;
+    Asks asks_;
+    Orders orders_;
+    int watch_depth_{0};
+    uint64_t filled_order_{0}; // Order of the last F, if fill_pending_
+    bool fill_pending_{false};
+};
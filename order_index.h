@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "huge_pages.h"
+#include "order_book.h"
+
+// Flat open-addressing hash table from order id to `Value` (OrderInfo for
+// the aggregated book).
+//
+// All entries live inline in one slot array, so adds and cancels never
+// touch the allocator once the table is sized. Collisions are resolved by
+// linear probing, and erase uses backward-shift deletion instead of
+// tombstones, so probe sequences stay short however much the book churns.
+// Keys are hashed with a Fibonacci multiply, which spreads the mostly
+// sequential order ids exchanges hand out.
+//
+// The interface mirrors the subset of std::unordered_map the book uses:
+// find / end / erase(iterator) / operator[] / reserve / size. Iterators are
+// slot pointers and are invalidated by any insert or erase.
+template<typename Value>
+class BasicOrderIndex {
+public:
+    struct Slot {
+        uint64_t first;
+        Value second;
+    };
+    using iterator = Slot*;
+
+    BasicOrderIndex() { rehash(kMinCapacity); }
+
+    // Sizes the table for `n` live orders without further growth.
+    void reserve(size_t n) {
+        size_t want = kMinCapacity;
+        while (want * kMaxLoadNum < n * kMaxLoadDen) {
+            want *= 2;
+        }
+        if (want > slots_.size()) {
+            rehash(want);
+        }
+    }
+
+    iterator find(uint64_t key) {
+        if (key == kEmpty) {
+            return has_empty_key_ ? &empty_key_slot_ : end();
+        }
+        for (size_t i = home(key);; i = (i + 1) & mask_) {
+            Slot& s = slots_[i];
+            if (s.first == key) {
+                return &s;
+            }
+            if (s.first == kEmpty) {
+                return end();
+            }
+        }
+    }
+
+    iterator end() { return nullptr; }
+
+    // The slot a find() or insert of `key` probes first: where to prefetch
+    // ahead of one.
+    const void* home_slot(uint64_t key) const { return &slots_[home(key)]; }
+
+    Value& operator[](uint64_t key) {
+        if (key == kEmpty) {
+            if (!has_empty_key_) {
+                has_empty_key_ = true;
+                empty_key_slot_ = {key, Value{}};
+                ++size_;
+            }
+            return empty_key_slot_.second;
+        }
+        if ((size_ + 1) * kMaxLoadDen > slots_.size() * kMaxLoadNum) {
+            rehash(slots_.size() * 2);
+        }
+        for (size_t i = home(key);; i = (i + 1) & mask_) {
+            Slot& s = slots_[i];
+            if (s.first == key) {
+                return s.second;
+            }
+            if (s.first == kEmpty) {
+                s = {key, Value{}};
+                ++size_;
+                return s.second;
+            }
+        }
+    }
+
+    void erase(iterator it) {
+        --size_;
+        if (it == &empty_key_slot_) {
+            has_empty_key_ = false;
+            return;
+        }
+        // Backward-shift deletion: pull later members of the probe run
+        // into the hole unless that would move them before their home slot.
+        size_t hole = static_cast<size_t>(it - slots_.data());
+        for (size_t i = (hole + 1) & mask_;; i = (i + 1) & mask_) {
+            Slot& s = slots_[i];
+            if (s.first == kEmpty) {
+                break;
+            }
+            size_t h = home(s.first);
+            if (((i - h) & mask_) >= ((i - hole) & mask_)) {
+                slots_[hole] = s;
+                hole = i;
+            }
+        }
+        slots_[hole].first = kEmpty;
+    }
+
+    size_t erase(uint64_t key) {
+        iterator it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    size_t size() const { return size_; }
+    size_t capacity() const { return slots_.size(); }
+
+    // Calls fn(key, value) for every entry, in slot order.
+    template<typename Fn>
+    void for_each(Fn&& fn) const {
+        if (has_empty_key_) {
+            fn(empty_key_slot_.first, empty_key_slot_.second);
+        }
+        for (const Slot& s : slots_) {
+            if (s.first != kEmpty) {
+                fn(s.first, s.second);
+            }
+        }
+    }
+
+private:
+    // Order id reserved to mark free slots; stored out of line if it occurs.
+    static constexpr uint64_t kEmpty = ~0ULL;
+    static constexpr size_t kMinCapacity = 1024;
+    // Maximum load factor 1/2. Cancels of unknown ids are common in MBO
+    // feeds, and a miss has to probe to the end of its run.
+    static constexpr size_t kMaxLoadNum = 1;
+    static constexpr size_t kMaxLoadDen = 2;
+
+    size_t home(uint64_t key) const {
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> shift_);
+    }
+
+    void rehash(size_t capacity) {
+        LargeVector<Slot> old;
+        old.swap(slots_);
+        slots_.assign(capacity, Slot{kEmpty, Value{}});
+        mask_ = capacity - 1;
+        shift_ = 64 - static_cast<unsigned>(__builtin_ctzll(capacity));
+        for (const Slot& s : old) {
+            if (s.first == kEmpty) {
+                continue;
+            }
+            size_t i = home(s.first);
+            while (slots_[i].first != kEmpty) {
+                i = (i + 1) & mask_;
+            }
+            slots_[i] = s;
+        }
+    }
+
+    LargeVector<Slot> slots_;
+    size_t mask_{0};
+    unsigned shift_{64};
+    size_t size_{0};
+    bool has_empty_key_{false};
+    Slot empty_key_slot_{kEmpty, Value{}};
+};
+
+template<typename Value, typename Fn>
+void for_each_entry(const BasicOrderIndex<Value>& index, Fn&& fn) {
+    index.for_each(fn);
+}
+
+template<typename Value>
+const void* entry_address(const BasicOrderIndex<Value>& index, uint64_t key) {
+    return index.home_slot(key);
+}
+
+using OrderIndex = BasicOrderIndex<OrderInfo>;
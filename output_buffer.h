@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "huge_pages.h"
+
+// Destination for an OutputBuffer's bytes other than a plain descriptor,
+// such as a compressor.
+class ByteSink {
+public:
+    virtual ~ByteSink() = default;
+    virtual bool write(const char* data, size_t n) = 0;
+    // Called once, after the last write; flushes whatever the sink holds.
+    virtual bool finish() = 0;
+};
+
+// Destination that takes over whole buffers instead of copying their
+// bytes, such as an asynchronous writer filling the next buffer while
+// the kernel drains the last. Its buffers have the OutputBuffer's
+// capacity.
+class BufferSink {
+public:
+    virtual ~BufferSink() = default;
+    // The buffer to fill first.
+    virtual char* buffer() = 0;
+    // Takes the `n` bytes at `data`, the cursor it last returned, and
+    // returns where to go on writing, with room for a full buffer.
+    virtual char* submit(char* data, size_t n) = 0;
+    // Called once, with the bytes after the last submit; writes them and
+    // waits for everything submitted.
+    virtual bool finish(char* data, size_t n) = 0;
+};
+
+// Large reusable output buffer over a file descriptor. Callers reserve
+// room for a whole record and format straight into the buffer; the
+// buffer reaches the kernel with a single write() whenever it fills.
+// This replaces std::ofstream, whose per-field operator<< calls dominate
+// the cost of CSV output.
+class OutputBuffer {
+public:
+    static constexpr size_t kDefaultCapacity = 1 << 20;
+
+    explicit OutputBuffer(size_t capacity = kDefaultCapacity)
+        : buf_(capacity), base_(buf_.data()), capacity_(capacity) {}
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    ~OutputBuffer() { close(); }
+
+    // Creates or truncates `path` for writing.
+    bool open(const char* path) {
+        fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        owns_fd_ = true;
+        return fd_ >= 0;
+    }
+
+    // Writes to an already open descriptor, such as STDOUT_FILENO, which
+    // close() leaves open.
+    void attach(int fd) {
+        fd_ = fd;
+        owns_fd_ = false;
+    }
+
+    // Sends all output through `sink`, which the buffer then owns, instead
+    // of writing it to the descriptor directly.
+    void attach(std::unique_ptr<ByteSink> sink) { sink_ = std::move(sink); }
+
+    // Formats into `sink`'s buffers, and hands each full one over, from
+    // here on. Nothing may have been written yet.
+    void attach(std::unique_ptr<BufferSink> sink) {
+        buffer_sink_ = std::move(sink);
+        base_ = buffer_sink_->buffer();
+    }
+
+    // Flushes, finishes the sink if there is one, then closes the
+    // descriptor if this buffer opened it. Returns false if any write failed.
+    bool close() {
+        if (buffer_sink_) {
+            if (!buffer_sink_->finish(base_, used_)) {
+                failed_ = true;
+            }
+            buffer_sink_.reset();
+            base_ = buf_.data();
+            used_ = 0;
+        }
+        flush();
+        if (sink_) {
+            if (!sink_->finish()) {
+                failed_ = true;
+            }
+            sink_.reset();
+        }
+        if (owns_fd_ && fd_ >= 0) {
+            if (::close(fd_) != 0) {
+                failed_ = true;
+            }
+        }
+        fd_ = -1;
+        owns_fd_ = false;
+        return !failed_;
+    }
+
+    // Makes room for at least `n` more bytes and returns the write cursor.
+    // `n` must not exceed the buffer capacity.
+    char* reserve(size_t n) {
+        if (capacity_ - used_ < n) {
+            flush();
+        }
+        return base_ + used_;
+    }
+
+    // Marks the bytes up to `end` (a pointer obtained from reserve) as written.
+    void commit(char* end) { used_ = static_cast<size_t>(end - base_); }
+
+    void append(const char* data, size_t n) {
+        if (n > capacity_ && !buffer_sink_) {
+            flush();
+            write_all(data, n);
+            return;
+        }
+        while (n > 0) {
+            const size_t part = n < capacity_ ? n : capacity_;
+            char* p = reserve(part);
+            std::memcpy(p, data, part);
+            commit(p + part);
+            data += part;
+            n -= part;
+        }
+    }
+
+    void flush() {
+        if (used_ > 0) {
+            if (buffer_sink_) {
+                base_ = buffer_sink_->submit(base_, used_);
+            } else {
+                write_all(base_, used_);
+            }
+            used_ = 0;
+        }
+    }
+
+    bool failed() const { return failed_; }
+    int fd() const { return fd_; }
+
+private:
+    void write_all(const char* data, size_t n) {
+        if (sink_) {
+            if (!failed_ && !sink_->write(data, n)) {
+                failed_ = true;
+            }
+            return;
+        }
+        while (n > 0 && !failed_) {
+            ssize_t w = ::write(fd_, data, n);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                failed_ = true;
+                break;
+            }
+            data += w;
+            n -= static_cast<size_t>(w);
+        }
+    }
+
+    PageBuffer buf_;
+    char* base_; // buf_, or the buffer sink's current buffer
+    std::unique_ptr<ByteSink> sink_;
+    std::unique_ptr<BufferSink> buffer_sink_;
+    size_t capacity_;
+    size_t used_{0};
+    int fd_{-1};
+    bool owns_fd_{false};
+    bool failed_{false};
+};
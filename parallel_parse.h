@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "csv_parser.h"
+#include "hot_path_stats.h"
+#include "mbo_event.h"
+
+// Parsed events stored column by column, as produced by one parse thread.
+struct EventColumns {
+    std::vector<int64_t> ts_event;
+    std::vector<int64_t> price;
+    std::vector<int64_t> size;
+    std::vector<uint64_t> order_id;
+    std::vector<uint32_t> instrument_id;
+    std::vector<char> action;
+    std::vector<char> side;
+
+    size_t count() const { return ts_event.size(); }
+
+    void clear() {
+        ts_event.clear();
+        price.clear();
+        size.clear();
+        order_id.clear();
+        instrument_id.clear();
+        action.clear();
+        side.clear();
+    }
+
+    void append(const MboEvent& ev) {
+        ts_event.push_back(ev.ts_event);
+        price.push_back(ev.price);
+        size.push_back(ev.size);
+        order_id.push_back(ev.order_id);
+        instrument_id.push_back(ev.instrument_id);
+        action.push_back(ev.action);
+        side.push_back(ev.side);
+    }
+
+    MboEvent operator[](size_t i) const {
+        return MboEvent{ts_event[i], price[i], size[i], order_id[i],
+                        instrument_id[i], action[i], side[i]};
+    }
+};
+
+// Splits the first ~`bytes` bytes off the front of `data`, extended to the
+// end of the line they stop in.
+inline std::string_view take_lines(std::string_view& data, size_t bytes) {
+    if (bytes >= data.size()) {
+        std::string_view all = data;
+        data = {};
+        return all;
+    }
+    const void* nl = std::memchr(data.data() + bytes, '\n', data.size() - bytes);
+    size_t len = nl ? static_cast<size_t>(static_cast<const char*>(nl) - data.data()) + 1 : data.size();
+    std::string_view head = data.substr(0, len);
+    data.remove_prefix(len);
+    return head;
+}
+
+// Parses a large in-memory MBO file in parallel and hands its events, in
+// file order, to a single consumer.
+//
+// The input is processed in windows of kWindowBytes. Each window is cut
+// into one newline-aligned range per thread, and every range is parsed
+// into its own EventColumns. While the caller consumes window k, window
+// k + 1 is already being parsed, so parsing, which is embarrassingly
+// parallel, overlaps book updates, which are not.
+class ParallelParser {
+public:
+    static constexpr size_t kWindowBytes = 32 << 20;
+
+    ParallelParser(size_t threads, const PriceScale& scale)
+        : threads_(threads), scale_(scale), current_(threads), next_(threads) {}
+
+    // Calls `fn` with every event in `data`, in order.
+    template<typename Fn>
+    void for_each_event(std::string_view data, Fn&& fn) {
+        std::vector<std::thread> workers = start(take_lines(data, kWindowBytes), current_);
+        join(workers);
+        bool more = true;
+        while (more) {
+            more = !data.empty();
+            if (more) {
+                workers = start(take_lines(data, kWindowBytes), next_);
+            }
+            for (const EventColumns& cols : current_) {
+                const size_t n = cols.count();
+                for (size_t i = 0; i < n; ++i) {
+                    fn(cols[i]);
+                }
+            }
+            join(workers);
+            std::swap(current_, next_);
+        }
+    }
+
+private:
+    // Starts one thread per newline-aligned range of `window`.
+    std::vector<std::thread> start(std::string_view window, std::vector<EventColumns>& out) {
+        std::vector<std::thread> workers;
+        const size_t range_bytes = window.size() / threads_ + 1;
+        for (size_t k = 0; k < threads_; ++k) {
+            std::string_view range = take_lines(window, range_bytes);
+            EventColumns& cols = out[k];
+            workers.emplace_back([this, range, &cols] {
+                cols.clear();
+                CsvScanner scanner;
+                scanner.for_each_row(range, [&](const CsvRow& row) {
+                    StageProbe probe(HotStage::kParse);
+                    cols.append(parse_event(row, scale_));
+                });
+            });
+        }
+        return workers;
+    }
+
+    static void join(std::vector<std::thread>& workers) {
+        for (std::thread& t : workers) {
+            t.join();
+        }
+        workers.clear();
+    }
+
+    size_t threads_;
+    PriceScale scale_;
+    std::vector<EventColumns> current_;
+    std::vector<EventColumns> next_;
+};
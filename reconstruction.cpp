@@ -1,212 +1,1486 @@
-#include <iostream>
-#include <fstream>
-#include <string>
-#include <vector>
-#include <map>
-#include <unordered_map>
-#include <string_view>
-#include <charconv>
-#include <cstdint>
-
-// Represents a single price level in the order book.
-// Tracks total volume and number of orders.
-struct LevelInfo {
-    int64_t total_size{0};
-    int32_t order_count{0};
-};
-
-// Stores essential info about an order for O(1) lookup.
-struct OrderInfo {
-    int64_t price;
-    char side;
-};
-
-// Custom parser for performance. Avoids std::stringstream overhead.
-// Parses a substring and converts it to the specified type.
-template<typename T>
-T parse_field(std::string_view& line_sv) {
-    auto pos = line_sv.find(',');
-    std::string_view field = line_sv.substr(0, pos);
-    if (pos != std::string_view::npos) {
-        line_sv.remove_prefix(pos + 1);
-    } else {
-        line_sv.remove_prefix(line_sv.size());
-    }
-
-    T value{};
-    // Use std::from_chars for fast, locale-independent conversion.
-    if constexpr (std::is_integral_v<T>) {
-        std::from_chars(field.data(), field.data() + field.size(), value);
-    } else { // Specifically for the price double
-        std::from_chars(field.data(), field.data() + field.size(), value);
-    }
-    return value;
-}
-
-// Skips a specified number of fields in the string_view.
-void skip_fields(std::string_view& line_sv, int count) {
-    for (int i = 0; i < count; ++i) {
-        auto pos = line_sv.find(',');
-        if (pos != std::string_view::npos) {
-            line_sv.remove_prefix(pos + 1);
-        } else {
-            line_sv.remove_prefix(line_sv.size());
-            break;
-        }
-    }
-}
-
-// Function to write the current top-10 levels of the order book to the output file.
-void write_mbp_output(std::ofstream& outputFile,
-                      long ts_event,
-                      const std::map<int64_t, LevelInfo, std::greater<int64_t>>& bids,
-                      const std::map<int64_t, LevelInfo>& asks) {
-
-    outputFile << ts_event;
-
-    auto bid_it = bids.begin();
-    auto ask_it = asks.begin();
-
-    for (int i = 0; i < 10; ++i) {
-        // Ask Price, Size, Count
-        if (ask_it != asks.end()) {
-            outputFile << ',' << ask_it->first << ',' << ask_it->second.total_size << ',' << ask_it->second.order_count;
-            ++ask_it;
-        } else {
-            outputFile << ",,,";
-        }
-        // Bid Price, Size, Count
-        if (bid_it != bids.end()) {
-            outputFile << ',' << bid_it->first << ',' << bid_it->second.total_size << ',' << bid_it->second.order_count;
-            ++bid_it;
-        } else {
-            outputFile << ",,,";
-        }
-    }
-    outputFile << '\n';
-}
-
-int main(int argc, char* argv[]) {
-    // Fast I/O settings
-    std::ios_base::sync_with_stdio(false);
-
-    if (argc != 2) {
-        std::cerr << "Usage: ./reconstruction <mbo_file.csv>\n";
-        return 1;
-    }
-
-    std::ifstream inputFile(argv[1]);
-    if (!inputFile.is_open()) {
-        std::cerr << "Error opening input file: " << argv[1] << "\n";
-        return 1;
-    }
-
-    std::ofstream outputFile("mbp.csv");
-    // Write header exactly as specified in the sample output
-    outputFile << "ts_event,ask_px_00,ask_sz_00,ask_ct_00,bid_px_00,bid_sz_00,bid_ct_00,ask_px_01,ask_sz_01,ask_ct_01,bid_px_01,bid_sz_01,bid_ct_01,ask_px_02,ask_sz_02,ask_ct_02,bid_px_02,bid_sz_02,bid_ct_02,ask_px_03,ask_sz_03,ask_ct_03,bid_px_03,bid_sz_03,bid_ct_03,ask_px_04,ask_sz_04,ask_ct_04,bid_px_04,bid_sz_04,bid_ct_04,ask_px_05,ask_sz_05,ask_ct_05,bid_px_05,bid_sz_05,bid_ct_05,ask_px_06,ask_sz_06,ask_ct_06,bid_px_06,bid_sz_06,bid_ct_06,ask_px_07,ask_sz_07,ask_ct_07,bid_px_07,bid_sz_07,bid_ct_07,ask_px_08,ask_sz_08,ask_ct_08,bid_px_08,bid_sz_08,bid_ct_08,ask_px_09,ask_sz_09,ask_ct_09,bid_px_09,bid_sz_09,bid_ct_09\n";
-
-
-    // Order book data structures
-    std::map<int64_t, LevelInfo, std::greater<int64_t>> bids;
-    std::map<int64_t, LevelInfo> asks;
-    std::unordered_map<uint64_t, OrderInfo> order_map;
-
-    std::string line;
-    // Rule 1: Ignore header and initial 'R' row (clear book action)
-    std::getline(inputFile, line);
-    std::getline(inputFile, line);
-
-    while (std::getline(inputFile, line)) {
-        std::string_view line_sv(line);
-
-        // --- Fast, Optimized Parsing ---
-        skip_fields(line_sv, 1); // ts_recv
-        long ts_event = parse_field<long>(line_sv);
-        skip_fields(line_sv, 3); // rtype, publisher_id, instrument_id
-
-        char action = line_sv[0];
-        skip_fields(line_sv, 1);
-
-        char side = line_sv[0];
-        skip_fields(line_sv, 1);
-
-        double price_double = parse_field<double>(line_sv);
-        // Convert price to integer to avoid floating point issues.
-        // Scaling by 10000 ensures precision for prices like X.1234.
-        int64_t price = static_cast<int64_t>(price_double * 10000.0);
-        int64_t size = parse_field<int64_t>(line_sv);
-        skip_fields(line_sv, 1); // channel_id
-        uint64_t order_id = parse_field<uint64_t>(line_sv);
-        // --- End Parsing ---
-
-        // Main logic based on action type
-        switch (action) {
-            case 'A': { // ADD
-                if (side == 'B') {
-                    bids[price].total_size += size;
-                    bids[price].order_count++;
-                } else if (side == 'A') {
-                    asks[price].total_size += size;
-                    asks[price].order_count++;
-                }
-                order_map[order_id] = {price, side};
-                break;
-            }
-            case 'C': { // CANCEL
-                auto it = order_map.find(order_id);
-                if (it != order_map.end()) {
-                    OrderInfo info = it->second;
-                    if (info.side == 'B') {
-                        bids[info.price].total_size -= size;
-                        bids[info.price].order_count--;
-                        if (bids[info.price].total_size <= 0) {
-                            bids.erase(info.price);
-                        }
-                    } else if (info.side == 'A') {
-                        asks[info.price].total_size -= size;
-                        asks[info.price].order_count--;
-                        if (asks[info.price].total_size <= 0) {
-                            asks.erase(info.price);
-                        }
-                    }
-                    order_map.erase(it);
-                }
-                break; // <-- FIX: This break was missing.
-            }
-            case 'T': { // TRADE (Special Logic)
-                // Rule 3: Ignore if side is 'N'
-                if (side == 'N') {
-                    break;
-                }
-                // Rule 2: Trade affects the OPPOSITE side of the book.
-                if (side == 'A') { // Aggressive Ask (sell) hits a resting Bid
-                    if (bids.count(price)) {
-                        bids[price].total_size -= size;
-                        // A trade implies a resting order was filled. We assume it's one order.
-                        bids[price].order_count--;
-                        if (bids[price].total_size <= 0) {
-                            bids.erase(price);
-                        }
-                    }
-                } else if (side == 'B') { // Aggressive Bid (buy) hits a resting Ask
-                    if (asks.count(price)) {
-                        asks[price].total_size -= size;
-                        asks[price].order_count--;
-                        if (asks[price].total_size <= 0) {
-                            asks.erase(price);
-                        }
-                    }
-                }
-                break;
-            }
-            case 'F': // FILL - Ignored per instructions, as it's part of the Trade sequence.
-                continue; // IMPORTANT: 'continue' skips the MBP output for this line
-            default:
-                break;
-        }
-        // Generate and write MBP-10 output for the current state
-        write_mbp_output(outputFile, ts_event, bids, asks);
-    }
-
-    return 0;
-}
+#include <iostream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <limits>
+#include <optional>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "analytics.h"
+#include "book_arena.h"
+#include "book_manager.h"
+#include "checkpoint.h"
+#include "csv_parser.h"
+#include "dbn_decoder.h"
+#include "hot_path_stats.h"
+#include "huge_pages.h"
+#include "l3_book.h"
+#include "mbp_writer.h"
+#include "order_book.h"
+#include "order_index.h"
+#include "parallel_parse.h"
+#include "reconstructor.h"
+#include "spsc_queue.h"
+#include "uring_writer.h"
+#include "zstd_stream.h"
+
+// Read-only memory map of a whole input file. Rows are handed to the parser
+// as string_view slices straight out of the page cache, so the hot loop does
+// no per-line copy and no ifstream buffering.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data_ != nullptr) {
+            munmap(data_, size_);
+        }
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    // Maps `path` for sequential reading. Returns false for anything that is
+    // not a regular file (pipes, FIFOs, /dev/stdin) or cannot be mapped, in
+    // which case the caller should fall back to stream input.
+    bool open(const char* path) {
+        fd_ = ::open(path, O_RDONLY);
+        if (fd_ < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode)) {
+            return false;
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ == 0) {
+            return true; // Nothing to map; data() is simply empty.
+        }
+        void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (addr == MAP_FAILED) {
+            size_ = 0;
+            return false;
+        }
+        data_ = static_cast<char*>(addr);
+        // Hints only; failures are harmless.
+        madvise(data_, size_, MADV_SEQUENTIAL);
+        madvise(data_, size_, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+        // Honoured only where the kernel supports THP for file-backed pages.
+        madvise(data_, size_, MADV_HUGEPAGE);
+#endif
+        return true;
+    }
+
+    std::string_view data() const { return {data_, size_}; }
+
+private:
+    int fd_{-1};
+    char* data_{nullptr};
+    size_t size_{0};
+};
+
+// Reads input that cannot be mapped (stdin, pipes, FIFOs, compressed
+// files) in large fixed-size blocks. Every block handed on ends at a line
+// boundary: the partial line after its last newline is carried over to the
+// front of the next one. Binary input picks its own boundaries with
+// for_each_chunk(). Memory stays at one block, unless a single line is
+// longer.
+class BlockReader {
+public:
+    static constexpr size_t kBlockBytes = 4 << 20;
+
+    // Pulls bytes with `source`, which behaves like read(2). `prefix` holds
+    // bytes already taken from the source, such as a sniffed file header.
+    BlockReader(std::function<ssize_t(char*, size_t)> source, std::string_view prefix = {})
+        : source_(std::move(source)), buf_(std::max(kBlockBytes, prefix.size())), primed_(prefix.size()) {
+        std::memcpy(buf_.data(), prefix.data(), prefix.size());
+    }
+
+    // Calls `fn` with each block of whole lines; only the last may lack its
+    // final newline. Returns false on a read error.
+    template<typename Fn>
+    bool for_each_block(Fn&& fn) {
+        return for_each_chunk([&](std::string_view block, bool eof) {
+            // rfind's npos + 1 is 0: no complete line yet.
+            size_t end = eof ? block.size() : block.rfind('\n') + 1;
+            if (end > 0) {
+                fn(block.substr(0, end));
+            }
+            return end;
+        });
+    }
+
+    // Calls fn(data, eof) with the bytes read so far; `fn` returns how
+    // many it used, and the rest begins the next call. `eof` is true on
+    // the last call. Returns false on a read error.
+    template<typename Fn>
+    bool for_each_chunk(Fn&& fn) {
+        size_t carry = primed_;
+        bool eof = false;
+        while (!eof) {
+            if (carry == buf_.size()) {
+                buf_.resize(buf_.size() * 2); // A line longer than a block
+            }
+            size_t used = carry;
+            while (used < buf_.size()) {
+                ssize_t n = source_(buf_.data() + used, buf_.size() - used);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                if (n == 0) {
+                    eof = true;
+                    break;
+                }
+                used += static_cast<size_t>(n);
+            }
+            size_t end = fn(std::string_view(buf_.data(), used), eof);
+            carry = used - end;
+            std::memmove(buf_.data(), buf_.data() + end, carry);
+        }
+        return true;
+    }
+
+private:
+    std::function<ssize_t(char*, size_t)> source_;
+    LargeVector<char> buf_;
+    size_t primed_;
+};
+
+// Reads up to `n` bytes from `source`, stopping short only at the end of
+// the input or on an error. Returns the number read.
+size_t read_prefix(const std::function<ssize_t(char*, size_t)>& source, char* dst, size_t n) {
+    size_t got = 0;
+    while (got < n) {
+        ssize_t r = source(dst + got, n - got);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            break;
+        }
+        got += static_cast<size_t>(r);
+    }
+    return got;
+}
+
+// Splits the next line off the front of `data` (without the '\n').
+std::string_view next_line(std::string_view& data) {
+    const void* nl = std::memchr(data.data(), '\n', data.size());
+    size_t len = nl ? static_cast<const char*>(nl) - data.data() : data.size();
+    std::string_view line = data.substr(0, len);
+    data.remove_prefix(nl ? len + 1 : len);
+    return line;
+}
+
+// How the books of a multi-instrument feed share output:
+//   kMerged - one stream, every instrument's snapshots interleaved in feed order
+//   kTagged - one stream with an instrument_id column (or InstrumentTag) per record
+//   kSplit  - one file per instrument, mbp.<instrument_id>.csv (or .bin)
+enum class InstrumentOutput { kMerged, kTagged, kSplit };
+
+// Command-line configuration.
+struct Options {
+    const char* input_path{nullptr}; // "-" reads stdin
+    const char* output_path{nullptr}; // nullptr = mbp.csv or mbp.bin; "-" = stdout
+    PriceScale price_scale; // Fixed-point units per 1.0 of price
+    BookKind book{BookKind::kFlat};
+    int64_t tick{1};             // PriceLadder slot width, in price units
+    int64_t ladder_span{1 << 16}; // PriceLadder window size, in ticks
+    int64_t orders_hint{0};       // Expected live orders; 0 = from file size
+    OutputFormat format{OutputFormat::kCsv};
+    EmitMode emit{EmitMode::kAll};
+    InstrumentOutput instrument_output{InstrumentOutput::kMerged};
+    int64_t threads{1}; // Worker threads; above 1, instruments are sharded
+    bool pipeline{false}; // Parse, apply and format on separate threads
+    int64_t parse_threads{1}; // Above 1, mapped input is parsed in parallel
+    int64_t depth{kMbpDepth}; // Levels per side in each snapshot
+    bool zstd{false}; // Compress output; implied by an --output ending in .zst
+    bool io_uring{false}; // Write output through io_uring from two buffers
+    bool direct{false};   // With io_uring, open output with O_DIRECT
+    int64_t checkpoint_every{0}; // Rows between checkpoints; 0 = none
+    const char* checkpoint_prefix{"mbp"}; // Checkpoints go to <prefix>.<ts_event>.<rows>.ckpt
+    const char* resume_from{nullptr}; // Checkpoint to start from instead of the first row
+    int64_t start_ts{std::numeric_limits<int64_t>::min()}; // Snapshots only for ts_event in
+    int64_t end_ts{std::numeric_limits<int64_t>::max()};   // [start_ts, end_ts)
+    int64_t conflate_ns{0}; // At most one snapshot per book per interval; 0 = off
+    const char* analytics_path{nullptr}; // Derived analytics stream; nullptr = none
+    int64_t analytics_depth{5}; // Levels per side in the depth imbalance
+    HugePages huge_pages{HugePages::kOff}; // Pages behind books and I/O buffers
+    int64_t numa_node{-1}; // Node to run on and allocate from; -1 = no binding
+    bool numa_spread{false}; // Worker k on node k mod the node count
+};
+
+void print_usage() {
+    std::cerr << "Usage: ./reconstruction [options] <mbo_file.csv | mbo_file.dbn | ->\n"
+                 "  -                 read the MBO feed from stdin\n"
+                 "  -o, --output PATH write snapshots to PATH, or to stdout if PATH is -\n"
+                 "                    (default mbp.csv); split and shard files are named\n"
+                 "                    after PATH without its extension\n"
+                 "  --zstd            zstd-compress the output, on its own thread (implied\n"
+                 "                    by an --output ending in .zst); zstd input is always\n"
+                 "                    recognised and decompressed (needs make ZSTD=1)\n"
+                 "  --io-uring        write output through io_uring from two alternating\n"
+                 "                    buffers, overlapping the disk with the replay; time\n"
+                 "                    spent waiting on a slow disk is reported to stderr\n"
+                 "  --direct          with --io-uring, bypass the page cache (O_DIRECT)\n"
+                 "  --price-scale N   fixed-point units per 1.0 of price, for every\n"
+                 "                    instrument (default 10000); a price it cannot\n"
+                 "                    hold exactly is an error\n"
+                 "  --book KIND       price-level container: flat (default), map,\n"
+                 "                    map-arena (map with pooled arena allocation), or\n"
+                 "                    l3 (flat, with a FIFO queue of orders per level)\n"
+                 "  --tick N          flat book tick size, in price units (default 1)\n"
+                 "  --ladder-span N   flat book window size, in ticks (default 65536)\n"
+                 "  --orders-hint N   expected number of live orders, to pre-size the\n"
+                 "                    order index (default: estimated from file size)\n"
+                 "  --format FMT      output encoding: csv (mbp.csv, default), bin (mbp.bin)\n"
+                 "                    or arrow (mbp.arrow, an Arrow IPC file)\n"
+                 "  --depth N         levels per side in each snapshot: 1, 5, 10 (default)\n"
+                 "                    or 50\n"
+                 "  --emit MODE       all (default): a snapshot after every event;\n"
+                 "                    changed: only when the top --depth levels changed;\n"
+                 "                    delta: one record per changed level\n"
+                 "  --instrument-output MODE\n"
+                 "                    merged (default): one output for all instruments;\n"
+                 "                    tagged: one output with an instrument_id per record;\n"
+                 "                    split: one file per instrument, mbp.<id>.csv\n"
+                 "  --threads N       shard instruments over N worker threads, each\n"
+                 "                    writing mbp.shard<k>.csv (needs tagged or split)\n"
+                 "  --pipeline        parse, update books and format output on three\n"
+                 "                    threads; prints per-stage throughput to stderr\n"
+                 "  --parse-threads N parse the input on N threads, in newline-aligned\n"
+                 "                    chunks, ahead of the book updates (regular files)\n"
+                 "  --start-ts NS     write only snapshots with ts_event >= NS; earlier\n"
+                 "                    events still update the books\n"
+                 "  --end-ts NS       write only snapshots with ts_event < NS\n"
+                 "  --conflate US|ts  at most one snapshot per instrument every US\n"
+                 "                    microseconds (or per distinct ts_event), showing\n"
+                 "                    the book at the end of the interval\n"
+                 "  --analytics PATH  also write mid, microprice, depth imbalance and\n"
+                 "                    cumulative volume/VWAP to PATH whenever they change\n"
+                 "                    (binary records if PATH ends in .bin, else CSV)\n"
+                 "  --analytics-depth N\n"
+                 "                    levels per side in the imbalance (default 5)\n"
+                 "  --checkpoint-every N\n"
+                 "                    every N rows, save all books and the input position\n"
+                 "                    to <prefix>.<ts_event>.<rows>.ckpt (serial mode only)\n"
+                 "  --checkpoint-prefix P\n"
+                 "                    path prefix of checkpoint files (default mbp)\n"
+                 "  --resume-from FILE\n"
+                 "                    load the books from a checkpoint and start reading\n"
+                 "                    the same input where it was taken; another input\n"
+                 "                    (by size and first 64 KiB) is refused\n"
+                 "  --huge-pages MODE off (default); thp: transparent huge pages; 2m or\n"
+                 "                    1g: hugetlbfs pages (vm.nr_hugepages), else thp;\n"
+                 "                    backs the order index, ladders and I/O buffers\n"
+                 "  --numa N|spread   run on NUMA node N and allocate from it; spread puts\n"
+                 "                    --threads worker k, and its books, on node k mod\n"
+                 "                    the number of nodes\n";
+}
+
+// Parses an integer option value.
+bool parse_integer(const char* text, int64_t& out) {
+    const char* end = text + std::strlen(text);
+    auto [ptr, ec] = std::from_chars(text, end, out);
+    return ec == std::errc() && ptr == end && ptr != text;
+}
+
+// Parses a strictly positive integer option value.
+bool parse_positive(const char* text, int64_t& out) {
+    return parse_integer(text, out) && out > 0;
+}
+
+bool parse_options(int argc, char* argv[], Options& opts) {
+    enum { kPriceScale = 256, kBook, kTick, kLadderSpan, kOrdersHint, kFormat, kEmit,
+           kInstrumentOutput, kThreads, kPipeline, kParseThreads, kDepth, kZstd, kIoUring, kDirect, kCheckpointEvery, kCheckpointPrefix, kResumeFrom,
+           kStartTs, kEndTs, kConflate, kAnalytics, kAnalyticsDepth, kHugePages, kNuma, kOutput = 'o' };
+    static const option long_options[] = {
+        {"price-scale", required_argument, nullptr, kPriceScale},
+        {"book", required_argument, nullptr, kBook},
+        {"tick", required_argument, nullptr, kTick},
+        {"ladder-span", required_argument, nullptr, kLadderSpan},
+        {"orders-hint", required_argument, nullptr, kOrdersHint},
+        {"format", required_argument, nullptr, kFormat},
+        {"emit", required_argument, nullptr, kEmit},
+        {"instrument-output", required_argument, nullptr, kInstrumentOutput},
+        {"threads", required_argument, nullptr, kThreads},
+        {"pipeline", no_argument, nullptr, kPipeline},
+        {"parse-threads", required_argument, nullptr, kParseThreads},
+        {"depth", required_argument, nullptr, kDepth},
+        {"output", required_argument, nullptr, kOutput},
+        {"zstd", no_argument, nullptr, kZstd},
+        {"io-uring", no_argument, nullptr, kIoUring},
+        {"direct", no_argument, nullptr, kDirect},
+        {"checkpoint-every", required_argument, nullptr, kCheckpointEvery},
+        {"checkpoint-prefix", required_argument, nullptr, kCheckpointPrefix},
+        {"resume-from", required_argument, nullptr, kResumeFrom},
+        {"start-ts", required_argument, nullptr, kStartTs},
+        {"end-ts", required_argument, nullptr, kEndTs},
+        {"conflate", required_argument, nullptr, kConflate},
+        {"analytics", required_argument, nullptr, kAnalytics},
+        {"analytics-depth", required_argument, nullptr, kAnalyticsDepth},
+        {"huge-pages", required_argument, nullptr, kHugePages},
+        {"numa", required_argument, nullptr, kNuma},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "o:", long_options, nullptr)) != -1) {
+        switch (c) {
+            case kPriceScale: {
+                int64_t factor;
+                if (!parse_positive(optarg, factor)) {
+                    std::cerr << "Invalid --price-scale: " << optarg << "\n";
+                    return false;
+                }
+                opts.price_scale = PriceScale::from_factor(factor);
+                break;
+            }
+            case kBook:
+                if (std::strcmp(optarg, "flat") == 0) {
+                    opts.book = BookKind::kFlat;
+                } else if (std::strcmp(optarg, "map") == 0) {
+                    opts.book = BookKind::kMap;
+                } else if (std::strcmp(optarg, "map-arena") == 0) {
+                    opts.book = BookKind::kMapArena;
+                } else if (std::strcmp(optarg, "l3") == 0) {
+                    opts.book = BookKind::kL3;
+                } else {
+                    std::cerr << "Invalid --book: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kTick:
+                if (!parse_positive(optarg, opts.tick)) {
+                    std::cerr << "Invalid --tick: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kLadderSpan:
+                if (!parse_positive(optarg, opts.ladder_span)) {
+                    std::cerr << "Invalid --ladder-span: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kOrdersHint:
+                if (!parse_positive(optarg, opts.orders_hint)) {
+                    std::cerr << "Invalid --orders-hint: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kFormat:
+                if (std::strcmp(optarg, "csv") == 0) {
+                    opts.format = OutputFormat::kCsv;
+                } else if (std::strcmp(optarg, "bin") == 0) {
+                    opts.format = OutputFormat::kBinary;
+                } else if (std::strcmp(optarg, "arrow") == 0) {
+                    opts.format = OutputFormat::kArrow;
+                } else {
+                    std::cerr << "Invalid --format: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kEmit:
+                if (std::strcmp(optarg, "all") == 0) {
+                    opts.emit = EmitMode::kAll;
+                } else if (std::strcmp(optarg, "changed") == 0) {
+                    opts.emit = EmitMode::kChanged;
+                } else if (std::strcmp(optarg, "delta") == 0) {
+                    opts.emit = EmitMode::kDelta;
+                } else {
+                    std::cerr << "Invalid --emit: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kInstrumentOutput:
+                if (std::strcmp(optarg, "merged") == 0) {
+                    opts.instrument_output = InstrumentOutput::kMerged;
+                } else if (std::strcmp(optarg, "tagged") == 0) {
+                    opts.instrument_output = InstrumentOutput::kTagged;
+                } else if (std::strcmp(optarg, "split") == 0) {
+                    opts.instrument_output = InstrumentOutput::kSplit;
+                } else {
+                    std::cerr << "Invalid --instrument-output: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kThreads:
+                if (!parse_positive(optarg, opts.threads)) {
+                    std::cerr << "Invalid --threads: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kPipeline:
+                opts.pipeline = true;
+                break;
+            case kParseThreads:
+                if (!parse_positive(optarg, opts.parse_threads)) {
+                    std::cerr << "Invalid --parse-threads: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kOutput:
+                opts.output_path = optarg;
+                break;
+            case kZstd:
+                opts.zstd = true;
+                break;
+            case kIoUring:
+                opts.io_uring = true;
+                break;
+            case kDirect:
+                opts.direct = true;
+                break;
+            case kCheckpointEvery:
+                if (!parse_positive(optarg, opts.checkpoint_every)) {
+                    std::cerr << "Invalid --checkpoint-every: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kCheckpointPrefix:
+                opts.checkpoint_prefix = optarg;
+                break;
+            case kResumeFrom:
+                opts.resume_from = optarg;
+                break;
+            case kStartTs:
+                if (!parse_integer(optarg, opts.start_ts)) {
+                    std::cerr << "Invalid --start-ts: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kEndTs:
+                if (!parse_integer(optarg, opts.end_ts)) {
+                    std::cerr << "Invalid --end-ts: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kConflate: {
+                // Per ts_event is an interval of one nanosecond.
+                int64_t us = 0;
+                if (std::strcmp(optarg, "ts") == 0) {
+                    opts.conflate_ns = 1;
+                } else if (parse_positive(optarg, us) && us <= std::numeric_limits<int64_t>::max() / 1000) {
+                    opts.conflate_ns = us * 1000;
+                } else {
+                    std::cerr << "Invalid --conflate: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            }
+            case kAnalytics:
+                opts.analytics_path = optarg;
+                break;
+            case kAnalyticsDepth:
+                if (!parse_positive(optarg, opts.analytics_depth) || opts.analytics_depth > kMaxMbpDepth) {
+                    std::cerr << "Invalid --analytics-depth: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kHugePages:
+                if (std::strcmp(optarg, "off") == 0) {
+                    opts.huge_pages = HugePages::kOff;
+                } else if (std::strcmp(optarg, "thp") == 0) {
+                    opts.huge_pages = HugePages::kTransparent;
+                } else if (std::strcmp(optarg, "2m") == 0) {
+                    opts.huge_pages = HugePages::k2M;
+                } else if (std::strcmp(optarg, "1g") == 0) {
+                    opts.huge_pages = HugePages::k1G;
+                } else {
+                    std::cerr << "Invalid --huge-pages: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kNuma:
+                if (std::strcmp(optarg, "spread") == 0) {
+                    opts.numa_spread = true;
+                    opts.numa_node = -1;
+                } else if (parse_integer(optarg, opts.numa_node) && opts.numa_node >= 0) {
+                    opts.numa_spread = false;
+                } else {
+                    std::cerr << "Invalid --numa: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            case kDepth:
+                // One compiled specialisation per depth; see run().
+                if (!parse_positive(optarg, opts.depth) ||
+                    (opts.depth != 1 && opts.depth != 5 && opts.depth != 10 && opts.depth != 50)) {
+                    std::cerr << "Invalid --depth: " << optarg << "\n";
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+    if (optind != argc - 1) {
+        return false;
+    }
+    if (opts.threads > 1 && opts.instrument_output == InstrumentOutput::kMerged) {
+        // Shards cannot be merged back into feed order, so rows must say
+        // which instrument they belong to.
+        std::cerr << "--threads needs --instrument-output tagged or split\n";
+        return false;
+    }
+    if (opts.output_path && std::strcmp(opts.output_path, "-") == 0 &&
+        (opts.threads > 1 || opts.instrument_output == InstrumentOutput::kSplit)) {
+        std::cerr << "Output to stdout needs a single stream: no --threads or split output\n";
+        return false;
+    }
+    const std::string_view out = opts.output_path ? opts.output_path : "";
+    if (out.size() > 4 && out.substr(out.size() - 4) == ".zst") {
+        opts.zstd = true;
+    }
+    if (opts.zstd && !kZstdAvailable) {
+        std::cerr << "--zstd: built without zstd support (make ZSTD=1)\n";
+        return false;
+    }
+    if (opts.io_uring && opts.zstd) {
+        // The encoder thread writes the compressed stream itself.
+        std::cerr << "--io-uring cannot be combined with --zstd\n";
+        return false;
+    }
+    if (opts.direct && !opts.io_uring) {
+        std::cerr << "--direct needs --io-uring\n";
+        return false;
+    }
+    if (opts.start_ts >= opts.end_ts) {
+        std::cerr << "--start-ts must be before --end-ts\n";
+        return false;
+    }
+    if ((opts.checkpoint_every > 0 || opts.resume_from) && (opts.threads > 1 || opts.pipeline)) {
+        // Only the serial replay has one consistent point to save or resume.
+        std::cerr << "--checkpoint-every and --resume-from cannot be combined with --threads or --pipeline\n";
+        return false;
+    }
+    if (opts.checkpoint_every > 0 && opts.parse_threads > 1) {
+        std::cerr << "--checkpoint-every cannot be combined with --parse-threads\n";
+        return false;
+    }
+    if (opts.threads > 1 && opts.pipeline) {
+        std::cerr << "--pipeline and --threads cannot be combined\n";
+        return false;
+    }
+    if (opts.analytics_path && (opts.threads > 1 || opts.pipeline || opts.resume_from)) {
+        // One stream in feed order, and cumulative values from the first row.
+        std::cerr << "--analytics cannot be combined with --threads, --pipeline or --resume-from\n";
+        return false;
+    }
+    if (opts.analytics_path && std::strcmp(opts.analytics_path, "-") == 0 && opts.output_path &&
+        std::strcmp(opts.output_path, "-") == 0) {
+        std::cerr << "--analytics and --output cannot both be stdout\n";
+        return false;
+    }
+    if (opts.numa_spread && opts.threads == 1) {
+        std::cerr << "--numa spread needs --threads\n";
+        return false;
+    }
+    opts.input_path = argv[optind];
+    return true;
+}
+
+// The options a Reconstructor takes, out of the command line.
+ReconstructorOptions reconstructor_options(const Options& opts) {
+    ReconstructorOptions r;
+    r.emit = opts.emit;
+    r.start_ts = opts.start_ts;
+    r.end_ts = opts.end_ts;
+    r.conflate_ns = opts.conflate_ns;
+    r.orders_hint = opts.orders_hint;
+    return r;
+}
+
+// Rough upper bound on live orders implied by an input of `bytes` bytes:
+// about one slot per ten rows, which covers the peak book depth of every
+// feed we replay. Capped so a huge file cannot reserve gigabytes up front.
+size_t estimate_live_orders(size_t bytes) {
+    constexpr size_t kBytesPerSlot = 1024;
+    constexpr size_t kMaxEstimate = 1 << 22;
+    return std::min(bytes / kBytesPerSlot, kMaxEstimate);
+}
+
+// An output file and the writer formatting snapshots into it.
+template<int Depth>
+struct OutputStream {
+    OutputStream(const Options& opts, std::string file, size_t capacity, bool tagged)
+        : path(std::move(file)),
+          buffer(capacity),
+          writer(buffer, opts.format, opts.emit, opts.price_scale.factor, tagged) {}
+
+    std::string path;
+    OutputBuffer buffer;
+    BasicMbpWriter<Depth> writer;
+    UringStats uring; // With --io-uring
+};
+
+// Per-file buffer in split mode, where hundreds of files may be open.
+constexpr size_t kSplitBufferCapacity = 64 << 10;
+
+// Each of the two buffers of a single --io-uring stream. Large, so that a
+// disk that stalls now and then is absorbed while the other one fills.
+constexpr size_t kUringBufferCapacity = 8 << 20;
+
+// Events in flight between the parser and each worker, or the apply
+// stage, in the threaded modes.
+constexpr size_t kWorkerQueueCapacity = 1 << 16;
+
+// Events handed to Reconstructor::process() at a time, so it can prefetch
+// ahead of the one it is applying.
+constexpr size_t kApplyBatch = 64;
+
+// Snapshots in flight between the apply and format pipeline stages.
+constexpr size_t kSnapshotQueueCapacity = 1 << 12;
+
+// Size of `path` if it is a regular file, otherwise 0.
+size_t input_size(const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+    return static_cast<size_t>(st.st_size);
+}
+
+std::string output_extension(const Options& opts) {
+    std::string ext = opts.format == OutputFormat::kBinary  ? ".bin"
+                      : opts.format == OutputFormat::kArrow ? ".arrow"
+                                                            : ".csv";
+    return opts.zstd ? ext + ".zst" : ext;
+}
+
+// Path of the single output stream: --output, or mbp.csv (mbp.bin).
+std::string output_path(const Options& opts) {
+    return opts.output_path ? std::string(opts.output_path) : "mbp" + output_extension(opts);
+}
+
+// Prefix of per-instrument and per-shard output files: the --output path
+// without its extension (and a .zst after it), or "mbp".
+std::string output_stem(const Options& opts) {
+    if (!opts.output_path) {
+        return "mbp";
+    }
+    std::string stem = opts.output_path;
+    for (int k = 0; k < 2; ++k) {
+        size_t dot = stem.rfind('.');
+        size_t slash = stem.rfind('/');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+            break;
+        }
+        const bool zst = stem.compare(dot, std::string::npos, ".zst") == 0;
+        stem.resize(dot);
+        if (!zst) {
+            break;
+        }
+    }
+    return stem;
+}
+
+// Writes the snapshots of one Reconstructor: keeps a SnapshotEmitter per
+// instrument, for --emit, and the output stream or streams they write to,
+// for --instrument-output.
+template<int Depth>
+class SnapshotSink {
+public:
+    explicit SnapshotSink(const Options& opts)
+        : opts_(opts),
+          split_(opts.instrument_output == InstrumentOutput::kSplit),
+          tagged_(opts.instrument_output == InstrumentOutput::kTagged) {}
+
+    // Opens `path`, the output shared by all instruments. In split mode
+    // files are opened per instrument instead, on their first snapshot.
+    bool open(const std::string& path) {
+        if (!split_) {
+            open_stream(path, opts_.io_uring ? kUringBufferCapacity : OutputBuffer::kDefaultCapacity);
+        }
+        return !open_failed_;
+    }
+
+    void write(const Snapshot<Depth>& snap) {
+        StageProbe probe(HotStage::kEmit);
+        if (snap.index >= emitters_.size() || !emitters_[snap.index]) {
+            open_emitter(snap);
+        }
+        emitters_[snap.index]->emit(snap.rec);
+    }
+
+    // Takes `snap` as the last snapshot written for its instrument, without
+    // writing it, so that a run resumed from a checkpoint emits the same
+    // changes as the run that wrote it.
+    void prime(const Snapshot<Depth>& snap) {
+        if (snap.index >= emitters_.size() || !emitters_[snap.index]) {
+            open_emitter(snap);
+        }
+        emitters_[snap.index]->prime(snap.rec);
+    }
+
+    // Flushes and closes every output. Returns false after any I/O error.
+    bool finish() {
+        bool ok = !open_failed_;
+        for (auto& stream : streams_) {
+            stream->writer.finish();
+            if (!stream->buffer.close() && !open_failed_) {
+                std::cerr << "Error writing output file: " << stream->path << "\n";
+                ok = false;
+            }
+            const UringStats& uring = stream->uring;
+            if (uring.stalls > 0) {
+                char line[256];
+                std::snprintf(line, sizeof(line), "io_uring output %s: stalled %.1f ms on %llu of %llu writes (%.1f MB)\n",
+                              stream->path.c_str(), static_cast<double>(uring.stall_ns) / 1e6,
+                              static_cast<unsigned long long>(uring.stalls),
+                              static_cast<unsigned long long>(uring.writes), static_cast<double>(uring.bytes) / (1 << 20));
+                std::cerr << line;
+            }
+        }
+        return ok;
+    }
+
+private:
+    // Creates the emitter of the instrument of `snap`, on its first snapshot.
+    void open_emitter(const Snapshot<Depth>& snap) {
+        if (snap.index >= emitters_.size()) {
+            emitters_.resize(snap.index + 1);
+        }
+        OutputStream<Depth>& stream =
+            split_ ? open_stream(output_stem(opts_) + "." + std::to_string(snap.instrument_id) + output_extension(opts_),
+                                 kSplitBufferCapacity)
+                   : *streams_.front();
+        emitters_[snap.index].emplace(stream.writer, opts_.emit, snap.instrument_id);
+    }
+
+    // Opens `path` and writes its header. A stream that failed to open
+    // still accepts records (they are dropped) so the replay can go on.
+    OutputStream<Depth>& open_stream(std::string path, size_t capacity) {
+        streams_.push_back(std::make_unique<OutputStream<Depth>>(opts_, std::move(path), capacity, tagged_));
+        OutputStream<Depth>& stream = *streams_.back();
+        if (stream.path == "-") {
+            stream.buffer.attach(STDOUT_FILENO);
+        } else if (!stream.buffer.open(stream.path.c_str())) {
+            std::cerr << "Error opening output file: " << stream.path << "\n";
+            open_failed_ = true;
+        }
+        if (opts_.io_uring && stream.buffer.fd() >= 0) {
+            auto uring = std::make_unique<UringWriter>(capacity, stream.uring);
+            if (!uring->open(stream.buffer.fd(), opts_.direct)) {
+                if (!uring_noted_) {
+                    std::cerr << "io_uring unavailable (" << std::strerror(errno) << "); writing synchronously\n";
+                    uring_noted_ = true;
+                }
+            } else {
+                if (opts_.direct && !uring->direct() && !uring_noted_) {
+                    std::cerr << "O_DIRECT refused for " << stream.path << "; writing through the page cache\n";
+                    uring_noted_ = true;
+                }
+                stream.buffer.attach(std::unique_ptr<BufferSink>(std::move(uring)));
+            }
+        }
+#ifdef MBP_ZSTD
+        if (opts_.zstd && stream.buffer.fd() >= 0) {
+            stream.buffer.attach(std::make_unique<ZstdEncoder>(stream.buffer.fd()));
+        }
+#endif
+        stream.writer.write_header();
+        return stream;
+    }
+
+    const Options& opts_;
+    const bool split_;
+    const bool tagged_;
+    std::vector<std::optional<BasicSnapshotEmitter<Depth>>> emitters_; // By instrument index
+    std::vector<std::unique_ptr<OutputStream<Depth>>> streams_;
+    bool open_failed_{false};
+    bool uring_noted_{false}; // One note per sink on a missing io_uring or O_DIRECT
+};
+
+// The DBN side of read_input(). DBN records need no parsing at all;
+// each is handed to this, which applies Rule 1 to a leading R record and
+// sets `row_end` just past each record.
+template<typename Fn>
+struct DbnRecordFn {
+    void operator()(const MboEvent& ev, const char* end) {
+        if (row_end) {
+            *row_end = offset + static_cast<uint64_t>(end - data);
+        }
+        if (first) {
+            first = false;
+            if (ev.action == 'R') {
+                return; // Rule 1, as in CSV
+            }
+        }
+        fn(ev);
+    }
+
+    Fn& fn;
+    uint64_t* row_end;
+    bool first;
+    const char* data{nullptr}; // Bytes being decoded, at `offset` in the input
+    uint64_t offset{0};
+};
+
+// Mapped DBN input, `data` being the whole file.
+template<typename Fn>
+bool read_dbn_mapped(const Options& opts, std::string_view data, Fn& fn, uint64_t start, uint64_t* row_end) {
+    const size_t records = dbn_records_offset(data.data(), data.size());
+    if (records == 0) {
+        std::cerr << "Truncated DBN metadata in " << opts.input_path << "\n";
+        return false;
+    }
+    if (start > data.size()) {
+        std::cerr << "Checkpoint offset " << start << " is past the end of " << opts.input_path << "\n";
+        return false;
+    }
+    if (start != 0 && start < records) {
+        std::cerr << "Checkpoint offset " << start << " is not a record boundary of " << opts.input_path << "\n";
+        return false;
+    }
+    const size_t first = start == 0 ? records : static_cast<size_t>(start);
+    DbnRecordFn<Fn> on_record{fn, row_end, start == 0, data.data(), 0};
+    DbnDecoder decoder(opts.price_scale);
+    if (decoder.decode(data.substr(first), on_record) != data.size() - first) {
+        std::cerr << "Truncated or malformed DBN record in " << opts.input_path << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Streamed DBN input. Bytes before `start` are dropped, counting down
+// `skip_bytes`; `malformed` is set if the stream ends inside the metadata
+// or a record, or holds a broken one. Returns false on a read error.
+template<typename Fn>
+bool read_dbn_stream(const Options& opts, BlockReader& reader, Fn& fn, uint64_t start, uint64_t* row_end,
+                     uint64_t& skip_bytes, bool& malformed) {
+    DbnRecordFn<Fn> on_record{fn, row_end, start == 0};
+    DbnDecoder decoder(opts.price_scale);
+    bool in_metadata = start == 0;
+    uint64_t consumed = 0;
+    return reader.for_each_chunk([&](std::string_view chunk, bool eof) {
+        size_t used = static_cast<size_t>(std::min<uint64_t>(skip_bytes, chunk.size()));
+        skip_bytes -= used;
+        if (in_metadata) {
+            used = dbn_records_offset(chunk.data(), chunk.size());
+            if (used == 0) {
+                malformed = eof;
+                return eof ? chunk.size() : 0; // Read on until the metadata is complete
+            }
+            in_metadata = false;
+        }
+        on_record.data = chunk.data();
+        on_record.offset = consumed;
+        used += decoder.decode(chunk.substr(used), on_record);
+        if (decoder.failed() || (eof && used != chunk.size())) {
+            malformed = true;
+            used = chunk.size();
+        }
+        consumed += used;
+        return used;
+    });
+}
+
+// Calls `fn` with every MBO event in `opts.input_path`, or on stdin if
+// the path is "-". The input is MBO CSV or DBN, told apart by their first
+// bytes. zstd-compressed input, recognised by its frame magic, is
+// decompressed on a separate thread. Returns false if the input cannot be
+// opened or read.
+//
+// Reading starts at byte `start` of the (decompressed) input, a row or
+// record boundary recorded in a checkpoint; 0 skips the header (the DBN
+// metadata) and R row as usual. If `row_end` is given, it is set to the offset just past each row
+// before `fn` sees the row's event (not with --parse-threads).
+template<typename Fn>
+bool read_input(const Options& opts, Fn&& fn, uint64_t start, uint64_t* row_end) {
+    // Where the rows being scanned sit in the input, for `row_end`.
+    const char* block_data = nullptr;
+    uint64_t block_offset = 0;
+    uint64_t block_limit = 0;
+    auto on_row = [&](const CsvRow& row) {
+        // Fields are pulled out by column index; the delimiter positions
+        // were found for the whole chunk in one vectorized pass.
+        MboEvent ev;
+        {
+            StageProbe probe(HotStage::kParse);
+            ev = parse_event(row, opts.price_scale);
+        }
+        if (row_end) {
+            *row_end = std::min(block_offset + static_cast<uint64_t>(row.end() - block_data) + 1, block_limit);
+        }
+        fn(ev);
+    };
+    CsvScanner scanner;
+    const bool from_stdin = std::strcmp(opts.input_path, "-") == 0;
+    MappedFile mapped;
+    if (!from_stdin && mapped.open(opts.input_path) &&
+        !is_zstd_frame(mapped.data().data(), mapped.data().size())) {
+        // Zero-copy path: every row is a slice of the mapping.
+        std::string_view data = mapped.data();
+        if (is_dbn(data.data(), data.size())) {
+            return read_dbn_mapped(opts, data, fn, start, row_end);
+        }
+        if (start == 0) {
+            // Rule 1: Ignore header and initial 'R' row (clear book action)
+            next_line(data);
+            next_line(data);
+        } else if (start > data.size()) {
+            std::cerr << "Checkpoint offset " << start << " is past the end of " << opts.input_path << "\n";
+            return false;
+        } else if (data[start - 1] != '\n') {
+            std::cerr << "Checkpoint offset " << start << " is not a row boundary of " << opts.input_path << "\n";
+            return false;
+        } else {
+            data.remove_prefix(start);
+        }
+        block_data = data.data();
+        block_offset = static_cast<uint64_t>(data.data() - mapped.data().data());
+        block_limit = mapped.data().size();
+
+        if (opts.parse_threads > 1) {
+            ParallelParser parser(static_cast<size_t>(opts.parse_threads), opts.price_scale);
+            parser.for_each_event(data, fn);
+        } else {
+            scanner.for_each_row(data, on_row);
+        }
+        return true;
+    }
+
+    // Streaming path for stdin, pipes, FIFOs, compressed files and anything
+    // else that cannot be mapped.
+    int fd = from_stdin ? STDIN_FILENO : ::open(opts.input_path, O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error opening input file: " << opts.input_path << "\n";
+        return false;
+    }
+    std::function<ssize_t(char*, size_t)> source = [fd](char* dst, size_t n) { return ::read(fd, dst, n); };
+    // Sniff the first bytes for a zstd frame; they are handed on either way.
+    char magic[4];
+    size_t sniffed = read_prefix(source, magic, sizeof(magic));
+    const bool compressed = is_zstd_frame(magic, sniffed);
+    if (compressed && !kZstdAvailable) {
+        std::cerr << "Compressed input: built without zstd support (make ZSTD=1)\n";
+        if (!from_stdin) {
+            close(fd);
+        }
+        return false;
+    }
+#ifdef MBP_ZSTD
+    std::unique_ptr<ZstdDecoder> decoder;
+    if (compressed) {
+        decoder = std::make_unique<ZstdDecoder>(fd, magic, sniffed);
+        source = [&decoder](char* dst, size_t n) { return decoder->read(dst, n); };
+        // Sniff again, for the format of the decompressed bytes.
+        sniffed = read_prefix(source, magic, sizeof(magic));
+    }
+#endif
+    BlockReader reader(source, std::string_view(magic, sniffed));
+    // Skips everything before a checkpoint's offset.
+    uint64_t skip_bytes = start;
+    uint64_t consumed = 0;
+    bool ok;
+    bool malformed = false;
+    if (is_dbn(magic, sniffed)) {
+        ok = read_dbn_stream(opts, reader, fn, start, row_end, skip_bytes, malformed);
+    } else {
+        // Rule 1: Ignore header and initial 'R' row (clear book action).
+        int skip = start == 0 ? 2 : 0;
+        ok = reader.for_each_block([&](std::string_view block) {
+            consumed += block.size();
+            const size_t dropped = static_cast<size_t>(std::min<uint64_t>(skip_bytes, block.size()));
+            block.remove_prefix(dropped);
+            skip_bytes -= dropped;
+            for (; skip > 0 && !block.empty(); --skip) {
+                next_line(block);
+            }
+            block_data = block.data();
+            block_offset = consumed - block.size();
+            block_limit = consumed;
+            scanner.for_each_row(block, on_row);
+        });
+    }
+#ifdef MBP_ZSTD
+    decoder.reset(); // Joins the decoder thread before fd is closed
+#endif
+    if (!from_stdin) {
+        close(fd);
+    }
+    if (!ok) {
+        std::cerr << "Error reading input file: " << opts.input_path << "\n";
+    } else if (malformed) {
+        std::cerr << "Truncated or malformed DBN record in " << opts.input_path << "\n";
+        ok = false;
+    } else if (skip_bytes > 0) {
+        std::cerr << "Checkpoint offset " << start << " is past the end of " << opts.input_path << "\n";
+        ok = false;
+    }
+    return ok;
+}
+
+// read_input(), refusing a price that --price-scale cannot hold exactly:
+// the first one fails the read, and neither it nor any later event
+// reaches `fn`. One scale covers every instrument, so rounding such a
+// price would move it onto another instrument's tick silently.
+template<typename Fn>
+bool read_events(const Options& opts, Fn&& fn, uint64_t start = 0, uint64_t* row_end = nullptr) {
+    bool off_scale = false;
+    MboEvent first_off_scale{};
+    auto checked = [&](const MboEvent& ev) {
+        if (ev.price == kOffScalePrice && !off_scale) {
+            off_scale = true;
+            first_off_scale = ev;
+        }
+        if (!off_scale) {
+            fn(ev);
+        }
+    };
+    if (!read_input(opts, checked, start, row_end)) {
+        return false;
+    }
+    if (off_scale) {
+        std::cerr << "Price of order " << first_off_scale.order_id << " at ts_event " << first_off_scale.ts_event
+                  << " in " << opts.input_path << " does not fit --price-scale " << opts.price_scale.factor << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Saves every book of `recon` to <prefix>.<ts_event>.<rows>.ckpt, taken
+// after `rows` rows of `input`, the next one starting at byte
+// `input_offset`. The row count keeps apart checkpoints taken within one
+// timestamp, which a burst of events can share.
+template<typename Book, int Depth>
+bool save_checkpoint(const Options& opts, const Reconstructor<Book, Depth>& recon, const InputIdentity& input,
+                     uint64_t input_offset, int64_t ts_event, uint64_t rows) {
+    CheckpointHeader header{};
+    std::memcpy(header.magic, CheckpointHeader::kMagic, sizeof(header.magic));
+    header.version = CheckpointHeader::kVersion;
+    header.book_kind = static_cast<uint32_t>(opts.book);
+    header.price_scale = opts.price_scale.factor;
+    header.input_offset = input_offset;
+    header.ts_event = ts_event;
+    header.rows = rows;
+    header.instruments = recon.instrument_count();
+    header.input_size = input.size;
+    header.input_hash = input.head_hash;
+    const std::string path = std::string(opts.checkpoint_prefix) + "." + std::to_string(ts_event) + "." +
+                             std::to_string(rows) + ".ckpt";
+    if (!write_checkpoint(path, header, [&](CheckpointWriter& out) { recon.save(out); })) {
+        std::cerr << "Error writing checkpoint: " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Loads the books of --resume-from into `recon` and primes `sink` with
+// their tops, so --emit changed and delta carry on where the checkpointed
+// run was. Returns false, with a message, if the checkpoint does not fit
+// these options or was taken from another input than `input`.
+template<typename Book, int Depth>
+bool resume(const Options& opts, Reconstructor<Book, Depth>& recon, SnapshotSink<Depth>& sink,
+            const InputIdentity& input, CheckpointHeader& header) {
+    CheckpointReader in;
+    std::string error;
+    if (!in.open(opts.resume_from)) {
+        error = "cannot read the file";
+    } else if (read_checkpoint_header(in, header, error) && check_checkpoint_input(header, input, error)) {
+        if (header.book_kind != static_cast<uint32_t>(opts.book)) {
+            error = "it was written with another --book";
+        } else if (header.price_scale != opts.price_scale.factor) {
+            error = "it was written with another --price-scale";
+        } else if (!recon.load(in, header.instruments) || !in.at_end()) {
+            error = "it is truncated or corrupt";
+        }
+    }
+    if (!error.empty()) {
+        std::cerr << "Cannot resume from " << opts.resume_from << ": " << error << "\n";
+        return false;
+    }
+    if (opts.emit != EmitMode::kAll) {
+        recon.for_each_top(header.ts_event, [&](const Snapshot<Depth>& snap) { sink.prime(snap); });
+    }
+    return true;
+}
+
+// The --analytics output of a serial replay.
+struct AnalyticsStream {
+    explicit AnalyticsStream(const Options& opts)
+        : path(opts.analytics_path),
+          writer(buffer, path.size() > 4 && path.compare(path.size() - 4, 4, ".bin") == 0,
+                 static_cast<int>(opts.analytics_depth), opts.price_scale.factor) {}
+
+    bool open() {
+        if (path == "-") {
+            buffer.attach(STDOUT_FILENO);
+        } else if (!buffer.open(path.c_str())) {
+            std::cerr << "Error opening analytics file: " << path << "\n";
+            return false;
+        }
+        writer.write_header();
+        return true;
+    }
+
+    bool close() {
+        if (!buffer.close()) {
+            std::cerr << "Error writing analytics file: " << path << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    std::string path;
+    OutputBuffer buffer;
+    AnalyticsWriter writer;
+};
+
+// Replays the whole feed on this thread into mbp.csv (or mbp.bin, or one
+// file per instrument), optionally from a checkpoint and taking more.
+template<typename Book, int Depth>
+int run_serial(const Options& opts, std::function<Book()> make_book) {
+    Reconstructor<Book, Depth> recon(reconstructor_options(opts), std::move(make_book),
+                                     estimate_live_orders(input_size(opts.input_path)));
+    SnapshotSink<Depth> sink(opts);
+    if (!sink.open(output_path(opts))) {
+        return 1;
+    }
+    InputIdentity input;
+    if ((opts.checkpoint_every > 0 || opts.resume_from) && !input_identity(opts.input_path, input)) {
+        std::cerr << "Error opening input file: " << opts.input_path << "\n";
+        sink.finish();
+        return 1;
+    }
+    CheckpointHeader resumed{}; // input_offset 0: from the first row
+    if (opts.resume_from && !resume(opts, recon, sink, input, resumed)) {
+        sink.finish();
+        return 1;
+    }
+    std::unique_ptr<AnalyticsStream> analytics;
+    if (opts.analytics_path) {
+        analytics = std::make_unique<AnalyticsStream>(opts);
+        if (!analytics->open()) {
+            sink.finish();
+            return 1;
+        }
+        recon.track_analytics(static_cast<int>(opts.analytics_depth),
+                              [&writer = analytics->writer](const AnalyticsRecord& rec) { writer.write(rec); });
+    }
+    Snapshot<Depth> snap;
+    auto write = [&](const Snapshot<Depth>& s) { sink.write(s); };
+    auto apply = [&](const MboEvent& ev) { recon.process(ev, snap, write); };
+    bool read_ok;
+    bool checkpoint_ok = true;
+    if (opts.checkpoint_every == 0) {
+        // Events are applied in batches, for Reconstructor's prefetching.
+        MboEvent batch[kApplyBatch];
+        size_t pending = 0;
+        read_ok = read_events(
+            opts,
+            [&](const MboEvent& ev) {
+                batch[pending] = ev;
+                if (++pending == kApplyBatch) {
+                    recon.process(batch, pending, snap, write);
+                    pending = 0;
+                }
+            },
+            resumed.input_offset);
+        recon.process(batch, pending, snap, write);
+    } else {
+        // A separate loop, so the checkpoint code stays out of the plain one.
+        const uint64_t every = static_cast<uint64_t>(opts.checkpoint_every);
+        uint64_t rows = resumed.rows;
+        uint64_t row_end = 0;
+        read_ok = read_events(
+            opts,
+            [&](const MboEvent& ev) {
+                apply(ev);
+                if (++rows % every == 0) {
+                    checkpoint_ok = save_checkpoint(opts, recon, input, row_end, ev.ts_event, rows) && checkpoint_ok;
+                }
+            },
+            resumed.input_offset, &row_end);
+    }
+    recon.flush(snap, write);
+    bool write_ok = sink.finish();
+    if (analytics && !analytics->close()) {
+        write_ok = false;
+    }
+    return read_ok && write_ok && checkpoint_ok ? 0 : 1;
+}
+
+// Item count and time accounting for one pipeline stage. Time spent
+// waiting on a full or empty queue is "blocked"; the rest is "busy". The
+// stage with the most busy time is the bottleneck.
+struct StageCounter {
+    using Clock = std::chrono::steady_clock;
+
+    void start() { begin = Clock::now(); }
+    void stop() { end = Clock::now(); }
+
+    template<typename T>
+    void push(SpscQueue<T>& queue, const T& value) {
+        if (!queue.try_push(value)) {
+            auto t0 = Clock::now();
+            queue.push(value);
+            blocked += Clock::now() - t0;
+        }
+    }
+
+    template<typename T>
+    bool pop(SpscQueue<T>& queue, T& value) {
+        if (queue.try_pop(value)) {
+            return true;
+        }
+        auto t0 = Clock::now();
+        bool ok = queue.pop(value);
+        blocked += Clock::now() - t0;
+        return ok;
+    }
+
+    template<typename T>
+    size_t pop(SpscQueue<T>& queue, T* out, size_t max) {
+        if (size_t n = queue.try_pop(out, max)) {
+            return n;
+        }
+        auto t0 = Clock::now();
+        size_t n = queue.pop(out, max);
+        blocked += Clock::now() - t0;
+        return n;
+    }
+
+    void report(const char* name) const {
+        using Ms = std::chrono::duration<double, std::milli>;
+        double wall_ms = Ms(end - begin).count();
+        double blocked_ms = Ms(blocked).count();
+        double busy_ms = std::max(wall_ms - blocked_ms, 0.0);
+        double rate = busy_ms > 0 ? static_cast<double>(items) / busy_ms / 1e3 : 0.0;
+        char line[160];
+        std::snprintf(line, sizeof(line), "  %-7s %12llu items  %9.1f ms busy  %9.1f ms blocked  %8.2f M/s busy\n",
+                      name, static_cast<unsigned long long>(items), busy_ms, blocked_ms, rate);
+        std::cerr << line;
+    }
+
+    uint64_t items{0};
+    Clock::time_point begin;
+    Clock::time_point end;
+    Clock::duration blocked{0};
+};
+
+// Pipelined mode: parsing (this thread), book updates and snapshot
+// formatting run as three threads, connected by SPSC queues of MboEvents
+// and of Snapshots. Output is identical to a serial run. Per-stage
+// counters are printed to stderr at the end.
+template<typename Book, int Depth>
+int run_pipeline(const Options& opts, std::function<Book()> make_book) {
+    Reconstructor<Book, Depth> recon(reconstructor_options(opts), std::move(make_book),
+                                     estimate_live_orders(input_size(opts.input_path)));
+    SnapshotSink<Depth> sink(opts);
+    if (!sink.open(output_path(opts))) {
+        return 1;
+    }
+    SpscQueue<MboEvent> events(kWorkerQueueCapacity);
+    SpscQueue<Snapshot<Depth>> snapshots(kSnapshotQueueCapacity);
+    StageCounter parse_stage;
+    StageCounter apply_stage;
+    StageCounter format_stage;
+
+    std::thread apply_thread([&] {
+        apply_stage.start();
+        MboEvent batch[kApplyBatch];
+        Snapshot<Depth> snap;
+        auto push = [&](const Snapshot<Depth>& s) { apply_stage.push(snapshots, s); };
+        while (size_t n = apply_stage.pop(events, batch, kApplyBatch)) {
+            apply_stage.items += n;
+            recon.process(batch, n, snap, push);
+        }
+        recon.flush(snap, push);
+        snapshots.close();
+        apply_stage.stop();
+    });
+    std::thread format_thread([&] {
+        format_stage.start();
+        Snapshot<Depth> snap;
+        while (format_stage.pop(snapshots, snap)) {
+            ++format_stage.items;
+            sink.write(snap);
+        }
+        format_stage.stop();
+    });
+
+    parse_stage.start();
+    bool read_ok = read_events(opts, [&](const MboEvent& ev) {
+        ++parse_stage.items;
+        parse_stage.push(events, ev);
+    });
+    events.close();
+    parse_stage.stop();
+
+    apply_thread.join();
+    format_thread.join();
+    bool write_ok = sink.finish();
+
+    std::cerr << "pipeline stages:\n";
+    parse_stage.report("parse");
+    apply_stage.report("apply");
+    format_stage.report("format");
+    return read_ok && write_ok ? 0 : 1;
+}
+
+// Parallel mode. This thread parses the input and deals instruments out
+// to `opts.threads` workers round-robin, in order of first appearance.
+// Each row goes through an SPSC queue to the worker owning its instrument,
+// which applies it to its own books and writes its own output: one
+// mbp.shard<k> file per worker, or per-instrument files in split mode.
+// A worker sees its instruments' rows in feed order, so each instrument's
+// snapshots are exactly those of a serial run.
+template<typename Book, int Depth>
+int run_parallel(const Options& opts, const std::function<Book()>& make_book) {
+    const size_t workers = static_cast<size_t>(opts.threads);
+    const size_t orders_hint = estimate_live_orders(input_size(opts.input_path)) / workers;
+
+    std::vector<std::unique_ptr<Reconstructor<Book, Depth>>> shards;
+    std::vector<std::unique_ptr<SnapshotSink<Depth>>> sinks;
+    std::vector<std::unique_ptr<SpscQueue<MboEvent>>> queues;
+    const ReconstructorOptions recon_opts = reconstructor_options(opts);
+    for (size_t k = 0; k < workers; ++k) {
+        shards.push_back(std::make_unique<Reconstructor<Book, Depth>>(recon_opts, make_book, orders_hint));
+        sinks.push_back(std::make_unique<SnapshotSink<Depth>>(opts));
+        if (!sinks.back()->open(output_stem(opts) + ".shard" + std::to_string(k) + output_extension(opts))) {
+            return 1;
+        }
+        queues.push_back(std::make_unique<SpscQueue<MboEvent>>(kWorkerQueueCapacity));
+    }
+
+    // Books are created on a worker's first event for them, so with
+    // --numa spread their memory is first touched, and placed, on the
+    // worker's node.
+    const std::vector<int> nodes = opts.numa_spread ? numa_cpu_nodes() : std::vector<int>();
+    std::vector<std::thread> threads;
+    for (size_t k = 0; k < workers; ++k) {
+        threads.emplace_back([&shards, &sinks, &queues, &nodes, k] {
+            if (!nodes.empty()) {
+                bind_to_numa_node(nodes[k % nodes.size()]);
+            }
+            MboEvent batch[kApplyBatch];
+            Snapshot<Depth> snap;
+            auto write = [&](const Snapshot<Depth>& s) { sinks[k]->write(s); };
+            while (size_t n = queues[k]->pop(batch, kApplyBatch)) {
+                shards[k]->process(batch, n, snap, write);
+            }
+            shards[k]->flush(snap, write);
+        });
+    }
+    std::unordered_map<uint32_t, uint32_t> owner;
+    uint32_t last_id = 0;
+    uint32_t last_worker = 0;
+    bool have_last = false;
+    bool read_ok = read_events(opts, [&](const MboEvent& ev) {
+        if (!have_last || ev.instrument_id != last_id) {
+            uint32_t next = static_cast<uint32_t>(owner.size() % workers);
+            last_worker = owner.try_emplace(ev.instrument_id, next).first->second;
+            last_id = ev.instrument_id;
+            have_last = true;
+        }
+        queues[last_worker]->push(ev);
+    });
+
+    for (auto& queue : queues) {
+        queue->close();
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    bool write_ok = true;
+    for (auto& sink : sinks) {
+        write_ok = sink->finish() && write_ok;
+    }
+    return read_ok && write_ok ? 0 : 1;
+}
+
+template<typename Book, int Depth>
+int run_mode(const Options& opts, std::function<Book()> make_book) {
+    if (opts.threads > 1) {
+        return run_parallel<Book, Depth>(opts, make_book);
+    }
+    if (opts.pipeline) {
+        return run_pipeline<Book, Depth>(opts, std::move(make_book));
+    }
+    return run_serial<Book, Depth>(opts, std::move(make_book));
+}
+
+// Every --depth is a separate instantiation, so the snapshot loops and
+// the CSV header are specialised for it at compile time.
+template<typename Book>
+int run(const Options& opts, std::function<Book()> make_book) {
+    switch (opts.depth) {
+        case 1:
+            return run_mode<Book, 1>(opts, std::move(make_book));
+        case 5:
+            return run_mode<Book, 5>(opts, std::move(make_book));
+        case 50:
+            return run_mode<Book, 50>(opts, std::move(make_book));
+        default:
+            return run_mode<Book, kMbpDepth>(opts, std::move(make_book));
+    }
+}
+
+// Order book data structures, one of each per instrument: the std
+// containers are the reference implementation, the flat ones the fast path.
+int run_book(const Options& opts) {
+    if (opts.book == BookKind::kMap) {
+        using Book = OrderBook<MapBids, MapAsks, std::unordered_map<uint64_t, OrderInfo>>;
+        return run<Book>(opts, [] { return Book{}; });
+    }
+    if (opts.book == BookKind::kMapArena) {
+        return run<ArenaBook>(opts, &ArenaBook::make);
+    }
+    const size_t span = static_cast<size_t>(opts.ladder_span);
+    if (opts.book == BookKind::kL3) {
+        using Book = L3Book<L3Bids, L3Asks>;
+        return run<Book>(opts, [&] { return Book(L3Bids(opts.tick, span), L3Asks(opts.tick, span)); });
+    }
+    using Book = OrderBook<FlatBids, FlatAsks, OrderIndex>;
+    return run<Book>(opts, [&] {
+        return Book(FlatBids(opts.tick, span), FlatAsks(opts.tick, span), OrderIndex());
+    });
+}
+
+int main(int argc, char* argv[]) {
+    // Fast I/O settings
+    std::ios_base::sync_with_stdio(false);
+
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        print_usage();
+        return 1;
+    }
+
+    // Both before the first allocation they apply to; threads started
+    // later inherit the binding.
+    set_huge_pages(opts.huge_pages);
+    if (opts.numa_node >= 0 && !bind_to_numa_node(static_cast<int>(opts.numa_node))) {
+        std::cerr << "--numa: node " << opts.numa_node << " does not exist or has no CPUs\n";
+        return 1;
+    }
+
+    int status = run_book(opts);
+    if constexpr (kInstrumented) {
+        report_hot_path_stats(std::cerr);
+    }
+    return status;
+}
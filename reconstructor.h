@@ -0,0 +1,350 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "analytics.h"
+#include "book_manager.h"
+#include "hot_path_stats.h"
+#include "mbo_event.h"
+#include "mbp_writer.h"
+
+// Price-level container used for the bid and ask sides.
+enum class BookKind { kMap, kMapArena, kFlat, kL3 };
+
+// What a Reconstructor does with the books it updates: the --emit,
+// --start-ts/--end-ts, --conflate and --orders-hint options.
+struct ReconstructorOptions {
+    EmitMode emit{EmitMode::kAll};
+    int64_t start_ts{std::numeric_limits<int64_t>::min()};
+    int64_t end_ts{std::numeric_limits<int64_t>::max()};
+    int64_t conflate_ns{0};
+    int64_t orders_hint{0}; // Live orders to reserve per book; 0 = first_orders_hint
+};
+
+// A top-of-book snapshot on its way to output, with the dense index (in
+// the producing Reconstructor) and id of its instrument.
+template<int Depth>
+struct Snapshot {
+    uint32_t index;
+    uint32_t instrument_id;
+    BasicMbpRecord<Depth> rec;
+};
+
+// Applies MBO events to one book per instrument and produces an MBP-N
+// snapshot, N = Depth, after every state change. The whole feed goes through a single
+// Reconstructor in serial and pipelined mode; in parallel mode each worker
+// owns one for its share of the instruments. An MbpFeed (mbp.h) wraps one
+// for a live process.
+template<typename Book, int Depth>
+class Reconstructor {
+public:
+    // `first_orders_hint` pre-sizes the first book's order index when no
+    // --orders-hint is given; later books grow on demand. An explicit
+    // --orders-hint applies to every book.
+    Reconstructor(const ReconstructorOptions& opts, std::function<Book()> make_book, size_t first_orders_hint)
+        : orders_hint_(opts.orders_hint),
+          books_(std::move(make_book)),
+          track_top_(opts.emit != EmitMode::kAll),
+          start_ts_(opts.start_ts),
+          end_ts_(opts.end_ts),
+          conflate_ns_(opts.conflate_ns),
+          filtered_(start_ts_ != std::numeric_limits<int64_t>::min() ||
+                    end_ts_ != std::numeric_limits<int64_t>::max() || conflate_ns_ > 0),
+          first_orders_hint_(first_orders_hint) {}
+
+    // Applies `ev` and calls emit(snapshot) for each snapshot now due: the
+    // one apply() produces or, with --conflate, those of the books that
+    // changed in the interval `ev` closes, each with its last state.
+    // `scratch` holds the snapshots passed to `emit`.
+    template<typename Emit>
+    void process(const MboEvent& ev, Snapshot<Depth>& scratch, Emit&& emit) {
+        if (conflate_ns_ > 0) {
+            const int64_t interval = ev.ts_event / conflate_ns_;
+            if (interval != interval_) {
+                flush(scratch, emit);
+                interval_ = interval;
+            }
+        }
+        if (apply(ev, scratch)) {
+            emit(scratch);
+        }
+    }
+
+    // Processes events[0, n) in order, exactly as n calls of process()
+    // would. While one event is applied, the order-index slot and price
+    // level of the event kPrefetchDistance behind it are being loaded, so
+    // the cache misses of a large book overlap useful work instead of
+    // stalling each update in turn.
+    template<typename Emit>
+    void process(const MboEvent* events, size_t n, Snapshot<Depth>& scratch, Emit&& emit) {
+        size_t ahead = 0; // Next event to prefetch for
+        for (size_t i = 0; i < n; ++i) {
+            for (; ahead < n && ahead <= i + kPrefetchDistance; ++ahead) {
+                // The hints are issued here, not in a helper of their own:
+                // GCC treats a function that only prefetches as pure and
+                // drops calls to it.
+                const PrefetchTargets t = prefetch_targets(events[ahead]);
+                if (t.order) {
+                    __builtin_prefetch(t.order);
+                }
+                if (t.level) {
+                    __builtin_prefetch(t.level);
+                }
+            }
+            process(events[i], scratch, emit);
+        }
+    }
+
+    // Emits the snapshots still held back by --conflate, at the end of
+    // the feed.
+    template<typename Emit>
+    void flush(Snapshot<Depth>& scratch, Emit&& emit) {
+        for (uint32_t index : pending_) {
+            StageProbe probe(HotStage::kSnapshot);
+            scratch.index = index;
+            scratch.instrument_id = books_.instrument_id(index);
+            build_snapshot(scratch.rec, pending_ts_[index], books_[index].bids(), books_[index].asks());
+            pending_ts_[index] = kNotPending;
+            emit(scratch);
+        }
+        pending_.clear();
+    }
+
+    // Handles a single MBO event: updates its instrument's book. Returns
+    // true, with the new top of book in `out`, if a snapshot is due. Events
+    // outside --start-ts/--end-ts update the book but produce none; with
+    // --conflate the book is only marked for the next flush().
+    bool apply(const MboEvent& ev, Snapshot<Depth>& out) {
+        const size_t known = books_.size();
+        const uint32_t index = books_.index_of(ev.instrument_id);
+        Book& book = books_[index];
+        if (books_.size() != known) {
+            set_up(book, index);
+        }
+
+        // Main logic based on action type. When only changes are emitted,
+        // `touched` says whether the event could have altered the visible
+        // top levels.
+        BookUpdate update;
+        {
+            ApplyProbe probe(ev.action);
+            switch (ev.action) {
+                case 'A': // ADD
+                    update = book.add(ev.order_id, ev.side, ev.price, ev.size);
+                    break;
+                case 'C': // CANCEL
+                    update = book.cancel(ev.order_id, ev.size);
+                    break;
+                case 'T': // TRADE (Special Logic, see OrderBook::trade)
+                    update = book.trade(ev.side, ev.price, ev.size);
+                    break;
+                case 'F': // FILL - Part of the Trade sequence: no book change, no MBP output.
+                    book.fill(ev.order_id); // Its C is folded into the trade
+                    return false;
+                default:
+                    break;
+            }
+            probe.record(update);
+        }
+        if (update.completes_fill) {
+            return false; // The T-F-C went out as one snapshot, the trade's
+        }
+        if (on_analytics_) {
+            update_analytics(index, ev, update, book);
+        }
+        if (track_top_ && !update.touched) {
+            return false; // The visible book is byte-identical to the last snapshot.
+        }
+        if (filtered_ && !due(index, ev.ts_event)) {
+            return false;
+        }
+        // Generate MBP-10 output for the current state
+        StageProbe probe(HotStage::kSnapshot);
+        out.index = index;
+        out.instrument_id = ev.instrument_id;
+        build_snapshot(out.rec, ev.ts_event, book.bids(), book.asks());
+        return true;
+    }
+
+    size_t instrument_count() const { return books_.size(); }
+
+    // Keeps BookAnalytics over the top `depth` levels of every book from
+    // here on, and calls fn(record) each time an instrument's change
+    // within --start-ts/--end-ts; --conflate does not apply. Call before
+    // the first event.
+    void track_analytics(int depth, std::function<void(const AnalyticsRecord&)> fn) {
+        analytics_depth_ = depth;
+        on_analytics_ = std::move(fn);
+    }
+
+    // Writes every book, in order of first appearance, for a checkpoint,
+    // then the snapshots --conflate is holding back.
+    template<typename Out>
+    void save(Out& out) const {
+        for (uint32_t i = 0; i < books_.size(); ++i) {
+            out.put(books_.instrument_id(i));
+            books_[i].save(out);
+        }
+        out.put(interval_);
+        out.put(static_cast<uint64_t>(pending_.size()));
+        for (uint32_t index : pending_) {
+            out.put(index);
+            out.put(pending_ts_[index]);
+        }
+    }
+
+    // Restores `count` books written by save(). Returns false if the
+    // checkpoint is truncated or names an instrument twice.
+    template<typename In>
+    bool load(In& in, uint64_t count) {
+        for (uint64_t i = 0; i < count && in.ok(); ++i) {
+            const size_t known = books_.size();
+            const uint32_t index = books_.index_of(in.template get<uint32_t>());
+            if (books_.size() == known) {
+                return false;
+            }
+            set_up(books_[index], index);
+            if (!books_[index].load(in)) {
+                return false;
+            }
+        }
+        interval_ = in.template get<int64_t>();
+        const uint64_t pending = in.template get<uint64_t>();
+        for (uint64_t i = 0; i < pending && in.ok(); ++i) {
+            const uint32_t index = in.template get<uint32_t>();
+            const int64_t ts_event = in.template get<int64_t>();
+            if (index >= books_.size()) {
+                return false;
+            }
+            hold(index, ts_event);
+        }
+        return in.ok();
+    }
+
+    // Fills `out` with the current top of the book of `instrument_id`,
+    // stamped `ts_event`. Returns false if the instrument has not been seen.
+    bool snapshot_of(uint32_t instrument_id, int64_t ts_event, BasicMbpRecord<Depth>& out) const {
+        const Book* book = books_.find(instrument_id);
+        if (!book) {
+            return false;
+        }
+        build_snapshot(out, ts_event, book->bids(), book->asks());
+        return true;
+    }
+
+    // Calls fn(snapshot) with the current top of every book, stamped
+    // `ts_event`.
+    template<typename Fn>
+    void for_each_top(int64_t ts_event, Fn&& fn) const {
+        Snapshot<Depth> snap;
+        for (uint32_t i = 0; i < books_.size(); ++i) {
+            snap.index = i;
+            snap.instrument_id = books_.instrument_id(i);
+            build_snapshot(snap.rec, ts_event, books_[i].bids(), books_[i].asks());
+            fn(snap);
+        }
+    }
+
+private:
+    static constexpr int64_t kNotPending = std::numeric_limits<int64_t>::min();
+    // Events between a prefetch and the update it is for: enough to cover
+    // a DRAM access, few enough that the lines are still in L1 when used.
+    static constexpr size_t kPrefetchDistance = 8;
+
+    struct PrefetchTargets {
+        const void* order{nullptr};
+        const void* level{nullptr};
+    };
+
+    // What applying `ev` will read first. A cancel's price is that of the
+    // order, so its level is known up front; a trade reduces the side
+    // opposite its aggressor (see OrderBook::trade).
+    PrefetchTargets prefetch_targets(const MboEvent& ev) const {
+        PrefetchTargets t;
+        const Book* book = books_.find(ev.instrument_id);
+        if (!book) {
+            return t;
+        }
+        switch (ev.action) {
+            case 'A':
+            case 'C':
+                t.order = book->order_address(ev.order_id);
+                t.level = book->level_address(ev.side, ev.price);
+                break;
+            case 'T':
+                t.level = book->level_address(ev.side == 'A' ? 'B' : ev.side == 'B' ? 'A' : 'N', ev.price);
+                break;
+            default:
+                break;
+        }
+        return t;
+    }
+
+    // For a change of book `index` at `ts_event`, with --start-ts, --end-ts
+    // or --conflate: true if a snapshot is due now. Kept out of apply() so
+    // the unfiltered path stays as it was.
+    bool due(uint32_t index, int64_t ts_event) {
+        if (ts_event < start_ts_ || ts_event >= end_ts_) {
+            return false;
+        }
+        if (conflate_ns_ > 0) {
+            hold(index, ts_event);
+            return false;
+        }
+        return true;
+    }
+
+    // Marks book `index` as changed in the current --conflate interval,
+    // last at `ts_event`.
+    void hold(uint32_t index, int64_t ts_event) {
+        if (index >= pending_ts_.size()) {
+            pending_ts_.resize(books_.size(), kNotPending);
+        }
+        if (pending_ts_[index] == kNotPending) {
+            pending_.push_back(index);
+        }
+        pending_ts_[index] = ts_event;
+    }
+
+    void update_analytics(uint32_t index, const MboEvent& ev, const BookUpdate& update, const Book& book) {
+        if (index >= analytics_.size()) {
+            analytics_.resize(index + 1, BookAnalytics(analytics_depth_));
+        }
+        if (analytics_[index].update(ev, update, book) && ev.ts_event >= start_ts_ && ev.ts_event < end_ts_) {
+            AnalyticsRecord rec;
+            analytics_[index].fill(rec, ev.ts_event, ev.instrument_id);
+            on_analytics_(rec);
+        }
+    }
+
+    // Prepares the new book of a newly seen instrument.
+    void set_up(Book& book, uint32_t index) {
+        size_t hint = orders_hint_ > 0 ? static_cast<size_t>(orders_hint_) : (index == 0 ? first_orders_hint_ : 0);
+        if (hint > 0) {
+            book.reserve_orders(hint);
+        }
+        if (track_top_) {
+            book.watch_top(Depth);
+        }
+    }
+
+    const int64_t orders_hint_;
+    BookManager<Book> books_;
+    const bool track_top_;
+    const int64_t start_ts_;
+    const int64_t end_ts_;
+    const int64_t conflate_ns_;
+    const bool filtered_; // Any of the three is set
+    int64_t interval_{kNotPending}; // Current --conflate interval
+    std::vector<uint32_t> pending_; // Books changed in it, in order of first change
+    std::vector<int64_t> pending_ts_; // By book: ts_event of its last change, or kNotPending
+    size_t first_orders_hint_;
+    int analytics_depth_{0};
+    std::function<void(const AnalyticsRecord&)> on_analytics_; // Unset unless track_analytics()
+    std::vector<BookAnalytics> analytics_; // By book
+};
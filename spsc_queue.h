@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+//
+// The producer owns `tail_` and the consumer owns `head_`; each index lives
+// on its own cache line, together with the owner's cached copy of the
+// other one, so the two threads only exchange cache lines when a cached
+// index runs out. Capacity is rounded up to a power of two.
+//
+// push() and pop() wait when the queue is full or empty, spinning briefly
+// and then yielding, so a producer and consumer sharing one core still
+// make progress.
+template<typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) {
+            n *= 2;
+        }
+        slots_.reset(new T[n]);
+        mask_ = n - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer side.
+    bool try_push(const T& value) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cached_head_ > mask_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail - cached_head_ > mask_) {
+                return false;
+            }
+        }
+        slots_[tail & mask_] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    void push(const T& value) {
+        for (unsigned spins = 0; !try_push(value); ++spins) {
+            backoff(spins);
+        }
+    }
+
+    // Marks the end of the stream; the consumer drains what is left.
+    void close() { closed_.store(true, std::memory_order_release); }
+
+    // Consumer side.
+    bool try_pop(T& value) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cached_tail_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head == cached_tail_) {
+                return false;
+            }
+        }
+        value = slots_[head & mask_];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Waits for the next value. Returns false once the queue is closed and
+    // empty.
+    bool pop(T& value) {
+        for (unsigned spins = 0; !try_pop(value); ++spins) {
+            if (closed_.load(std::memory_order_acquire)) {
+                // close() follows the last push, so one more look suffices.
+                return try_pop(value);
+            }
+            backoff(spins);
+        }
+        return true;
+    }
+
+    // Moves up to `max` queued values to `out` without waiting and returns
+    // how many. The head is published once for the whole batch.
+    size_t try_pop(T* out, size_t max) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cached_tail_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head == cached_tail_) {
+                return 0;
+            }
+        }
+        const size_t n = std::min(max, cached_tail_ - head);
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = slots_[(head + i) & mask_];
+        }
+        head_.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    // Waits for at least one value, then takes up to `max`. Returns 0 once
+    // the queue is closed and empty.
+    size_t pop(T* out, size_t max) {
+        size_t n;
+        for (unsigned spins = 0; (n = try_pop(out, max)) == 0; ++spins) {
+            if (closed_.load(std::memory_order_acquire)) {
+                return try_pop(out, max);
+            }
+            backoff(spins);
+        }
+        return n;
+    }
+
+private:
+    static constexpr size_t kCacheLine = 64;
+    static constexpr unsigned kSpinLimit = 64;
+
+    static void backoff(unsigned spins) {
+        if (spins < kSpinLimit) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    alignas(kCacheLine) std::atomic<size_t> head_{0};
+    size_t cached_tail_{0};
+    alignas(kCacheLine) std::atomic<size_t> tail_{0};
+    size_t cached_head_{0};
+    alignas(kCacheLine) std::atomic<bool> closed_{false};
+    std::unique_ptr<T[]> slots_;
+    size_t mask_{0};
+};
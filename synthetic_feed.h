@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "mbo_event.h"
+
+// Shape of a synthetic MBO feed.
+struct FeedConfig {
+    size_t events{500000};       // Rows to generate, F rows included
+    double add_weight{0.5};      // Relative frequency of each book action
+    double cancel_weight{0.4};
+    double trade_weight{0.1};
+    double volatility{0.2};      // Chance per row that the mid moves one tick
+    int depth{20};               // Levels per side that adds are spread over
+    size_t live_orders{10000};   // Resting orders (order-id cardinality) the book hovers at
+    int64_t tick{100};           // Tick size, in price units (one cent at scale 10000)
+    int64_t start_mid{550000};
+    uint32_t instrument_id{1108};
+    uint64_t seed{1};
+};
+
+// Generates a single-instrument MBO stream with the shape of a FeedConfig.
+//
+// Adds land uniformly on the `depth` levels behind a mid price that
+// random-walks by whole ticks. Cancels remove a random resting order.
+// A trade hits a resting order near the top of the book and is followed,
+// as in the real feed, by the F and C rows of the filled order. Adds
+// become cancels while `live_orders` orders rest, so the number of
+// distinct live ids stays bounded.
+//
+// Prices are fixed-point at the default PriceScale (10000 per 1.0).
+class SyntheticFeed {
+public:
+    explicit SyntheticFeed(const FeedConfig& cfg)
+        : cfg_(cfg),
+          rng_(cfg.seed),
+          action_({cfg.add_weight, cfg.cancel_weight, cfg.trade_weight}),
+          mid_(cfg.start_mid) {
+        live_.reserve(cfg.live_orders);
+    }
+
+    // Produces the next row. Returns false after cfg.events rows.
+    bool next(MboEvent& ev) {
+        if (produced_ == cfg_.events) {
+            return false;
+        }
+        ++produced_;
+        if (pending_ > 0) {
+            ev = after_trade_[2 - pending_--];
+            return true;
+        }
+        ts_ += static_cast<int64_t>(rng_() % 50000);
+        if (std::bernoulli_distribution(cfg_.volatility)(rng_)) {
+            mid_ += (rng_() & 1) ? cfg_.tick : -cfg_.tick;
+        }
+        int action = live_.empty() ? kAdd : action_(rng_);
+        if (action == kAdd && live_.size() >= cfg_.live_orders) {
+            action = kCancel;
+        }
+        switch (action) {
+            case kAdd:
+                ev = add();
+                break;
+            case kCancel:
+                ev = cancel();
+                break;
+            default:
+                ev = trade();
+                break;
+        }
+        return true;
+    }
+
+    std::vector<MboEvent> generate() {
+        std::vector<MboEvent> events;
+        events.reserve(cfg_.events);
+        MboEvent ev;
+        while (next(ev)) {
+            events.push_back(ev);
+        }
+        return events;
+    }
+
+private:
+    enum { kAdd, kCancel, kTrade };
+
+    struct Resting {
+        uint64_t order_id;
+        int64_t price;
+        int64_t size;
+        char side;
+    };
+
+    MboEvent row(char action, char side, int64_t price, int64_t size, uint64_t order_id) const {
+        return MboEvent{ts_, price, size, order_id, cfg_.instrument_id, action, side};
+    }
+
+    MboEvent add() {
+        const char side = (rng_() & 1) ? 'B' : 'A';
+        const int64_t offset = cfg_.tick * (1 + static_cast<int64_t>(rng_() % static_cast<uint64_t>(cfg_.depth)));
+        const int64_t price = side == 'B' ? mid_ - offset : mid_ + offset;
+        const int64_t size = 1 + static_cast<int64_t>(rng_() % 500);
+        live_.push_back(Resting{next_id_, price, size, side});
+        return row('A', side, price, size, next_id_++);
+    }
+
+    // Removes resting order `i` (swap with the last) and returns it.
+    Resting take(size_t i) {
+        Resting r = live_[i];
+        live_[i] = live_.back();
+        live_.pop_back();
+        return r;
+    }
+
+    MboEvent cancel() {
+        Resting r = take(rng_() % live_.size());
+        return row('C', r.side, r.price, r.size, r.order_id);
+    }
+
+    // Fills the best of a few sampled resting orders, so trades happen
+    // near the top of the book without tracking it.
+    MboEvent trade() {
+        size_t best = rng_() % live_.size();
+        for (int k = 0; k < 3; ++k) {
+            size_t i = rng_() % live_.size();
+            if (std::abs(live_[i].price - mid_) < std::abs(live_[best].price - mid_)) {
+                best = i;
+            }
+        }
+        Resting r = take(best);
+        const char aggressor = r.side == 'B' ? 'A' : 'B';
+        after_trade_[0] = row('F', r.side, r.price, r.size, r.order_id);
+        after_trade_[1] = row('C', r.side, r.price, r.size, r.order_id);
+        pending_ = 2;
+        return row('T', aggressor, r.price, r.size, 0);
+    }
+
+    FeedConfig cfg_;
+    std::mt19937_64 rng_;
+    std::discrete_distribution<int> action_;
+    std::vector<Resting> live_;
+    MboEvent after_trade_[2]{};
+    int pending_{0};
+    size_t produced_{0};
+    int64_t mid_;
+    int64_t ts_{1752739503360677248LL};
+    uint64_t next_id_{1};
+};
+
+// Renders events in the Databento MBO CSV layout that reconstruction
+// reads, header and initial clear row included. Prices are written with
+// nine decimals, as Databento does.
+inline std::string render_mbo_csv(const std::vector<MboEvent>& events) {
+    std::string out =
+        "ts_recv,ts_event,rtype,publisher_id,instrument_id,action,side,price,size,channel_id,"
+        "order_id,flags,ts_in_delta,sequence,symbol\n";
+    const int64_t ts0 = events.empty() ? 0 : events.front().ts_event;
+    out += std::to_string(ts0) + "," + std::to_string(ts0) + ",160,2," +
+           std::to_string(events.empty() ? 0 : events.front().instrument_id) + ",R,N,,0,0,0,8,0,0,SYN\n";
+    out.reserve(out.size() + events.size() * 112);
+
+    char line[256];
+    for (const MboEvent& ev : events) {
+        char* p = line;
+        char* end = line + sizeof(line);
+        for (int k = 0; k < 2; ++k) {
+            p = std::to_chars(p, end, ev.ts_event).ptr;
+            *p++ = ',';
+        }
+        p = std::copy_n("160,2,", 6, p);
+        p = std::to_chars(p, end, ev.instrument_id).ptr;
+        *p++ = ',';
+        *p++ = ev.action;
+        *p++ = ',';
+        *p++ = ev.side;
+        *p++ = ',';
+        // Price units are 1e-4: four decimals, padded to nine.
+        p = std::to_chars(p, end, ev.price / 10000).ptr;
+        *p++ = '.';
+        char frac[5];
+        std::to_chars(frac, frac + 5, 10000 + ev.price % 10000);
+        p = std::copy_n(frac + 1, 4, p);
+        p = std::copy_n("00000,", 6, p);
+        p = std::to_chars(p, end, ev.size).ptr;
+        p = std::copy_n(",0,", 3, p);
+        p = std::to_chars(p, end, ev.order_id).ptr;
+        p = std::copy_n(",130,165200,851012,SYN\n", 23, p);
+        out.append(line, p);
+    }
+    return out;
+}
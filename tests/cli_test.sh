@@ -0,0 +1,151 @@
+#!/bin/sh
+# Runs the reconstruction binary on the fixtures in tests/data and compares
+# what it writes, byte for byte, with the files in tests/expected.
+#
+# tests/data/mbo.csv is two interleaved synthetic instruments (1108, 1109)
+# with N-side trades, unknown and partial cancels mixed in, then a third
+# (1110) with a partial fill whose order is cancelled later and a T-F-C
+# with another instrument's events between its rows; mbo.dbn is the same
+# feed in DBN. The expected files were checked against independent
+# models of the rules in Readme.txt section 4, not just recorded.
+#
+# Usage: tests/cli_test.sh [path/to/reconstruction]
+
+BIN=$(cd "$(dirname "${1:-./reconstruction}")" && pwd)/$(basename "${1:-./reconstruction}")
+HERE=$(cd "$(dirname "$0")" && pwd)
+DATA=$HERE/data
+EXPECTED=$HERE/expected
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+failures=0
+
+pass() { echo "ok    $1"; }
+fail() { echo "FAIL  $1"; failures=$((failures + 1)); }
+
+# check NAME EXPECTED ACTUAL
+check() {
+    if cmp "$2" "$3"; then pass "$1"; else fail "$1"; fi
+}
+
+# run NAME EXPECTED OPTIONS...: writes to out.<ext of EXPECTED>
+run() {
+    name=$1 expected=$2
+    shift 2
+    out=out.${expected##*.}
+    rm -f "$out"
+    if "$BIN" -o "$out" "$@" 2>err.txt; then
+        check "$name" "$expected" "$out"
+    else
+        fail "$name (exit $?)"
+        cat err.txt
+    fi
+}
+
+# rows INSTRUMENT FILES...: the tagged CSV rows of one instrument
+rows() {
+    id=$1
+    shift
+    awk -F, -v id="$id" 'FNR > 1 && $2 == id' "$@"
+}
+
+TAG="--instrument-output tagged"
+
+for book in flat map map-arena; do
+    run "--book $book" "$EXPECTED/mbp.csv" $TAG --book "$book" "$DATA/mbo.csv"
+done
+run "--book l3" "$EXPECTED/mbp.l3.csv" $TAG --book l3 "$DATA/mbo.csv"
+run "DBN input" "$EXPECTED/mbp.csv" $TAG "$DATA/mbo.dbn"
+run "DBN input, --parse-threads 3" "$EXPECTED/mbp.csv" $TAG --parse-threads 3 "$DATA/mbo.dbn"
+run "--parse-threads 3" "$EXPECTED/mbp.csv" $TAG --parse-threads 3 "$DATA/mbo.csv"
+run "--pipeline" "$EXPECTED/mbp.csv" $TAG --pipeline "$DATA/mbo.csv"
+run "--io-uring" "$EXPECTED/mbp.csv" $TAG --io-uring "$DATA/mbo.csv"
+run "--emit delta" "$EXPECTED/mbp.delta.csv" $TAG --emit delta "$DATA/mbo.csv"
+run "--emit changed --conflate 20" "$EXPECTED/mbp.conflate.csv" $TAG --emit changed --conflate 20 "$DATA/mbo.csv"
+run "--depth 1 --format bin" "$EXPECTED/mbp.d1.bin" $TAG --depth 1 --format bin "$DATA/mbo.csv"
+run "--depth 1 --format arrow" "$EXPECTED/mbp.d1.arrow" $TAG --depth 1 --format arrow "$DATA/mbo.csv"
+
+# stdin
+rm -f out.csv
+"$BIN" -o out.csv $TAG - < "$DATA/mbo.csv" 2>err.txt && check "stdin" "$EXPECTED/mbp.csv" out.csv || fail "stdin"
+
+# --depth 5 is the first 5 of the 10 level pairs: 2 + 5 * 6 columns
+rm -f out.csv
+"$BIN" -o out.csv $TAG --depth 5 "$DATA/mbo.csv" 2>err.txt
+cut -d, -f1-32 "$EXPECTED/mbp.csv" > expected5.csv
+check "--depth 5" expected5.csv out.csv
+
+# --analytics
+rm -f analytics.csv
+"$BIN" -o /dev/null $TAG --analytics analytics.csv "$DATA/mbo.csv" 2>err.txt
+check "--analytics" "$EXPECTED/analytics.csv" analytics.csv
+
+# --threads: split files byte-equal to the serial run's, tagged shards
+# holding exactly each instrument's rows of the serial run, in order.
+mkdir serial threads shards
+"$BIN" -o serial/s.csv --instrument-output split "$DATA/mbo.csv" 2>err.txt
+"$BIN" -o threads/s.csv --instrument-output split --threads 2 "$DATA/mbo.csv" 2>err.txt
+for id in 1108 1109 1110; do
+    check "--threads 2, split $id" "serial/s.$id.csv" "threads/s.$id.csv"
+done
+"$BIN" -o shards/t.csv $TAG --threads 2 "$DATA/mbo.csv" 2>err.txt
+for id in 1108 1109 1110; do
+    rows "$id" "$EXPECTED/mbp.csv" > expected.$id.csv
+    rows "$id" shards/t.shard*.csv > shards.$id.csv
+    check "--threads 2, tagged $id" expected.$id.csv shards.$id.csv
+done
+
+# Checkpoint and resume: the resumed run writes the header and then the
+# rows the uninterrupted run wrote after the checkpoint.
+mkdir ck
+"$BIN" -o /dev/null $TAG --checkpoint-every 300 --checkpoint-prefix ck/ck "$DATA/mbo.csv" 2>err.txt
+for ckpt in $(ls ck/*.ckpt | head -2); do
+    rm -f out.csv
+    "$BIN" -o out.csv $TAG --resume-from "$ckpt" "$DATA/mbo.csv" 2>err.txt
+    body=$(($(wc -l < out.csv) - 1))
+    { head -1 "$EXPECTED/mbp.csv"; tail -n "$body" "$EXPECTED/mbp.csv"; } > expected.resume.csv
+    if [ "$body" -gt 0 ] && [ "$body" -lt $(($(wc -l < "$EXPECTED/mbp.csv") - 1)) ]; then
+        check "--resume-from $(basename "$ckpt")" expected.resume.csv out.csv
+    else
+        fail "--resume-from $(basename "$ckpt") wrote $body rows"
+    fi
+done
+
+# A checkpoint per row: rows sharing a ts_event must not overwrite each
+# other's checkpoint.
+mkdir every
+"$BIN" -o /dev/null $TAG --checkpoint-every 1 --checkpoint-prefix every/ck "$DATA/mbo.csv" 2>err.txt
+rows=$(($(wc -l < "$DATA/mbo.csv") - 2))
+if [ "$(ls every | wc -l)" -eq "$rows" ]; then pass "--checkpoint-every 1"; else fail "--checkpoint-every 1"; fi
+
+# Resuming on another input is refused: another file, the same file with
+# one byte changed, and the file piped in, where it cannot be checked.
+ckpt=$(ls ck/*.ckpt | head -1)
+sed '3s/SYN$/SYM/' "$DATA/mbo.csv" > changed.csv
+for input in "$DATA/mbo.dbn" changed.csv -; do
+    if "$BIN" -o out.csv $TAG --resume-from "$ckpt" "$input" < "$DATA/mbo.csv" 2>err.txt; then
+        fail "--resume-from on another input ($input)"
+    else
+        pass "--resume-from on another input ($(basename "$input"))"
+    fi
+done
+
+# A price the scale cannot hold exactly is refused, not rounded: the
+# fixture's cent prices in quarters, CSV and DBN, and one price with a
+# fifth decimal at the default scale.
+refused() {
+    name=$1
+    shift
+    if "$BIN" -o out.csv $TAG "$@" 2>err.txt; then fail "$name"; else pass "$name"; fi
+}
+refused "--price-scale 4, CSV input" --price-scale 4 "$DATA/mbo.csv"
+refused "--price-scale 4, DBN input" --price-scale 4 "$DATA/mbo.dbn"
+sed '3s/,55\.040000000,/,55.040050000,/' "$DATA/mbo.csv" > fine.csv
+refused "a fifth decimal at the default scale" fine.csv
+
+if [ "$failures" -ne 0 ]; then
+    echo "$failures CLI check(s) failed"
+    exit 1
+fi
+echo "All CLI checks passed"
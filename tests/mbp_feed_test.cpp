@@ -0,0 +1,159 @@
+// Push-API test of libmbp: tests/data/mbo.csv and mbo.dbn are pushed into
+// an MbpFeed in uneven chunks, as a live feed handler would, and the
+// snapshots it hands back are written as tagged CSV and compared byte for
+// byte with the reconstruction binary's output for the same input in
+// tests/expected (see tests/cli_test.sh).
+//
+// Usage: mbp_feed_test <tests directory>
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mbp.h"
+#include "output_buffer.h"
+
+namespace {
+
+bool read_file(const std::string& path, std::string& text) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    char block[1 << 16];
+    ssize_t n;
+    while ((n = ::read(fd, block, sizeof(block))) > 0) {
+        text.append(block, static_cast<size_t>(n));
+    }
+    ::close(fd);
+    return n == 0;
+}
+
+// Collects an OutputBuffer's bytes in memory.
+class StringSink : public ByteSink {
+public:
+    explicit StringSink(std::string& text) : text_(text) {}
+    bool write(const char* data, size_t n) override {
+        text_.append(data, n);
+        return true;
+    }
+    bool finish() override { return true; }
+
+private:
+    std::string& text_;
+};
+
+// Pushes `input` into `feed` `chunk` bytes at a time, carrying over what
+// each call leaves unconsumed, the way a reader of a socket would.
+template<typename PushFn>
+void push_in_chunks(std::string_view input, size_t chunk, PushFn&& push) {
+    std::string pending;
+    for (size_t pos = 0; pos < input.size(); pos += chunk) {
+        pending.append(input.substr(pos, chunk));
+        pending.erase(0, push(std::string_view(pending)));
+    }
+}
+
+// Replays `input` (CSV, or DBN records when `dbn`) through an MbpFeed
+// over `book` and returns its snapshots, or deltas, as the CLI's tagged
+// CSV.
+std::string replay(std::string_view input, bool dbn, BookKind book, EmitMode emit) {
+    MbpFeedOptions opts;
+    opts.book = book;
+    opts.emit = emit;
+    MbpFeed feed(opts);
+
+    std::string text;
+    OutputBuffer out;
+    out.attach(std::make_unique<StringSink>(text));
+    BasicMbpWriter<kMbpDepth> writer(out, OutputFormat::kCsv, emit, opts.price_scale.factor, true);
+    writer.write_header();
+    feed.subscribe_snapshots([&](uint32_t instrument_id, const MbpRecord& rec) { writer.write(rec, instrument_id); });
+    feed.subscribe_deltas(
+        [&](uint32_t instrument_id, const MbpDelta& delta) { writer.write_delta(delta, instrument_id); });
+
+    // 1000 bytes is neither a whole number of CSV rows nor of 56-byte DBN
+    // records, so most chunks end in the middle of one.
+    constexpr size_t kChunk = 1000;
+    if (dbn) {
+        input.remove_prefix(dbn_records_offset(input.data(), input.size()));
+        push_in_chunks(input, kChunk, [&](std::string_view data) { return feed.on_dbn(data); });
+        if (feed.failed()) {
+            return "DBN decoding failed";
+        }
+    } else {
+        push_in_chunks(input, kChunk, [&](std::string_view data) { return feed.on_csv(data); });
+    }
+    writer.finish();
+    out.close();
+    return text;
+}
+
+// A price that the scale cannot hold exactly fails the feed, and neither
+// its row nor any later one is applied, in CSV or in DBN.
+bool check_off_scale(std::string_view csv, std::string_view dbn) {
+    MbpFeedOptions opts;
+    opts.price_scale = PriceScale::from_factor(4); // The fixture's cent prices are off this scale
+    size_t snapshots = 0;
+    MbpFeed from_csv(opts);
+    from_csv.subscribe_snapshots([&](uint32_t, const MbpRecord&) { ++snapshots; });
+    from_csv.on_csv(csv);
+    MbpFeed from_dbn(opts);
+    from_dbn.subscribe_snapshots([&](uint32_t, const MbpRecord&) { ++snapshots; });
+    dbn.remove_prefix(dbn_records_offset(dbn.data(), dbn.size()));
+    from_dbn.on_dbn(dbn);
+    return from_csv.failed() && from_dbn.failed() && snapshots == 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        std::fprintf(stderr, "Usage: %s <tests directory>\n", argv[0]);
+        return 2;
+    }
+    const std::string dir = argv[1];
+    std::string csv, dbn, mbp, l3, delta;
+    if (!read_file(dir + "/data/mbo.csv", csv) || !read_file(dir + "/data/mbo.dbn", dbn) ||
+        !read_file(dir + "/expected/mbp.csv", mbp) || !read_file(dir + "/expected/mbp.l3.csv", l3) ||
+        !read_file(dir + "/expected/mbp.delta.csv", delta)) {
+        std::fprintf(stderr, "Error: cannot read the fixtures under %s\n", dir.c_str());
+        return 2;
+    }
+
+    struct Case {
+        const char* name;
+        BookKind book;
+        EmitMode emit;
+        const std::string& expected;
+    };
+    const Case cases[] = {
+        {"flat", BookKind::kFlat, EmitMode::kAll, mbp},
+        {"map", BookKind::kMap, EmitMode::kAll, mbp},
+        {"map-arena", BookKind::kMapArena, EmitMode::kAll, mbp},
+        {"l3", BookKind::kL3, EmitMode::kAll, l3},
+        {"flat, deltas", BookKind::kFlat, EmitMode::kDelta, delta},
+    };
+    int failures = 0;
+    for (const Case& c : cases) {
+        for (bool from_dbn : {false, true}) {
+            const std::string got = replay(from_dbn ? dbn : csv, from_dbn, c.book, c.emit);
+            const bool ok = got == c.expected;
+            std::printf("%-6sMbpFeed %s, %s input\n", ok ? "ok" : "FAIL", c.name, from_dbn ? "DBN" : "CSV");
+            failures += !ok;
+        }
+    }
+    const bool off_scale_ok = check_off_scale(csv, dbn);
+    std::printf("%-6sMbpFeed refuses prices off the scale\n", off_scale_ok ? "ok" : "FAIL");
+    failures += !off_scale_ok;
+    if (failures != 0) {
+        std::printf("%d MbpFeed check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("All MbpFeed checks passed\n");
+    return 0;
+}
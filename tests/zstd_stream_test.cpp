@@ -0,0 +1,148 @@
+// Test of the zstd input path (zstd_stream.h), built and run by `make test`
+// when the tree is built with `make ZSTD=1`:
+//   - a stream of two frames, read from a pipe to its end, decompresses to
+//     the original bytes;
+//   - a decoder whose input pipe stays open is destroyed after reading
+//     only part of the stream, and must not wait for input that never
+//     comes. A watchdog fails the test instead of letting it hang.
+//
+// Usage: zstd_stream_test
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "zstd_stream.h"
+
+namespace {
+
+constexpr unsigned kWatchdogSeconds = 10;
+
+// Compressible text a few codec chunks long, so the reader sees several.
+std::string make_text(size_t bytes) {
+    std::string text;
+    for (uint64_t i = 0; text.size() < bytes; ++i) {
+        text += std::to_string(1752739503360689447ULL + i * 997) + ",A,B,100.25," + std::to_string(i % 500) + "\n";
+    }
+    return text;
+}
+
+std::string compress(const std::string& text) {
+    std::string frame(ZSTD_compressBound(text.size()), '\0');
+    const size_t n = ZSTD_compress(frame.data(), frame.size(), text.data(), text.size(), 1);
+    frame.resize(ZSTD_isError(n) ? 0 : n);
+    return frame;
+}
+
+// Writes `data` to a new pipe from a thread and returns the read end. The
+// write end is closed afterwards unless `keep_open`, in which case it is
+// returned in `write_fd` for the caller to close.
+int pipe_in(const std::string& data, std::thread& writer, bool keep_open, int& write_fd) {
+    int fds[2];
+    if (::pipe(fds) != 0) {
+        return -1;
+    }
+    write_fd = fds[1];
+    writer = std::thread([&data, fd = fds[1], keep_open] {
+        detail::write_fd(fd, data.data(), data.size());
+        if (!keep_open) {
+            ::close(fd);
+        }
+    });
+    return fds[0];
+}
+
+// Reads `fd`'s zstd stream through a ZstdDecoder, as read_events does
+// (the first bytes sniffed, then handed on as the prefix), until the end
+// or until `limit` bytes. Then calls `before_stop`, with the decoder
+// still running.
+template<typename Fn>
+std::string decode(int fd, size_t limit, Fn&& before_stop) {
+    char magic[4];
+    size_t sniffed = 0;
+    while (sniffed < sizeof(magic)) {
+        const ssize_t n = ::read(fd, magic + sniffed, sizeof(magic) - sniffed);
+        if (n <= 0) {
+            return {};
+        }
+        sniffed += static_cast<size_t>(n);
+    }
+    ZstdDecoder decoder(fd, magic, sniffed);
+    std::string out;
+    std::vector<char> block(1 << 16);
+    ssize_t n;
+    while (out.size() < limit && (n = decoder.read(block.data(), block.size())) > 0) {
+        out.append(block.data(), static_cast<size_t>(n));
+    }
+    before_stop();
+    return out; // ~ZstdDecoder stops the decoder thread here
+}
+
+bool check_whole_stream() {
+    const std::string first = make_text(6 << 20);
+    const std::string second = make_text(1 << 20);
+    const std::string stream = compress(first) + compress(second);
+    std::thread writer;
+    int write_fd;
+    const int fd = pipe_in(stream, writer, false, write_fd);
+    const std::string out = decode(fd, SIZE_MAX, [] {});
+    writer.join();
+    ::close(fd);
+    return out == first + second;
+}
+
+bool check_early_stop() {
+    // More than one codec chunk, so the first reaches the reader while
+    // the decoder thread still has input to wait for.
+    const std::string text = make_text(3 * detail::ChunkRing::kCodecChunkBytes);
+    const std::string frame = compress(text);
+    const std::string partial = frame.substr(0, frame.size() / 2);
+    std::thread writer;
+    int write_fd;
+    const int fd = pipe_in(partial, writer, true, write_fd);
+    // Stop only once the decoder has taken everything in the pipe and is
+    // waiting on it for more. The sleep covers decompressing its last read.
+    const std::string out = decode(fd, 1, [&] {
+        writer.join();
+        int unread;
+        while (::ioctl(fd, FIONREAD, &unread) == 0 && unread > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    });
+    ::close(write_fd);
+    ::close(fd);
+    return !out.empty() && text.compare(0, out.size(), out) == 0;
+}
+
+} // namespace
+
+int main() {
+    std::signal(SIGALRM, [](int) {
+        static const char kMessage[] = "FAIL  ZstdDecoder did not stop: the test hung\n";
+        [[maybe_unused]] const ssize_t n = ::write(STDOUT_FILENO, kMessage, sizeof(kMessage) - 1);
+        _exit(1);
+    });
+    ::alarm(kWatchdogSeconds);
+
+    int failures = 0;
+    auto report = [&](const char* name, bool ok) {
+        std::printf("%-6s%s\n", ok ? "ok" : "FAIL", name);
+        std::fflush(stdout);
+        failures += !ok;
+    };
+    report("ZstdDecoder: two frames from a pipe, read to the end", check_whole_stream());
+    report("ZstdDecoder: destroyed mid-stream, its pipe still open", check_early_stop());
+    if (failures != 0) {
+        std::printf("%d zstd check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("All zstd checks passed\n");
+    return 0;
+}
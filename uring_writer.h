@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "huge_pages.h"
+#include "output_buffer.h"
+
+// Output written through io_uring from two alternating buffers
+// (--io-uring). The replay formats into one buffer while the kernel
+// writes the other, so a slow disk costs the replay nothing until it
+// falls a whole buffer behind. There is no writer thread: the write runs
+// in the kernel. No liburing either; the ring is set up with the raw
+// system calls, as huge_pages.h does for set_mempolicy.
+
+// Counters of one UringWriter, kept by its owner so they outlive it.
+struct UringStats {
+    uint64_t writes{0};   // Buffers submitted
+    uint64_t bytes{0};
+    uint64_t stalls{0};   // Submissions that waited for the previous write
+    uint64_t stall_ns{0}; // Time spent in those waits
+};
+
+class UringWriter : public BufferSink {
+public:
+    // Buffer address and O_DIRECT write granularity. 4 KB covers the
+    // logical block size of every device we write to.
+    static constexpr size_t kDirectBlock = 4096;
+
+    // Two buffers of `capacity` bytes each, plus a block for the O_DIRECT
+    // tail carried from one buffer to the next. They come from
+    // allocate_large, as the OutputBuffer's own buffer does, so
+    // --huge-pages covers them too.
+    UringWriter(size_t capacity, UringStats& stats)
+        : stats_(stats),
+          bufs_{PageBuffer(capacity + kDirectBlock, kDirectBlock), PageBuffer(capacity + kDirectBlock, kDirectBlock)} {}
+
+    UringWriter(const UringWriter&) = delete;
+    UringWriter& operator=(const UringWriter&) = delete;
+
+    ~UringWriter() override {
+        if (ring_fd_ >= 0) {
+            wait(false);
+            munmap(sqes_, sqes_size_);
+            if (cq_ring_ != sq_ring_) {
+                munmap(cq_ring_, cq_ring_size_);
+            }
+            munmap(sq_ring_, sq_ring_size_);
+            ::close(ring_fd_);
+        }
+    }
+
+    // Sets up the ring for writes to `fd`, which then bypass the page
+    // cache if `direct` is set and the file system allows it (see
+    // direct()). Returns false, with errno set, if the kernel has no
+    // usable io_uring (older than 5.6, or blocked by a seccomp filter).
+    bool open(int fd, bool direct) {
+        io_uring_params params{};
+        const long ring = syscall(__NR_io_uring_setup, kEntries, &params);
+        if (ring < 0) {
+            return false;
+        }
+        ring_fd_ = static_cast<int>(ring);
+        // Writes at the file position (offset -1) keep pipes and files on
+        // one path; with one write in flight they land in order.
+        if (!(params.features & IORING_FEAT_RW_CUR_POS) || !map_rings(params)) {
+            const int error = (params.features & IORING_FEAT_RW_CUR_POS) ? errno : ENOSYS;
+            ::close(ring_fd_);
+            ring_fd_ = -1;
+            errno = error;
+            return false;
+        }
+        fd_ = fd;
+        if (direct) {
+            const int flags = fcntl(fd_, F_GETFL);
+            direct_ = flags >= 0 && fcntl(fd_, F_SETFL, flags | O_DIRECT) == 0;
+        }
+        return true;
+    }
+
+    // Whether writes bypass the page cache. tmpfs and pipes refuse O_DIRECT.
+    bool direct() const { return direct_; }
+
+    char* buffer() override { return bufs_[0].data(); }
+
+    // Waits for the other buffer's write, submits this one's bytes and
+    // returns the other buffer to go on filling. Under O_DIRECT only whole
+    // blocks are written; the rest is copied to the front of the other
+    // buffer, and the returned cursor is just past it.
+    char* submit(char* data, size_t n) override {
+        wait();
+        char* const begin = data - carried_;
+        const size_t total = carried_ + n;
+        const size_t length = direct_ ? total & ~(kDirectBlock - 1) : total;
+        char* const next = bufs_[begin == bufs_[0].data() ? 1 : 0].data();
+        carried_ = total - length;
+        std::memcpy(next, begin + length, carried_);
+        if (length > 0 && !failed_) {
+            start_write(begin, length);
+            ++stats_.writes;
+        }
+        return next + carried_;
+    }
+
+    // Waits for the write in flight, then writes the last `n` bytes at
+    // `data` directly, with O_DIRECT cleared for an unaligned tail.
+    bool finish(char* data, size_t n) override {
+        wait(false);
+        char* begin = data - carried_;
+        size_t total = carried_ + n;
+        const size_t last = total;
+        carried_ = 0;
+        if (direct_) {
+            const int flags = fcntl(fd_, F_GETFL);
+            if (flags < 0 || fcntl(fd_, F_SETFL, flags & ~O_DIRECT) != 0) {
+                failed_ = true;
+            }
+            direct_ = false;
+        }
+        while (total > 0 && !failed_) {
+            const ssize_t w = ::write(fd_, begin, total);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                failed_ = true;
+                break;
+            }
+            begin += w;
+            total -= static_cast<size_t>(w);
+        }
+        if (!failed_) {
+            stats_.bytes += last;
+        }
+        return !failed_;
+    }
+
+private:
+    // One write in flight at a time; the spare entries are never used.
+    static constexpr unsigned kEntries = 4;
+
+    bool map_rings(const io_uring_params& params) {
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+        sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == nullptr) {
+            return false;
+        }
+        cq_ring_ = single ? sq_ring_ : map(cq_ring_size_, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+        if (cq_ring_ == nullptr || sqes_ == nullptr) {
+            if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+                munmap(cq_ring_, cq_ring_size_);
+            }
+            munmap(sq_ring_, sq_ring_size_);
+            return false;
+        }
+        char* sq = static_cast<char*>(sq_ring_);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        char* cq = static_cast<char*>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void* map(size_t size, off_t offset) {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    // Queues a write of `n` bytes at `data` and hands it to the kernel.
+    void start_write(const char* data, size_t n) {
+        const unsigned tail = *sq_tail_;
+        const unsigned index = tail & sq_mask_;
+        io_uring_sqe& sqe = sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_WRITE;
+        sqe.fd = fd_;
+        sqe.addr = reinterpret_cast<uint64_t>(data);
+        sqe.len = static_cast<uint32_t>(n);
+        sqe.off = static_cast<uint64_t>(-1);
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        while (syscall(__NR_io_uring_enter, ring_fd_, 1, 0, 0, nullptr, 0) < 0) {
+            if (errno != EINTR && errno != EAGAIN) {
+                failed_ = true;
+                return;
+            }
+        }
+        pending_ = data;
+        pending_size_ = n;
+    }
+
+    // Reaps the write in flight, if any. A short write, as to a pipe, is
+    // resubmitted for the rest. With `count_stall`, having to wait for
+    // the kernel counts as a stall, timed until the write is complete.
+    void wait(bool count_stall = true) {
+        bool stalled = false;
+        std::chrono::steady_clock::time_point start;
+        while (pending_size_ > 0) {
+            const unsigned head = *cq_head_;
+            while (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+                if (!stalled) {
+                    stalled = true;
+                    start = std::chrono::steady_clock::now();
+                }
+                if (syscall(__NR_io_uring_enter, ring_fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+                    errno != EINTR) {
+                    failed_ = true;
+                    pending_size_ = 0;
+                    return;
+                }
+            }
+            const int res = cqes_[head & cq_mask_].res;
+            __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+            const char* data = pending_;
+            size_t size = pending_size_;
+            pending_size_ = 0;
+            if (res == -EINTR || res == -EAGAIN) {
+                start_write(data, size);
+            } else if (res <= 0) {
+                failed_ = true;
+            } else {
+                stats_.bytes += static_cast<uint64_t>(res);
+                if (static_cast<size_t>(res) < size) {
+                    start_write(data + res, size - static_cast<size_t>(res));
+                }
+            }
+        }
+        if (stalled && count_stall) {
+            ++stats_.stalls;
+            stats_.stall_ns += static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start)
+                    .count());
+        }
+    }
+
+    UringStats& stats_;
+    PageBuffer bufs_[2];
+    size_t carried_{0}; // Bytes at the front of the current buffer, before the cursor
+    const char* pending_{nullptr}; // Write in flight, if pending_size_ > 0
+    size_t pending_size_{0};
+    int fd_{-1};
+    bool direct_{false};
+    bool failed_{false};
+
+    int ring_fd_{-1};
+    void* sq_ring_{nullptr};
+    void* cq_ring_{nullptr};
+    size_t sq_ring_size_{0};
+    size_t cq_ring_size_{0};
+    io_uring_sqe* sqes_{nullptr};
+    size_t sqes_size_{0};
+    unsigned* sq_tail_{nullptr};
+    unsigned sq_mask_{0};
+    unsigned* sq_array_{nullptr};
+    unsigned* cq_head_{nullptr};
+    unsigned* cq_tail_{nullptr};
+    unsigned cq_mask_{0};
+    io_uring_cqe* cqes_{nullptr};
+};
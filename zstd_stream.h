@@ -0,0 +1,298 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Streaming zstd decompression of input and compression of output, each
+// on its own thread so the codec overlaps the replay instead of sitting on
+// its critical path. Built with -DMBP_ZSTD (`make ZSTD=1`), linking
+// libzstd; without it kZstdAvailable is false and compressed input or
+// output is refused.
+#ifdef MBP_ZSTD
+inline constexpr bool kZstdAvailable = true;
+#else
+inline constexpr bool kZstdAvailable = false;
+#endif
+
+// True if `data` starts with a zstd frame (magic 0xFD2FB528, little-endian).
+inline bool is_zstd_frame(const char* data, size_t n) {
+    static constexpr unsigned char kMagic[4] = {0x28, 0xB5, 0x2F, 0xFD};
+    return n >= sizeof(kMagic) && std::memcmp(data, kMagic, sizeof(kMagic)) == 0;
+}
+
+#ifdef MBP_ZSTD
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include "output_buffer.h"
+#include "spsc_queue.h"
+
+namespace detail {
+// A buffer passed between the codec thread and the replay thread.
+struct CodecChunk {
+    char* data{nullptr};
+    size_t size{0};
+};
+
+// kCodecChunks buffers of kCodecChunkBytes, circulating between a queue
+// of filled chunks and a queue of free ones. With one chunk being filled,
+// one being drained and the rest queued, neither thread waits on the
+// other unless it is persistently faster.
+class ChunkRing {
+public:
+    static constexpr size_t kCodecChunks = 4;
+    static constexpr size_t kCodecChunkBytes = 4 << 20;
+
+    ChunkRing() : full(kCodecChunks), free(kCodecChunks) {
+        for (size_t i = 0; i < kCodecChunks; ++i) {
+            storage_.emplace_back(new char[kCodecChunkBytes]);
+            free.push(CodecChunk{storage_.back().get(), 0});
+        }
+    }
+
+    SpscQueue<CodecChunk> full;
+    SpscQueue<CodecChunk> free;
+
+private:
+    std::vector<std::unique_ptr<char[]>> storage_;
+};
+
+inline bool write_fd(int fd, const char* data, size_t n) {
+    while (n > 0) {
+        ssize_t w = ::write(fd, data, n);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += w;
+        n -= static_cast<size_t>(w);
+    }
+    return true;
+}
+} // namespace detail
+
+// Decompresses a zstd stream from a descriptor on its own thread. The
+// replay thread pulls the plain bytes with read(), like from a pipe.
+// Concatenated frames are decoded one after another.
+class ZstdDecoder {
+public:
+    // `prefix` holds bytes already read from `fd` (the sniffed magic).
+    ZstdDecoder(int fd, const char* prefix, size_t prefix_size)
+        : fd_(fd), prefix_(prefix, prefix + prefix_size), wake_fd_(::eventfd(0, EFD_CLOEXEC)),
+          thread_([this] { decode(); }) {}
+
+    ZstdDecoder(const ZstdDecoder&) = delete;
+    ZstdDecoder& operator=(const ZstdDecoder&) = delete;
+
+    ~ZstdDecoder() {
+        // If the reader stopped early, wake the decoder from a read of a
+        // pipe that may never deliver another byte, and hand chunks back
+        // until it sees stop_ rather than waiting for a free one.
+        stop_.store(true, std::memory_order_relaxed);
+        if (wake_fd_ >= 0) {
+            const uint64_t one = 1;
+            [[maybe_unused]] const ssize_t woken = ::write(wake_fd_, &one, sizeof(one));
+        }
+        detail::CodecChunk chunk;
+        while (!done_.load(std::memory_order_acquire)) {
+            while (ring_.full.try_pop(chunk)) {
+                ring_.free.push(chunk);
+            }
+            std::this_thread::yield();
+        }
+        thread_.join();
+        if (wake_fd_ >= 0) {
+            ::close(wake_fd_);
+        }
+    }
+
+    // Copies up to `n` decompressed bytes into `dst`. Returns 0 at the end
+    // of the stream and -1 on a read or decode error.
+    ssize_t read(char* dst, size_t n) {
+        while (pos_ == current_.size) {
+            if (current_.data) {
+                ring_.free.push(current_);
+                current_ = {};
+            }
+            if (!ring_.full.pop(current_)) {
+                return failed_.load(std::memory_order_acquire) ? -1 : 0;
+            }
+            pos_ = 0;
+        }
+        size_t k = std::min(n, current_.size - pos_);
+        std::memcpy(dst, current_.data + pos_, k);
+        pos_ += k;
+        return static_cast<ssize_t>(k);
+    }
+
+private:
+    void decode() {
+        std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> dctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+        std::vector<char> in(ZSTD_DStreamInSize());
+        std::memcpy(in.data(), prefix_.data(), prefix_.size());
+        ZSTD_inBuffer input{in.data(), prefix_.size(), 0};
+        detail::CodecChunk chunk;
+        ring_.free.pop(chunk);
+        bool eof = false;
+        bool flush_pending = false; // The last call filled its output; more may be buffered
+        size_t hint = 0;            // Zero once a frame is complete
+        while (!stop_.load(std::memory_order_relaxed)) {
+            if (input.pos == input.size && !flush_pending) {
+                if (eof || !wait_readable()) {
+                    break;
+                }
+                ssize_t r = ::read(fd_, in.data(), in.size());
+                if (r < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (r < 0) {
+                    failed_.store(true, std::memory_order_release);
+                    break;
+                }
+                eof = r == 0;
+                input = ZSTD_inBuffer{in.data(), static_cast<size_t>(r), 0};
+                continue;
+            }
+            ZSTD_outBuffer output{chunk.data, detail::ChunkRing::kCodecChunkBytes, chunk.size};
+            const size_t consumed = input.pos;
+            const size_t r = ZSTD_decompressStream(dctx.get(), &output, &input);
+            if (ZSTD_isError(r)) {
+                failed_.store(true, std::memory_order_release);
+                break;
+            }
+            if (input.pos != consumed || output.pos != chunk.size) {
+                hint = r; // A call that did nothing reports the next frame's header size
+            }
+            chunk.size = output.pos;
+            flush_pending = output.pos == output.size;
+            if (chunk.size == detail::ChunkRing::kCodecChunkBytes) {
+                ring_.full.push(chunk);
+                ring_.free.pop(chunk);
+                chunk.size = 0;
+            }
+        }
+        if (chunk.size > 0) {
+            ring_.full.push(chunk); // Never waits: the queue holds every chunk
+        }
+        if (eof && hint != 0) {
+            // The input ended inside a frame.
+            failed_.store(true, std::memory_order_release);
+        }
+        ring_.full.close();
+        done_.store(true, std::memory_order_release);
+    }
+
+    // Waits until fd_ can be read without blocking, which a regular file
+    // always can. Returns false if the destructor woke the thread instead.
+    // Without an eventfd it does not wait, and read() may block.
+    bool wait_readable() {
+        if (wake_fd_ < 0) {
+            return true;
+        }
+        pollfd fds[2] = {{fd_, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+        while (::poll(fds, 2, -1) < 0 && errno == EINTR) {
+        }
+        return fds[1].revents == 0;
+    }
+
+    int fd_;
+    std::vector<char> prefix_;
+    int wake_fd_; // Written by the destructor to interrupt wait_readable()
+    detail::ChunkRing ring_;
+    detail::CodecChunk current_;
+    size_t pos_{0};
+    std::atomic<bool> stop_{false};
+    std::atomic<bool> done_{false};
+    std::atomic<bool> failed_{false};
+    std::thread thread_; // Last: starts once everything above exists
+};
+
+// Compresses an OutputBuffer's bytes on its own thread and writes them to
+// a descriptor. The replay thread only copies each flushed buffer into a
+// free chunk.
+class ZstdEncoder : public ByteSink {
+public:
+    static constexpr int kDefaultLevel = 3;
+
+    explicit ZstdEncoder(int fd, int level = kDefaultLevel)
+        : fd_(fd), level_(level), thread_([this] { encode(); }) {}
+
+    ZstdEncoder(const ZstdEncoder&) = delete;
+    ZstdEncoder& operator=(const ZstdEncoder&) = delete;
+
+    ~ZstdEncoder() override { finish(); }
+
+    bool write(const char* data, size_t n) override {
+        while (n > 0) {
+            detail::CodecChunk chunk;
+            ring_.free.pop(chunk);
+            chunk.size = std::min(n, detail::ChunkRing::kCodecChunkBytes);
+            std::memcpy(chunk.data, data, chunk.size);
+            ring_.full.push(chunk);
+            data += chunk.size;
+            n -= chunk.size;
+        }
+        return !failed_.load(std::memory_order_acquire);
+    }
+
+    bool finish() override {
+        if (thread_.joinable()) {
+            ring_.full.close();
+            thread_.join();
+        }
+        return !failed_.load(std::memory_order_acquire);
+    }
+
+private:
+    void encode() {
+        std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> cctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+        ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_compressionLevel, level_);
+        std::vector<char> out(ZSTD_CStreamOutSize());
+        detail::CodecChunk chunk;
+        bool ok = true;
+        auto compress = [&](const char* data, size_t size, ZSTD_EndDirective mode) {
+            ZSTD_inBuffer input{data, size, 0};
+            size_t remaining;
+            do {
+                ZSTD_outBuffer output{out.data(), out.size(), 0};
+                remaining = ZSTD_compressStream2(cctx.get(), &output, &input, mode);
+                if (ZSTD_isError(remaining)) {
+                    return false;
+                }
+                if (!detail::write_fd(fd_, out.data(), output.pos)) {
+                    return false;
+                }
+            } while (mode == ZSTD_e_end ? remaining != 0 : input.pos < input.size);
+            return true;
+        };
+        while (ring_.full.pop(chunk)) {
+            ok = ok && compress(chunk.data, chunk.size, ZSTD_e_continue);
+            ring_.free.push(chunk);
+        }
+        ok = ok && compress(nullptr, 0, ZSTD_e_end);
+        if (!ok) {
+            failed_.store(true, std::memory_order_release);
+        }
+    }
+
+    int fd_;
+    int level_;
+    detail::ChunkRing ring_;
+    std::atomic<bool> failed_{false};
+    std::thread thread_; // Last: starts once everything above exists
+};
+
+#endif // MBP_ZSTD